@@ -74,11 +74,10 @@ struct _FpiDeviceAes1610
 {
   FpImageDevice parent;
 
-  guint8        read_regs_retry_count;
-  GSList       *strips;
-  gsize         strips_len;
-  gboolean      deactivating;
-  guint8        blanks_count;
+  guint8             read_regs_retry_count;
+  FpiFrameAssembler *assembler;
+  gboolean           deactivating;
+  guint8             blanks_count;
 };
 G_DECLARE_FINAL_TYPE (FpiDeviceAes1610, fpi_device_aes1610, FPI, DEVICE_AES1610,
                       FpImageDevice);
@@ -583,8 +582,8 @@ capture_read_strip_cb (FpiUsbTransfer *transfer, FpDevice *device,
       stripe->delta_y = 0;
       stripdata = stripe->data;
       memcpy (stripdata, data + 1, FRAME_WIDTH * (FRAME_HEIGHT / 2));
-      self->strips = g_slist_prepend (self->strips, stripe);
-      self->strips_len++;
+      fpi_frame_assembler_add_frame (self->assembler, stripe);
+      g_free (stripe);
       self->blanks_count = 0;
     }
   else
@@ -603,21 +602,19 @@ capture_read_strip_cb (FpiUsbTransfer *transfer, FpDevice *device,
   adjust_gain (data, GAIN_STATUS_NORMAL);
 
   /* stop capturing if MAX_FRAMES is reached */
-  if (self->blanks_count > 10 || g_slist_length (self->strips) >= MAX_FRAMES)
+  if (self->blanks_count > 10 || fpi_frame_assembler_get_n_frames (self->assembler) >= MAX_FRAMES)
     {
       FpImage *img;
+      gint64 start;
 
       fp_dbg ("sending stop capture.... blanks=%d  frames=%d",
-              self->blanks_count, g_slist_length (self->strips));
+              self->blanks_count, fpi_frame_assembler_get_n_frames (self->assembler));
       /* send stop capture bits */
       aes_write_regv (dev, capture_stop, G_N_ELEMENTS (capture_stop), stub_capture_stop_cb, NULL);
-      self->strips = g_slist_reverse (self->strips);
-      fpi_do_movement_estimation (&assembling_ctx, self->strips);
-      img = fpi_assemble_frames (&assembling_ctx, self->strips);
+      start = g_get_monotonic_time ();
+      img = fpi_frame_assembler_finish (self->assembler);
+      fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
 
-      g_slist_free_full (self->strips, g_free);
-      self->strips = NULL;
-      self->strips_len = 0;
       self->blanks_count = 0;
       fpi_image_device_image_captured (dev, img);
       fpi_image_device_report_finger_status (dev, FALSE);
@@ -792,9 +789,7 @@ complete_deactivation (FpImageDevice *dev)
    * maybe we can do this with a master reset, unconditionally? */
 
   self->deactivating = FALSE;
-  g_slist_free (self->strips);
-  self->strips = NULL;
-  self->strips_len = 0;
+  fpi_frame_assembler_reset (self->assembler);
   self->blanks_count = 0;
   fpi_image_device_deactivate_complete (dev, NULL);
 }
@@ -802,10 +797,13 @@ complete_deactivation (FpImageDevice *dev)
 static void
 dev_init (FpImageDevice *dev)
 {
+  FpiDeviceAes1610 *self = FPI_DEVICE_AES1610 (dev);
   GError *error = NULL;
 
   /* FIXME check endpoints */
 
+  self->assembler = fpi_frame_assembler_new (&assembling_ctx, TRUE);
+
   if (!g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error))
     {
       fpi_image_device_open_complete (dev, error);
@@ -818,8 +816,11 @@ dev_init (FpImageDevice *dev)
 static void
 dev_deinit (FpImageDevice *dev)
 {
+  FpiDeviceAes1610 *self = FPI_DEVICE_AES1610 (dev);
   GError *error = NULL;
 
+  g_clear_pointer (&self->assembler, fpi_frame_assembler_free);
+
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)),
                                   0, 0, &error);
   fpi_image_device_close_complete (dev, error);
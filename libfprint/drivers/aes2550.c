@@ -55,10 +55,9 @@ struct _FpiDeviceAes2550
 {
   FpImageDevice parent;
 
-  GSList       *strips;
-  size_t        strips_len;
-  gboolean      deactivating;
-  int           heartbeat_cnt;
+  FpiFrameAssembler *assembler;
+  gboolean           deactivating;
+  int                heartbeat_cnt;
 };
 G_DECLARE_FINAL_TYPE (FpiDeviceAes2550, fpi_device_aes2550, FPI, DEVICE_AES2550,
                       FpImageDevice);
@@ -208,10 +207,10 @@ process_strip_data (FpiSsm *ssm, FpImageDevice *dev,
   stripe->delta_y = -(int8_t) data[7];
   stripdata = stripe->data;
   memcpy (stripdata, data + 33, FRAME_WIDTH * FRAME_HEIGHT / 2);
-  self->strips = g_slist_prepend (self->strips, stripe);
-  self->strips_len++;
+  fpi_frame_assembler_add_frame (self->assembler, stripe);
 
   fp_dbg ("deltas: %dx%d", stripe->delta_x, stripe->delta_y);
+  g_free (stripe);
 
   return TRUE;
 }
@@ -224,15 +223,14 @@ capture_set_idle_reqs_cb (FpiUsbTransfer *transfer,
   FpImageDevice *dev = FP_IMAGE_DEVICE (device);
   FpiDeviceAes2550 *self = FPI_DEVICE_AES2550 (dev);
 
-  if (!error && self->strips_len)
+  if (!error && fpi_frame_assembler_get_n_frames (self->assembler))
     {
       FpImage *img;
+      gint64 start;
 
-      self->strips = g_slist_reverse (self->strips);
-      img = fpi_assemble_frames (&assembling_ctx, self->strips);
-      g_slist_free_full (self->strips, g_free);
-      self->strips = NULL;
-      self->strips_len = 0;
+      start = g_get_monotonic_time ();
+      img = fpi_frame_assembler_finish (self->assembler);
+      fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
       fpi_image_device_image_captured (dev, img);
       fpi_image_device_report_finger_status (dev, FALSE);
       /* marking machine complete will re-trigger finger detection loop */
@@ -521,19 +519,21 @@ complete_deactivation (FpImageDevice *dev)
   G_DEBUG_HERE ();
 
   self->deactivating = FALSE;
-  g_slist_free (self->strips);
-  self->strips = NULL;
-  self->strips_len = 0;
+  fpi_frame_assembler_reset (self->assembler);
   fpi_image_device_deactivate_complete (dev, NULL);
 }
 
 static void
 dev_init (FpImageDevice *dev)
 {
+  FpiDeviceAes2550 *self = FPI_DEVICE_AES2550 (dev);
   GError *error = NULL;
 
   /* TODO check that device has endpoints we're using */
 
+  /* The device reports the movement between frames itself */
+  self->assembler = fpi_frame_assembler_new (&assembling_ctx, FALSE);
+
   g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error);
 
   fpi_image_device_open_complete (dev, error);
@@ -542,8 +542,11 @@ dev_init (FpImageDevice *dev)
 static void
 dev_deinit (FpImageDevice *dev)
 {
+  FpiDeviceAes2550 *self = FPI_DEVICE_AES2550 (dev);
   GError *error = NULL;
 
+  g_clear_pointer (&self->assembler, fpi_frame_assembler_free);
+
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)),
                                   0, 0, &error);
   fpi_image_device_close_complete (dev, error);
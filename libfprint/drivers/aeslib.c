@@ -34,123 +34,119 @@
 
 struct write_regv_data
 {
-  unsigned int               num_regs;
-  const struct aes_regwrite *regs;
-  unsigned int               offset;
-  aes_write_regv_cb          callback;
-  void                      *user_data;
+  unsigned int      num_pending;
+  GCancellable     *cancellable;
+  GError           *error;
+  aes_write_regv_cb callback;
+  void             *user_data;
 };
 
-static void continue_write_regv (FpImageDevice          *dev,
-                                 struct write_regv_data *wdata);
-
-/* libusb bulk callback for regv write completion transfer. continues the
- * transaction */
+/* libusb bulk callback for regv write completion transfer. reports the
+ * result to the caller once all transfers of the write have completed */
 static void
 write_regv_trf_complete (FpiUsbTransfer *transfer, FpDevice *device,
                          gpointer user_data, GError *error)
 {
   struct write_regv_data *wdata = user_data;
 
-  if (error)
+  wdata->num_pending--;
+
+  if (error && !wdata->error)
     {
-      wdata->callback (FP_IMAGE_DEVICE (device), error, wdata->user_data);
-      g_free (wdata);
+      /* don't send the remaining writes */
+      wdata->error = error;
+      g_cancellable_cancel (wdata->cancellable);
     }
-  else
+  else if (error)
     {
-      continue_write_regv (FP_IMAGE_DEVICE (device), wdata);
+      g_error_free (error);
     }
+
+  if (wdata->num_pending > 0)
+    return;
+
+  if (!wdata->error)
+    fp_dbg ("all registers written");
+
+  wdata->callback (FP_IMAGE_DEVICE (device), wdata->error, wdata->user_data);
+  g_object_unref (wdata->cancellable);
+  g_free (wdata);
 }
 
-/* write from wdata->offset to upper_bound (inclusive) of wdata->regs */
+/* queue a transfer writing num registers starting at regs */
 static void
-do_write_regv (FpImageDevice *dev, struct write_regv_data *wdata, int upper_bound)
+do_write_regv (FpImageDevice *dev, struct write_regv_data *wdata,
+               const struct aes_regwrite *regs, unsigned int num)
 {
-  unsigned int offset = wdata->offset;
-  unsigned int num = upper_bound - offset + 1;
-  size_t alloc_size = num * 2;
   unsigned int i;
   size_t data_offset = 0;
   FpiUsbTransfer *transfer = fpi_usb_transfer_new (FP_DEVICE (dev));
 
-  fpi_usb_transfer_fill_bulk (transfer, EP_OUT, alloc_size);
+  fpi_usb_transfer_fill_bulk (transfer, EP_OUT, num * 2);
 
-  for (i = offset; i < offset + num; i++)
+  for (i = 0; i < num; i++)
     {
-      const struct aes_regwrite *regwrite = &wdata->regs[i];
-      transfer->buffer[data_offset++] = regwrite->reg;
-      transfer->buffer[data_offset++] = regwrite->value;
+      transfer->buffer[data_offset++] = regs[i].reg;
+      transfer->buffer[data_offset++] = regs[i].value;
     }
 
   transfer->short_is_error = TRUE;
-  fpi_usb_transfer_submit (transfer, BULK_TIMEOUT, NULL,
+  wdata->num_pending++;
+  fpi_usb_transfer_submit (transfer, BULK_TIMEOUT, wdata->cancellable,
                            write_regv_trf_complete, wdata);
 }
 
-/* write the next batch of registers to be written, or if there are no more,
- * indicate completion to the caller */
-static void
-continue_write_regv (FpImageDevice *dev, struct write_regv_data *wdata)
-{
-  unsigned int offset = wdata->offset;
-  unsigned int regs_remaining;
-  unsigned int limit;
-  unsigned int upper_bound;
-  int i;
-
-  /* skip all zeros and ensure there is still work to do */
-  while (TRUE)
-    {
-      if (offset >= wdata->num_regs)
-        {
-          fp_dbg ("all registers written");
-          wdata->callback (dev, 0, wdata->user_data);
-          g_free (wdata);
-          return;
-        }
-      if (wdata->regs[offset].reg)
-        break;
-      offset++;
-    }
-
-  wdata->offset = offset;
-  regs_remaining = wdata->num_regs - offset;
-  limit = MIN (regs_remaining, MAX_REGWRITES_PER_REQUEST);
-  upper_bound = offset + limit - 1;
-
-  /* determine if we can write the entire of the regs at once, or if there
-   * is a zero dividing things up */
-  for (i = offset; i <= upper_bound; i++)
-    if (!wdata->regs[i].reg)
-      {
-        upper_bound = i - 1;
-        break;
-      }
-
-  do_write_regv (dev, wdata, upper_bound);
-
-  wdata->offset = upper_bound + 1;
-}
-
 /* write a load of registers to the device, combining multiple writes in a
  * single URB up to a limit. insert writes to non-existent register 0 to force
- * specific groups of writes to be separated by different URBs. */
+ * specific groups of writes to be separated by different URBs.
+ *
+ * all URBs are queued at once rather than waiting for each one to complete
+ * before sending the next. bulk transfers on an endpoint are processed in
+ * order, so the device still sees the writes in the same order and split
+ * into the same URBs, but without a round trip per URB. */
 void
 aes_write_regv (FpImageDevice *dev, const struct aes_regwrite *regs,
                 unsigned int num_regs, aes_write_regv_cb callback,
                 void *user_data)
 {
   struct write_regv_data *wdata;
+  unsigned int offset = 0;
 
   fp_dbg ("write %d regs", num_regs);
-  wdata = g_malloc (sizeof (*wdata));
-  wdata->num_regs = num_regs;
-  wdata->regs = regs;
-  wdata->offset = 0;
+  wdata = g_new0 (struct write_regv_data, 1);
+  wdata->cancellable = g_cancellable_new ();
   wdata->callback = callback;
   wdata->user_data = user_data;
-  continue_write_regv (dev, wdata);
+
+  while (offset < num_regs)
+    {
+      unsigned int num = 0;
+
+      /* skip all zeros */
+      if (!regs[offset].reg)
+        {
+          offset++;
+          continue;
+        }
+
+      /* write as many regs at once as the limit allows, unless there is a
+       * zero dividing things up */
+      while (num < MAX_REGWRITES_PER_REQUEST &&
+             offset + num < num_regs &&
+             regs[offset + num].reg)
+        num++;
+
+      do_write_regv (dev, wdata, &regs[offset], num);
+      offset += num;
+    }
+
+  if (wdata->num_pending == 0)
+    {
+      fp_dbg ("all registers written");
+      callback (dev, NULL, user_data);
+      g_object_unref (wdata->cancellable);
+      g_free (wdata);
+    }
 }
 
 unsigned char
@@ -30,8 +30,7 @@
 typedef struct
 {
   GByteArray         *stripe_packet;
-  GSList             *strips;
-  size_t              strips_len;
+  FpiFrameAssembler  *assembler;
   gboolean            deactivating;
   struct aesX660_cmd *init_seq;
   size_t              init_seq_len;
@@ -307,8 +306,8 @@ process_stripe_data (FpiSsm *ssm, FpiDeviceAesX660 *self,
     {
       memcpy (stripdata, data + AESX660_IMAGE_OFFSET, cls->assembling_ctx->frame_width * FRAME_HEIGHT / 2);
 
-      priv->strips = g_slist_prepend (priv->strips, stripe);
-      priv->strips_len++;
+      fpi_frame_assembler_add_frame (priv->assembler, stripe);
+      g_free (stripe);
       return data[AESX660_LAST_FRAME_OFFSET] & AESX660_LAST_FRAME_BIT;
     }
 
@@ -323,18 +322,15 @@ capture_set_idle_cmd_cb (FpiUsbTransfer *transfer, FpDevice *device,
   FpImageDevice *dev = FP_IMAGE_DEVICE (device);
   FpiDeviceAesX660 *self = FPI_DEVICE_AES_X660 (device);
   FpiDeviceAesX660Private *priv = fpi_device_aes_x660_get_instance_private (self);
-  FpiDeviceAesX660Class *cls = FPI_DEVICE_AES_X660_GET_CLASS (self);
 
   if (!error)
     {
       FpImage *img;
+      gint64 start;
 
-      priv->strips = g_slist_reverse (priv->strips);
-      img = fpi_assemble_frames (cls->assembling_ctx, priv->strips);
-      g_slist_foreach (priv->strips, (GFunc) g_free, NULL);
-      g_slist_free (priv->strips);
-      priv->strips = NULL;
-      priv->strips_len = 0;
+      start = g_get_monotonic_time ();
+      img = fpi_frame_assembler_finish (priv->assembler);
+      fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
       fpi_image_device_image_captured (dev, img);
       fpi_image_device_report_finger_status (dev, FALSE);
       fpi_ssm_mark_completed (transfer->ssm);
@@ -439,7 +435,7 @@ capture_run_state (FpiSsm *ssm, FpDevice *_dev)
       break;
 
     case CAPTURE_SET_IDLE:
-      fp_dbg ("Got %lu frames\n", priv->strips_len);
+      fp_dbg ("Got %u frames\n", fpi_frame_assembler_get_n_frames (priv->assembler));
       aesX660_send_cmd (ssm, _dev, set_idle_cmd, sizeof (set_idle_cmd),
                         capture_set_idle_cmd_cb);
       break;
@@ -686,11 +682,14 @@ aesX660_dev_init (FpImageDevice *dev)
 {
   FpiDeviceAesX660 *self = FPI_DEVICE_AES_X660 (dev);
   FpiDeviceAesX660Private *priv = fpi_device_aes_x660_get_instance_private (self);
+  FpiDeviceAesX660Class *cls = FPI_DEVICE_AES_X660_GET_CLASS (self);
   GError *error = NULL;
 
   g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error);
 
   priv->stripe_packet = g_byte_array_new ();
+  /* The device reports the movement between frames itself */
+  priv->assembler = fpi_frame_assembler_new (cls->assembling_ctx, FALSE);
 
   fpi_image_device_open_complete (dev, error);
 }
@@ -706,6 +705,7 @@ aesX660_dev_deinit (FpImageDevice *dev)
                                   0, 0, &error);
 
   g_clear_pointer (&priv->stripe_packet, g_byte_array_unref);
+  g_clear_pointer (&priv->assembler, fpi_frame_assembler_free);
 
   fpi_image_device_close_complete (dev, error);
 }
@@ -720,9 +720,7 @@ complete_deactivation (FpImageDevice *dev)
   G_DEBUG_HERE ();
 
   priv->deactivating = FALSE;
-  g_slist_free (priv->strips);
-  priv->strips = NULL;
-  priv->strips_len = 0;
+  fpi_frame_assembler_reset (priv->assembler);
   fpi_image_device_deactivate_complete (dev, NULL);
 }
 
@@ -53,6 +53,7 @@ static struct fpi_frame_asmbl_ctx assembling_ctx = {
   .frame_width = 0,
   .frame_height = 0,
   .image_width = 0,
+  .linear_frames = TRUE,
   .get_pixel = elan_get_pixel,
 };
 
@@ -63,8 +64,7 @@ struct _FpiDeviceElan
   /* device config */
   unsigned short dev_type;
   unsigned short fw_ver;
-  void           (*process_frame) (unsigned short *raw_frame,
-                                   GSList       ** frames);
+  struct fpi_frame *(*process_frame) (unsigned short *raw_frame);
   /* end device config */
 
   /* commands */
@@ -85,18 +85,13 @@ struct _FpiDeviceElan
   unsigned char       raw_frame_height;
   int                 num_frames;
   GSList             *frames;
+  FpiFrameAssembler  *assembler;
   /* end state */
 };
 G_DECLARE_FINAL_TYPE (FpiDeviceElan, fpi_device_elan, FPI, DEVICE_ELAN,
                       FpImageDevice);
 G_DEFINE_TYPE (FpiDeviceElan, fpi_device_elan, FP_TYPE_IMAGE_DEVICE);
 
-static int
-cmp_short (const void *a, const void *b)
-{
-  return (int) (*(short *) a - *(short *) b);
-}
-
 static void
 elan_dev_reset_state (FpiDeviceElan *elandev)
 {
@@ -113,10 +108,35 @@ elan_dev_reset_state (FpiDeviceElan *elandev)
   g_slist_free_full (elandev->frames, g_free);
   elandev->frames = NULL;
   elandev->num_frames = 0;
+
+  if (elandev->assembler)
+    fpi_frame_assembler_reset (elandev->assembler);
 }
 
-static void
-elan_save_frame (FpiDeviceElan *self, unsigned short *frame)
+/* Rotated frames are transposed in tiles of this size */
+#define ELAN_TILE_SIZE 16
+
+static inline unsigned int
+elan_store_pixel (unsigned short       *frame,
+                  const unsigned short *background,
+                  int                   frame_idx,
+                  unsigned short        px)
+{
+  if (background)
+    px = background[frame_idx] > px ? 0 : px - background[frame_idx];
+
+  frame[frame_idx] = px;
+
+  return px;
+}
+
+/* Copies the frame from the last read into @frame. If @background is given
+ * it is subtracted in the same pass, clamping at zero. Returns the sum of
+ * the stored pixels. */
+static unsigned int
+elan_save_frame (FpiDeviceElan        *self,
+                 unsigned short       *frame,
+                 const unsigned short *background)
 {
   G_DEBUG_HERE ();
 
@@ -138,19 +158,39 @@ elan_save_frame (FpiDeviceElan *self, unsigned short *frame)
   unsigned char frame_height = self->frame_height;
   unsigned char raw_height = self->raw_frame_height;
   unsigned char frame_margin = (raw_height - self->frame_height) / 2;
-  int frame_idx, raw_idx;
+  const unsigned short *raw = (unsigned short *) self->last_read;
+  unsigned int sum = 0;
+
+  if (self->dev_type & ELAN_NOT_ROTATED)
+    {
+      for (int y = 0; y < frame_height; y++)
+        for (int x = 0; x < frame_width; x++)
+          sum += elan_store_pixel (frame, background, x + y * frame_width,
+                                   raw[x + (y + frame_margin) * frame_width]);
+
+      return sum;
+    }
 
-  for (int y = 0; y < frame_height; y++)
-    for (int x = 0; x < frame_width; x++)
+  /* The raw frame is stored column by column. Walk it in tiles, so that
+   * the raw columns are read sequentially while the frame rows written
+   * stay in cache. */
+  for (int y0 = 0; y0 < frame_height; y0 += ELAN_TILE_SIZE)
+    for (int x0 = 0; x0 < frame_width; x0 += ELAN_TILE_SIZE)
       {
-        if (self->dev_type & ELAN_NOT_ROTATED)
-          raw_idx = x + (y + frame_margin) * frame_width;
-        else
-          raw_idx = frame_margin + y + x * raw_height;
-        frame_idx = x + y * frame_width;
-        frame[frame_idx] =
-          ((unsigned short *) self->last_read)[raw_idx];
+        int y1 = MIN (y0 + ELAN_TILE_SIZE, frame_height);
+        int x1 = MIN (x0 + ELAN_TILE_SIZE, frame_width);
+
+        for (int x = x0; x < x1; x++)
+          {
+            const unsigned short *column = raw + frame_margin + x * raw_height;
+
+            for (int y = y0; y < y1; y++)
+              sum += elan_store_pixel (frame, background, x + y * frame_width,
+                                       column[y]);
+          }
       }
+
+  return sum;
 }
 
 static void
@@ -162,7 +202,7 @@ elan_save_background (FpiDeviceElan *elandev)
   elandev->background =
     g_malloc (elandev->frame_width * elandev->frame_height *
               sizeof (short));
-  elan_save_frame (elandev, elandev->background);
+  elan_save_frame (elandev, elandev->background, NULL);
 }
 
 /* save a frame as part of the fingerprint image
@@ -207,17 +247,9 @@ elan_save_img_frame (FpiDeviceElan *elandev)
 
   unsigned int frame_size = elandev->frame_width * elandev->frame_height;
   unsigned short *frame = g_malloc (frame_size * sizeof (short));
-  elan_save_frame (elandev, frame);
-  unsigned int sum = 0;
+  unsigned int sum;
 
-  for (int i = 0; i < frame_size; i++)
-    {
-      if (elandev->background[i] > frame[i])
-        frame[i] = 0;
-      else
-        frame[i] -= elandev->background[i];
-      sum += frame[i];
-    }
+  sum = elan_save_frame (elandev, frame, elandev->background);
 
   if (sum == 0)
     {
@@ -229,12 +261,26 @@ elan_save_img_frame (FpiDeviceElan *elandev)
 
   elandev->frames = g_slist_prepend (elandev->frames, frame);
   elandev->num_frames += 1;
+
+  /* The last frames of a swipe are dropped, so a frame is only assembled
+   * once ELAN_SKIP_LAST_FRAMES newer ones have been captured */
+  if (elandev->num_frames > ELAN_SKIP_LAST_FRAMES)
+    {
+      GSList *l = g_slist_nth (elandev->frames, ELAN_SKIP_LAST_FRAMES);
+      struct fpi_frame *fpi_frame = elandev->process_frame (l->data);
+
+      fpi_frame_assembler_add_frame (elandev->assembler, fpi_frame);
+      g_free (fpi_frame);
+
+      g_free (l->data);
+      elandev->frames = g_slist_delete_link (elandev->frames, l);
+    }
+
   return 0;
 }
 
-static void
-elan_process_frame_linear (unsigned short *raw_frame,
-                           GSList       ** frames)
+static struct fpi_frame *
+elan_process_frame_linear (unsigned short *raw_frame)
 {
   unsigned int frame_size =
     assembling_ctx.frame_width * assembling_ctx.frame_height;
@@ -262,12 +308,39 @@ elan_process_frame_linear (unsigned short *raw_frame,
       frame->data[i] = (unsigned char) px;
     }
 
-  *frames = g_slist_prepend (*frames, frame);
+  return frame;
 }
 
-static void
-elan_process_frame_thirds (unsigned short *raw_frame,
-                           GSList       ** frames)
+/* Percentiles are found with a histogram of the high byte of the pixels,
+ * followed by one of the low byte within the bin holding the rank. */
+#define ELAN_HIST_BINS 256
+
+/* Returns the pixel that would be at index @rank if @data was sorted */
+static unsigned short
+elan_find_rank (const unsigned short *data,
+                unsigned int          size,
+                const unsigned int   *high_hist,
+                unsigned int          rank)
+{
+  unsigned int low_hist[ELAN_HIST_BINS] = { 0, };
+  unsigned int count = 0;
+  unsigned int high, low;
+
+  for (high = 0; count + high_hist[high] <= rank; high++)
+    count += high_hist[high];
+
+  for (int i = 0; i < size; i++)
+    if (data[i] >> 8 == high)
+      low_hist[data[i] & 0xff]++;
+
+  for (low = 0; count + low_hist[low] <= rank; low++)
+    count += low_hist[low];
+
+  return high << 8 | low;
+}
+
+static struct fpi_frame *
+elan_process_frame_thirds (unsigned short *raw_frame)
 {
   G_DEBUG_HERE ();
 
@@ -276,15 +349,19 @@ elan_process_frame_thirds (unsigned short *raw_frame,
   struct fpi_frame *frame =
     g_malloc (frame_size + sizeof (struct fpi_frame));
 
-  unsigned short lvl0, lvl1, lvl2, lvl3;
-  unsigned short *sorted = g_malloc (frame_size * sizeof (short));
-  memcpy (sorted, raw_frame, frame_size * sizeof (short));
-  qsort (sorted, frame_size, sizeof (short), cmp_short);
-  lvl0 = sorted[0];
-  lvl1 = sorted[frame_size * 3 / 10];
-  lvl2 = sorted[frame_size * 65 / 100];
-  lvl3 = sorted[frame_size - 1];
-  g_free (sorted);
+  unsigned short lvl0 = 0xffff, lvl1, lvl2, lvl3 = 0;
+  unsigned int high_hist[ELAN_HIST_BINS] = { 0, };
+
+  for (int i = 0; i < frame_size; i++)
+    {
+      if (raw_frame[i] < lvl0)
+        lvl0 = raw_frame[i];
+      if (raw_frame[i] > lvl3)
+        lvl3 = raw_frame[i];
+      high_hist[raw_frame[i] >> 8]++;
+    }
+  lvl1 = elan_find_rank (raw_frame, frame_size, high_hist, frame_size * 3 / 10);
+  lvl2 = elan_find_rank (raw_frame, frame_size, high_hist, frame_size * 65 / 100);
 
   unsigned short px;
   for (int i = 0; i < frame_size; i++)
@@ -299,29 +376,21 @@ elan_process_frame_thirds (unsigned short *raw_frame,
       frame->data[i] = (unsigned char) px;
     }
 
-  *frames = g_slist_prepend (*frames, frame);
+  return frame;
 }
 
 static void
 elan_submit_image (FpImageDevice *dev)
 {
   FpiDeviceElan *self = FPI_DEVICE_ELAN (dev);
-  GSList *raw_frames;
-  GSList *frames = NULL;
   FpImage *img;
+  gint64 start;
 
   G_DEBUG_HERE ();
 
-  raw_frames = g_slist_nth (self->frames, ELAN_SKIP_LAST_FRAMES);
-
-  assembling_ctx.frame_width = self->frame_width;
-  assembling_ctx.frame_height = self->frame_height;
-  assembling_ctx.image_width = self->frame_width * 3 / 2;
-  g_slist_foreach (raw_frames, (GFunc) self->process_frame, &frames);
-  fpi_do_movement_estimation (&assembling_ctx, frames);
-  img = fpi_assemble_frames (&assembling_ctx, frames);
-
-  g_slist_free_full (frames, g_free);
+  start = g_get_monotonic_time ();
+  img = fpi_frame_assembler_finish (self->assembler);
+  fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
 
   fpi_image_device_image_captured (dev, img);
 }
@@ -617,6 +686,11 @@ elan_capture (FpDevice *dev)
   G_DEBUG_HERE ();
 
   elan_dev_reset_state (self);
+
+  assembling_ctx.frame_width = self->frame_width;
+  assembling_ctx.frame_height = self->frame_height;
+  assembling_ctx.image_width = self->frame_width * 3 / 2;
+
   FpiSsm *ssm =
     fpi_ssm_new (dev, capture_run_state, CAPTURE_NUM_STATES);
   fpi_ssm_start (ssm, capture_complete);
@@ -915,6 +989,7 @@ dev_init (FpImageDevice *dev)
   self->dev_type = fpi_device_get_driver_data (FP_DEVICE (dev));
   self->background = NULL;
   self->process_frame = elan_process_frame_thirds;
+  self->assembler = fpi_frame_assembler_new (&assembling_ctx, TRUE);
 
   switch (self->dev_type)
     {
@@ -935,6 +1010,7 @@ dev_deinit (FpImageDevice *dev)
   G_DEBUG_HERE ();
 
   elan_dev_reset_state (self);
+  g_clear_pointer (&self->assembler, fpi_frame_assembler_free);
   g_free (self->background);
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)),
                                   0, 0, &error);
@@ -116,22 +116,11 @@ upeksonly_get_deviation2 (struct fpi_line_asmbl_ctx *ctx,
                           GSList *line1, GSList *line2)
 {
   unsigned char *buf1 = line1->data, *buf2 = line2->data;
-  int res = 0, mean = 0, i;
 
   g_assert (ctx->line_width > 0);
 
-  for (i = 0; i < ctx->line_width; i += 2)
-    mean += (int) buf1[i + 1] + (int) buf2[i];
-
-  mean /= (ctx->line_width / 2);
-
-  for (i = 0; i < ctx->line_width; i += 2)
-    {
-      int dev = (int) buf1[i + 1] + (int) buf2[i] - mean;
-      res += dev * dev;
-    }
-
-  return res / (ctx->line_width / 2);
+  /* Odd pixels of the first line, even pixels of the second one */
+  return fpi_sum_std_sq_dev (buf1 + 1, buf2, ctx->line_width / 2, 2);
 }
 
 
@@ -218,6 +207,7 @@ handoff_img (FpImageDevice *dev)
 {
   FpiDeviceUpeksonly *self = FPI_DEVICE_UPEKSONLY (dev);
   FpImage *img;
+  gint64 start;
 
   GSList *elem = self->rows;
 
@@ -230,7 +220,9 @@ handoff_img (FpImageDevice *dev)
   self->rows = g_slist_reverse (self->rows);
 
   fp_dbg ("%lu rows", self->num_rows);
+  start = g_get_monotonic_time ();
   img = fpi_assemble_lines (&self->assembling_ctx, self->rows, self->num_rows);
+  fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
 
   g_slist_free_full (self->rows, g_free);
   self->rows = NULL;
@@ -698,8 +690,6 @@ sm_read_reg_cb (FpiUsbTransfer *transfer, FpDevice *device,
       fp_dbg ("read reg result = %02x", self->read_reg_result);
       fpi_ssm_next_state (transfer->ssm);
     }
-
-  g_free (transfer->buffer);
 }
 
 static void
@@ -736,7 +726,6 @@ sm_await_intr_cb (FpiUsbTransfer *transfer, FpDevice *device,
 
   if (error)
     {
-      g_free (transfer->buffer);
       fpi_ssm_mark_failed (transfer->ssm, error);
       return;
     }
@@ -744,7 +733,6 @@ sm_await_intr_cb (FpiUsbTransfer *transfer, FpDevice *device,
   fp_dbg ("interrupt received: %02x %02x %02x %02x",
           transfer->buffer[0], transfer->buffer[1],
           transfer->buffer[2], transfer->buffer[3]);
-  g_free (transfer->buffer);
 
   self->finger_state = FINGER_DETECTED;
   fpi_image_device_report_finger_status (dev, TRUE);
@@ -0,0 +1,129 @@
+/*
+ * Digital Persona U.are.U 4000/4000B/4500 image decoding
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * Copyright (C) 2012 Timo Teräs <timo.teras@iki.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "uru4000_decode.h"
+
+static uint32_t
+update_key (uint32_t key)
+{
+  /* linear feedback shift register
+   * taps at bit positions 1 3 4 7 11 13 20 23 26 29 32 */
+  uint32_t bit = key & 0x9248144d;
+
+  bit ^= bit << 16;
+  bit ^= bit << 8;
+  bit ^= bit << 4;
+  bit ^= bit << 2;
+  bit ^= bit << 1;
+  return (bit & 0x80000000) | (key >> 1);
+}
+
+static uint8_t
+calc_xorbyte (uint32_t key)
+{
+  uint8_t xorbyte;
+
+  xorbyte  = ((key >>  4) & 1) << 0;
+  xorbyte |= ((key >>  8) & 1) << 1;
+  xorbyte |= ((key >> 11) & 1) << 2;
+  xorbyte |= ((key >> 14) & 1) << 3;
+  xorbyte |= ((key >> 18) & 1) << 4;
+  xorbyte |= ((key >> 21) & 1) << 5;
+  xorbyte |= ((key >> 24) & 1) << 6;
+  xorbyte |= ((key >> 29) & 1) << 7;
+
+  return xorbyte;
+}
+
+/* Both the key update and the xor byte are linear over GF(2), so they can
+ * be computed from independent lookups of each byte of the key.
+ * feedback_table yields the 8 bits that update_key() shifts in over
+ * 8 steps, xorbyte_table the result of calc_xorbyte(). */
+static uint8_t feedback_table[4][256];
+static uint8_t xorbyte_table[4][256];
+
+void
+uru4000_init_decode_tables (void)
+{
+  int i, j, b;
+
+  for (i = 0; i < 4; i++)
+    {
+      for (b = 0; b < 256; b++)
+        {
+          uint32_t key = (uint32_t) b << (i * 8);
+          uint32_t next = key;
+
+          for (j = 0; j < 8; j++)
+            next = update_key (next);
+
+          feedback_table[i][b] = next >> 24;
+          xorbyte_table[i][b] = calc_xorbyte (key);
+        }
+    }
+}
+
+#define KEY_TABLE_LOOKUP(table, key) \
+  (table[0][(key) & 0xff] ^ table[1][((key) >> 8) & 0xff] ^ \
+   table[2][((key) >> 16) & 0xff] ^ table[3][(key) >> 24])
+
+uint32_t
+uru4000_advance_key (uint32_t key,
+                     int      steps)
+{
+  for (; steps >= 8; steps -= 8)
+    key = (key >> 8) | ((uint32_t) KEY_TABLE_LOOKUP (feedback_table, key) << 24);
+
+  for (; steps > 0; steps--)
+    key = update_key (key);
+
+  return key;
+}
+
+uint32_t
+uru4000_decode (uint8_t *data,
+                int      num_bytes,
+                uint32_t key)
+{
+  uint64_t window = 0;
+  int i;
+
+  for (i = 0; i < num_bytes - 1; i++)
+    {
+      uint32_t cur;
+
+      /* The keys of the next 8 bytes are consecutive bit windows of
+       * the key followed by its next 8 feedback bits. */
+      if (i % 8 == 0)
+        window = key | (uint64_t) KEY_TABLE_LOOKUP (feedback_table, key) << 32;
+
+      cur = window >> (i % 8);
+
+      /* decrypt data */
+      data[i] = data[i + 1] ^ KEY_TABLE_LOOKUP (xorbyte_table, cur);
+
+      if (i % 8 == 7)
+        key = window >> 8;
+    }
+
+  /* the final byte is implicitly zero */
+  data[i] = 0;
+  return uru4000_advance_key (key, i % 8 + 1);
+}
@@ -0,0 +1,35 @@
+/*
+ * Digital Persona U.are.U 4000/4000B/4500 image decoding
+ * Copyright (C) 2007-2008 Daniel Drake <dsd@gentoo.org>
+ * Copyright (C) 2012 Timo Teräs <timo.teras@iki.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Image decryption of the 4000B and 4500. uru4000_init_decode_tables()
+ * must be called once before decoding. */
+
+void uru4000_init_decode_tables (void);
+
+uint32_t uru4000_advance_key (uint32_t key,
+                              int      steps);
+
+uint32_t uru4000_decode (uint8_t *data,
+                         int      num_bytes,
+                         uint32_t key);
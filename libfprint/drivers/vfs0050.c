@@ -162,14 +162,6 @@ async_abort (FpDevice *dev, FpiSsm *ssm, int ep)
 
 /* Image processing functions */
 
-/* Pixel getter for fpi_assemble_lines */
-static unsigned char
-vfs0050_get_pixel (struct fpi_line_asmbl_ctx *ctx,
-                   GSList * line, unsigned int x)
-{
-  return ((struct vfs_line *) line->data)->data[x];
-}
-
 /* Deviation getter for fpi_assemble_lines */
 static int
 vfs0050_get_difference (struct fpi_line_asmbl_ctx *ctx,
@@ -178,15 +170,9 @@ vfs0050_get_difference (struct fpi_line_asmbl_ctx *ctx,
   struct vfs_line *line1 = line_list_1->data;
   struct vfs_line *line2 = line_list_2->data;
   const int shift = (VFS_IMAGE_WIDTH - VFS_NEXT_LINE_WIDTH) / 2 - 1;
-  int res = 0;
 
-  for (int i = 0; i < VFS_NEXT_LINE_WIDTH; ++i)
-    {
-      int x =
-        (int) line1->next_line_part[i] - (int) line2->data[shift + i];
-      res += x * x;
-    }
-  return res;
+  return fpi_sum_sq_diff (line1->next_line_part, line2->data + shift,
+                          VFS_NEXT_LINE_WIDTH);
 }
 
 #define VFS_NOISE_THRESHOLD 40
@@ -212,8 +198,9 @@ static struct fpi_line_asmbl_ctx assembling_ctx = {
   .resolution = 10,
   .median_filter_size = 25,
   .max_search_offset = 100,
+  .linear_lines = TRUE,
+  .pixel_offset = G_STRUCT_OFFSET (struct vfs_line, data),
   .get_deviation = vfs0050_get_difference,
-  .get_pixel = vfs0050_get_pixel,
 };
 
 /* Processes image before submitting */
@@ -221,6 +208,8 @@ static FpImage *
 prepare_image (FpDeviceVfs0050 *vdev)
 {
   int height = vdev->bytes / VFS_LINE_SIZE;
+  FpImage *img;
+  gint64 start;
 
   /* Noise cleaning. IMHO, it works pretty well
      I've not detected cases when it doesn't work or cuts a part of the finger
@@ -238,15 +227,19 @@ prepare_image (FpDeviceVfs0050 *vdev)
   if (height < VFS_IMAGE_WIDTH)
     return NULL;
 
-  /* Building GSList */
-  GSList *lines = NULL;
-  for (int i = height - 1; i >= 0; --i)
-    lines = g_slist_prepend (lines, vdev->lines_buffer + i);
+  /* The received lines are already stored contiguously */
+  struct fpi_asmbl_ring lines = {
+    .data = (unsigned char *) vdev->lines_buffer,
+    .stride = sizeof (struct vfs_line),
+    .capacity = height,
+    .len = height,
+  };
 
   /* Perform line assembling */
-  FpImage *img = fpi_assemble_lines (&assembling_ctx, lines, height);
+  start = g_get_monotonic_time ();
+  img = fpi_assemble_lines_ring (&assembling_ctx, &lines);
+  fpi_device_add_scan_timing (FP_DEVICE (vdev), "assemble", start);
 
-  g_slist_free (lines);
   return img;
 }
 
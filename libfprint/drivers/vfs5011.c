@@ -208,41 +208,16 @@ usb_exchange_async (FpiSsm                  *ssm,
 static int
 vfs5011_get_deviation2 (struct fpi_line_asmbl_ctx *ctx, GSList *row1, GSList *row2)
 {
-  unsigned char *buf1, *buf2;
-  int res = 0, mean = 0, i;
-  const int size = 64;
-
-  buf1 = (unsigned char *) row1->data + 56;
-  buf2 = (unsigned char *) row2->data + 168;
-
-  for (i = 0; i < size; i++)
-    mean += (int) buf1[i] + (int) buf2[i];
-
-  mean /= size;
-
-  for (i = 0; i < size; i++)
-    {
-      int dev = (int) buf1[i] + (int) buf2[i] - mean;
-      res += dev * dev;
-    }
-
-  return res / size;
-}
-
-static unsigned char
-vfs5011_get_pixel (struct fpi_line_asmbl_ctx *ctx,
-                   GSList                    *row,
-                   unsigned                   x)
-{
-  unsigned char *data = (unsigned char *) row->data + 8;
-
-  return data[x];
+  return fpi_sum_std_sq_dev ((unsigned char *) row1->data + 56,
+                             (unsigned char *) row2->data + 168,
+                             64, 1);
 }
 
 /* ====================== main stuff ======================= */
 
 enum {
   CAPTURE_LINES = 256,
+  CAPTURE_BUFFERS = 4,
   MAXLINES = 2000,
   MAX_CAPTURE_LINES = 100000,
 };
@@ -253,8 +228,9 @@ static struct fpi_line_asmbl_ctx assembling_ctx = {
   .resolution = 10,
   .median_filter_size = 25,
   .max_search_offset = 30,
+  .linear_lines = TRUE,
+  .pixel_offset = 8,
   .get_deviation = vfs5011_get_deviation2,
-  .get_pixel = vfs5011_get_pixel,
 };
 
 struct _FpDeviceVfs5011
@@ -262,13 +238,16 @@ struct _FpDeviceVfs5011
   FpImageDevice           parent;
 
   unsigned char          *total_buffer;
-  unsigned char          *capture_buffer;
+  FpiUsbStream           *capture_stream;
   unsigned char          *row_buffer;
   unsigned char          *lastline;
-  GSList                 *rows;
+  struct fpi_asmbl_ring   rows;
   int                     lines_captured, lines_recorded, empty_lines;
   int                     max_lines_captured, max_lines_recorded;
   int                     lines_total, lines_total_allocated;
+  /* Capture rate, lines received after the first chunk of data */
+  int                     lines_received;
+  gint64                  capture_start_us, capture_end_us;
   gboolean                loop_running;
   gboolean                deactivating;
   struct usbexchange_data init_sequence;
@@ -298,6 +277,7 @@ capture_init (FpDeviceVfs5011 *self, int max_captured,
 {
   fp_dbg ("capture_init");
   self->lastline = NULL;
+  fpi_asmbl_ring_reset (&self->rows);
   self->lines_captured = 0;
   self->lines_recorded = 0;
   self->empty_lines = 0;
@@ -306,10 +286,38 @@ capture_init (FpDeviceVfs5011 *self, int max_captured,
   self->total_buffer = NULL;
   self->max_lines_captured = max_captured;
   self->max_lines_recorded = max_recorded;
+  self->lines_received = 0;
+  self->capture_start_us = 0;
+  self->capture_end_us = 0;
+}
+
+static void
+capture_update_rate (FpDeviceVfs5011 *self, int transferred)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (self->capture_start_us == 0)
+    self->capture_start_us = now;
+  else
+    self->lines_received += transferred / VFS5011_LINE_SIZE;
+  self->capture_end_us = now;
+}
+
+static void
+capture_log_rate (FpDeviceVfs5011 *self)
+{
+  if (self->capture_end_us <= self->capture_start_us)
+    return;
+
+  fp_dbg ("capture: received %d lines in %" G_GINT64_FORMAT " us, %.0f lines/s",
+          self->lines_received, self->capture_end_us - self->capture_start_us,
+          self->lines_received * (double) G_USEC_PER_SEC /
+          (self->capture_end_us - self->capture_start_us));
 }
 
 static int
-process_chunk (FpDeviceVfs5011 *self, int transferred)
+process_chunk (FpDeviceVfs5011 *self, const unsigned char *buf,
+               int transferred)
 {
   enum {
     DEVIATION_THRESHOLD = 15 * 15,
@@ -323,8 +331,7 @@ process_chunk (FpDeviceVfs5011 *self, int transferred)
 
   for (i = 0; i < lines_captured; i++)
     {
-      unsigned char *linebuf = self->capture_buffer
-                               + i * VFS5011_LINE_SIZE;
+      const unsigned char *linebuf = buf + i * VFS5011_LINE_SIZE;
 
       if (fpi_std_sq_dev (linebuf + 8, VFS5011_IMAGE_WIDTH)
           < DEVIATION_THRESHOLD)
@@ -358,9 +365,7 @@ process_chunk (FpDeviceVfs5011 *self, int transferred)
                                   linebuf + 8,
                                   VFS5011_IMAGE_WIDTH) >= DIFFERENCE_THRESHOLD))
         {
-          self->lastline = g_malloc (VFS5011_LINE_SIZE);
-          self->rows = g_slist_prepend (self->rows,
-                                        self->lastline);
+          self->lastline = fpi_asmbl_ring_push (&self->rows);
           memmove (self->lastline, linebuf, VFS5011_LINE_SIZE);
           self->lines_recorded++;
           if (self->lines_recorded >= self->max_lines_recorded)
@@ -380,6 +385,7 @@ submit_image (FpiSsm          *ssm,
               FpImageDevice   *dev)
 {
   FpImage *img;
+  gint64 start;
 
   if (self->lines_recorded == 0)
     {
@@ -388,15 +394,13 @@ submit_image (FpiSsm          *ssm,
       return;
     }
 
-  g_assert (self->rows != NULL);
-
-  self->rows = g_slist_reverse (self->rows);
+  g_assert (self->rows.len == self->lines_recorded);
 
-  img = fpi_assemble_lines (&assembling_ctx, self->rows,
-                            self->lines_recorded);
+  start = g_get_monotonic_time ();
+  img = fpi_assemble_lines_ring (&assembling_ctx, &self->rows);
+  fpi_device_add_scan_timing (FP_DEVICE (dev), "assemble", start);
 
-  g_slist_free_full (self->rows, g_free);
-  self->rows = NULL;
+  fpi_asmbl_ring_reset (&self->rows);
 
   fp_dbg ("Image captured, committing");
 
@@ -404,68 +408,65 @@ submit_image (FpiSsm          *ssm,
 }
 
 static void
-chunk_capture_callback (FpiUsbTransfer *transfer, FpDevice *device,
-                        gpointer user_data, GError *error)
+chunk_capture_callback (FpiUsbStream *stream, FpiUsbTransfer *transfer,
+                        FpDevice *device, gpointer user_data)
 {
   FpImageDevice *dev = FP_IMAGE_DEVICE (device);
   FpDeviceVfs5011 *self;
 
   self = FPI_DEVICE_VFS5011 (dev);
 
-  if (!error ||
-      g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT))
+  if (transfer->actual_length > 0)
     {
-      if (error)
-        g_error_free (error);
+      capture_update_rate (self, transfer->actual_length);
+      fpi_image_device_report_finger_status (dev, TRUE);
+    }
 
-      if (transfer->actual_length > 0)
-        fpi_image_device_report_finger_status (dev, TRUE);
+  if (process_chunk (self, transfer->buffer, transfer->actual_length) ||
+      self->deactivating)
+    fpi_usb_stream_stop (stream);
+}
 
-      if (process_chunk (self, transfer->actual_length))
-        fpi_ssm_jump_to_state (transfer->ssm,
-                               DEV_ACTIVATE_DATA_COMPLETE);
-      else
-        fpi_ssm_jump_to_state (transfer->ssm,
-                               DEV_ACTIVATE_READ_DATA);
+static void
+capture_done_callback (FpiUsbStream *stream, FpDevice *device,
+                       gpointer user_data, GError *error)
+{
+  FpDeviceVfs5011 *self = FPI_DEVICE_VFS5011 (device);
+  FpiSsm *ssm = user_data;
+
+  capture_log_rate (self);
+
+  if (!error)
+    {
+      fpi_ssm_jump_to_state (ssm, DEV_ACTIVATE_DATA_COMPLETE);
+    }
+  else if (!self->deactivating)
+    {
+      fp_err ("Failed to capture data");
+      fpi_ssm_mark_failed (ssm, error);
     }
   else
     {
-      if (!self->deactivating)
-        {
-          fp_err ("Failed to capture data");
-          fpi_ssm_mark_failed (transfer->ssm, error);
-        }
-      else
-        {
-          g_error_free (error);
-          fpi_ssm_mark_completed (transfer->ssm);
-        }
+      g_error_free (error);
+      fpi_ssm_mark_completed (ssm);
     }
 }
 
+/*
+ * Keeps CAPTURE_BUFFERS transfers queued on the data endpoint, so that the
+ * device can keep streaming lines while a chunk is being processed.
+ */
 static void
 capture_chunk_async (FpDeviceVfs5011 *self,
                      GUsbDevice *handle, int nline,
                      int timeout, FpiSsm *ssm)
 {
-  FpiUsbTransfer *transfer;
-
-  fp_dbg ("capture_chunk_async: capture %d lines, already have %d",
-          nline, self->lines_recorded);
-  enum {
-    DEVIATION_THRESHOLD = 15 * 15,
-    DIFFERENCE_THRESHOLD = 600,
-    STOP_CHECK_LINES = 50
-  };
+  fp_dbg ("capture_chunk_async: capture %d lines in %d buffers, already have %d",
+          nline, CAPTURE_BUFFERS, self->lines_recorded);
 
-  transfer = fpi_usb_transfer_new (FP_DEVICE (self));
-  fpi_usb_transfer_fill_bulk_full (transfer,
-                                   VFS5011_IN_ENDPOINT_DATA,
-                                   self->capture_buffer,
-                                   nline * VFS5011_LINE_SIZE, NULL);
-  transfer->ssm = ssm;
-  fpi_usb_transfer_submit (transfer, timeout, fpi_device_get_cancellable (FP_DEVICE (self)),
-                           chunk_capture_callback, NULL);
+  fpi_usb_stream_start (self->capture_stream, timeout,
+                        fpi_device_get_cancellable (FP_DEVICE (self)),
+                        chunk_capture_callback, capture_done_callback, ssm);
 }
 
 /*
@@ -798,7 +799,13 @@ dev_open (FpImageDevice *dev)
   FpDeviceVfs5011 *self;
 
   self = FPI_DEVICE_VFS5011 (dev);
-  self->capture_buffer = g_new0 (unsigned char, CAPTURE_LINES * VFS5011_LINE_SIZE);
+  self->capture_stream = fpi_usb_stream_new (FP_DEVICE (dev),
+                                             VFS5011_IN_ENDPOINT_DATA,
+                                             CAPTURE_LINES * VFS5011_LINE_SIZE,
+                                             CAPTURE_BUFFERS);
+  /* No lines arrive while waiting for a finger, keep reading then */
+  fpi_usb_stream_set_continue_on_timeout (self->capture_stream, TRUE);
+  fpi_asmbl_ring_init (&self->rows, VFS5011_LINE_SIZE, MAXLINES);
 
   if (!g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error))
     {
@@ -821,8 +828,8 @@ dev_close (FpImageDevice *dev)
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)),
                                   0, 0, &error);
 
-  g_free (self->capture_buffer);
-  g_slist_free_full (self->rows, g_free);
+  g_clear_pointer (&self->capture_stream, fpi_usb_stream_free);
+  fpi_asmbl_ring_clear (&self->rows);
 
   fpi_image_device_close_complete (dev, error);
 }
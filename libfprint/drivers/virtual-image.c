@@ -162,6 +162,12 @@ recv_image_hdr_recv_cb (GObject      *source_object,
                                                  !!self->recv_img_hdr[1]);
           break;
 
+        case -5:
+          /* -5 sets the size of the match cache */
+          fpi_image_device_set_match_cache_size (FP_IMAGE_DEVICE (self),
+                                                 self->recv_img_hdr[1]);
+          break;
+
         default:
           /* disconnect client, it didn't play fair */
           g_io_stream_close (G_IO_STREAM (self->connection), NULL, NULL);
@@ -245,6 +251,31 @@ start_listen (FpDeviceVirtualImage *dev)
                                   dev);
 }
 
+static void
+dev_probe_done (FpDevice *device, gpointer user_data)
+{
+  fpi_device_probe_complete (device, NULL, NULL, NULL);
+}
+
+static void
+dev_probe (FpDevice *device)
+{
+  const char *delay;
+
+  G_DEBUG_HERE ();
+
+  /* Allows testing how slow devices are handled during enumeration */
+  delay = g_getenv ("FP_VIRTUAL_IMAGE_PROBE_DELAY");
+  if (delay && delay[0] != '\0')
+    {
+      fpi_device_add_timeout (device, g_ascii_strtoull (delay, NULL, 10),
+                              dev_probe_done, NULL, NULL);
+      return;
+    }
+
+  fpi_device_probe_complete (device, NULL, NULL, NULL);
+}
+
 static void
 dev_init (FpImageDevice *dev)
 {
@@ -285,6 +316,12 @@ dev_init (FpImageDevice *dev)
   self->listener = g_steal_pointer (&listener);
   self->cancellable = g_cancellable_new ();
 
+  /* Test clients load the same image files over and over. Cache entries
+   * are keyed by a SHA-256 of the raw image data and a checksum of the
+   * template minutiae, so only a byte-identical resubmission of an image
+   * against the same templates can reuse a result. */
+  fpi_image_device_set_match_cache_size (dev, 4);
+
   start_listen (self);
 
   fpi_image_device_open_complete (dev, NULL);
@@ -325,6 +362,7 @@ fpi_device_virtual_image_class_init (FpDeviceVirtualImageClass *klass)
   dev_class->full_name = "Virtual image device for debugging";
   dev_class->type = FP_DEVICE_TYPE_VIRTUAL;
   dev_class->id_table = driver_ids;
+  dev_class->probe = dev_probe;
 
   img_class->img_open = dev_init;
   img_class->img_close = dev_deinit;
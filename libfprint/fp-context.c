@@ -34,6 +34,11 @@
  *
  * The <link linkend="device-added">device-added</link> and device-removed signals allow you to handle devices
  * that may be hotplugged at runtime.
+ *
+ * Every device is probed independently of the others. Use
+ * fp_context_enumerate_async() to handle devices as soon as they are
+ * ready, and fp_context_set_probe_timeout() to avoid waiting for devices
+ * that are slow to respond.
  */
 
 typedef struct
@@ -43,11 +48,35 @@ typedef struct
 
   gint          pending_devices;
   gboolean      enumerated;
+  GTask        *enumerate_task;
+  guint         probe_timeout;
 
   GArray       *drivers;
   GPtrArray    *devices;
+
+  /* (VID, PID) to GPtrArray of FpContextUsbCandidate */
+  GHashTable   *usb_candidates;
 } FpContextPrivate;
 
+typedef struct
+{
+  GType            driver;
+  const FpIdEntry *entry;
+} FpContextUsbCandidate;
+
+#define USB_ID_KEY(vid, pid) GUINT_TO_POINTER (((guint) (vid) << 16) | (pid))
+
+typedef struct
+{
+  GWeakRef      context;
+  GCancellable *cancellable;
+  GCancellable *context_cancellable;
+  gulong        context_cancellable_id;
+  GSource      *timeout_source;
+  gint64        start_time;
+  gboolean      timed_out;
+} FpContextProbeData;
+
 G_DEFINE_TYPE_WITH_PRIVATE (FpContext, fp_context, G_TYPE_OBJECT)
 
 enum {
@@ -86,32 +115,147 @@ is_driver_allowed (const gchar *driver)
   return FALSE;
 }
 
+static void
+fp_context_probe_data_free (FpContextProbeData *data)
+{
+  g_weak_ref_clear (&data->context);
+  g_cancellable_disconnect (data->context_cancellable, data->context_cancellable_id);
+  g_clear_object (&data->context_cancellable);
+  g_clear_object (&data->cancellable);
+  g_clear_pointer (&data->timeout_source, g_source_destroy);
+  g_free (data);
+}
+
+static void
+fp_context_probe_finished (FpContext *self)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (self);
+
+  priv->pending_devices--;
+
+  if (priv->pending_devices == 0 && priv->enumerate_task)
+    {
+      g_autoptr(GTask) task = g_steal_pointer (&priv->enumerate_task);
+
+      g_task_return_boolean (task, TRUE);
+    }
+}
+
 static void
 async_device_init_done_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   g_autoptr(GError) error = NULL;
+  g_autoptr(FpContext) context = NULL;
+  FpContextProbeData *data = user_data;
   FpDevice *device;
-  FpContext *context;
   FpContextPrivate *priv;
+  gboolean timed_out;
+  gint64 duration;
 
   device = (FpDevice *) g_async_initable_new_finish (G_ASYNC_INITABLE (source_object), res, &error);
-  if (!device)
-    {
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        return;
 
-      context = FP_CONTEXT (user_data);
-      priv = fp_context_get_instance_private (context);
-      priv->pending_devices--;
-      g_message ("Ignoring device due to initialization error: %s", error->message);
+  context = g_weak_ref_get (&data->context);
+  timed_out = data->timed_out;
+  duration = g_get_monotonic_time () - data->start_time;
+  fp_context_probe_data_free (data);
+
+  /* The context has been destroyed in the meantime */
+  if (!context)
+    {
+      g_clear_object (&device);
       return;
     }
 
-  context = FP_CONTEXT (user_data);
   priv = fp_context_get_instance_private (context);
-  priv->pending_devices--;
-  g_ptr_array_add (priv->devices, device);
-  g_signal_emit (context, signals[DEVICE_ADDED_SIGNAL], 0, device);
+
+  if (!device)
+    {
+      g_message ("Ignoring device due to initialization error: %s", error->message);
+    }
+  else
+    {
+      /* A late device is still added, just without holding up enumeration */
+      g_debug ("Probing device %s took %" G_GINT64_FORMAT " ms",
+               fp_device_get_driver (device), duration / 1000);
+      g_ptr_array_add (priv->devices, device);
+      g_signal_emit (context, signals[DEVICE_ADDED_SIGNAL], 0, device);
+    }
+
+  if (!timed_out)
+    fp_context_probe_finished (context);
+}
+
+static gboolean
+probe_timeout_cb (gpointer user_data)
+{
+  FpContextProbeData *data = user_data;
+  g_autoptr(FpContext) context = g_weak_ref_get (&data->context);
+
+  data->timeout_source = NULL;
+  data->timed_out = TRUE;
+
+  /* Only stop waiting, the probe itself carries on and the device is
+   * added once it completes. */
+  if (context)
+    {
+      FpContextPrivate *priv = fp_context_get_instance_private (context);
+
+      g_message ("Not waiting for device as probing it took longer than %u ms",
+                 priv->probe_timeout);
+      fp_context_probe_finished (context);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+on_context_cancelled (GCancellable *context_cancellable,
+                      GCancellable *cancellable)
+{
+  g_cancellable_cancel (cancellable);
+}
+
+/* Creates and probes a device of type @driver. Every probe can be
+ * cancelled on its own and stops holding up enumeration on timeout. */
+static void
+fp_context_probe_device (FpContext   *self,
+                         GType        driver,
+                         const gchar *first_property_name,
+                         ...)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (self);
+  FpContextProbeData *data;
+  va_list args;
+
+  data = g_new0 (FpContextProbeData, 1);
+  g_weak_ref_init (&data->context, self);
+  data->start_time = g_get_monotonic_time ();
+  data->cancellable = g_cancellable_new ();
+  data->context_cancellable = g_object_ref (priv->cancellable);
+  data->context_cancellable_id = g_cancellable_connect (priv->cancellable,
+                                                        G_CALLBACK (on_context_cancelled),
+                                                        data->cancellable,
+                                                        NULL);
+
+  if (priv->probe_timeout > 0)
+    {
+      data->timeout_source = g_timeout_source_new (priv->probe_timeout);
+      g_source_set_callback (data->timeout_source, probe_timeout_cb, data, NULL);
+      g_source_attach (data->timeout_source, g_main_context_get_thread_default ());
+      g_source_unref (data->timeout_source);
+    }
+
+  priv->pending_devices++;
+
+  va_start (args, first_property_name);
+  g_async_initable_new_valist_async (driver,
+                                     first_property_name,
+                                     args,
+                                     G_PRIORITY_LOW,
+                                     data->cancellable,
+                                     async_device_init_done_cb,
+                                     data);
+  va_end (args);
 }
 
 static void
@@ -120,6 +264,7 @@ usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
   FpContextPrivate *priv = fp_context_get_instance_private (self);
   GType found_driver = G_TYPE_NONE;
   const FpIdEntry *found_entry = NULL;
+  GPtrArray *candidates;
   gint found_score = 0;
   gint i;
   guint16 pid, vid;
@@ -127,34 +272,25 @@ usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
   pid = g_usb_device_get_pid (device);
   vid = g_usb_device_get_vid (device);
 
+  candidates = g_hash_table_lookup (priv->usb_candidates, USB_ID_KEY (vid, pid));
+
   /* Find the best driver to handle this USB device. */
-  for (i = 0; i < priv->drivers->len; i++)
+  for (i = 0; candidates && i < candidates->len; i++)
     {
-      GType driver = g_array_index (priv->drivers, GType, i);
-      g_autoptr(FpDeviceClass) cls = g_type_class_ref (driver);
-      const FpIdEntry *entry;
-
-      if (cls->type != FP_DEVICE_TYPE_USB)
-        continue;
-
-      for (entry = cls->id_table; entry->pid; entry++)
-        {
-          gint driver_score = 50;
-
-          if (entry->pid != pid || entry->vid != vid)
-            continue;
+      FpContextUsbCandidate *candidate = g_ptr_array_index (candidates, i);
+      g_autoptr(FpDeviceClass) cls = g_type_class_ref (candidate->driver);
+      gint driver_score = 50;
 
-          if (cls->usb_discover)
-            driver_score = cls->usb_discover (device);
+      if (cls->usb_discover)
+        driver_score = cls->usb_discover (device);
 
-          /* Is this driver better than the one we had? */
-          if (driver_score <= found_score)
-            continue;
+      /* Is this driver better than the one we had? */
+      if (driver_score <= found_score)
+        continue;
 
-          found_score = driver_score;
-          found_driver = driver;
-          found_entry = entry;
-        }
+      found_score = driver_score;
+      found_driver = candidate->driver;
+      found_entry = candidate->entry;
     }
 
   if (found_driver == G_TYPE_NONE)
@@ -163,15 +299,11 @@ usb_device_added_cb (FpContext *self, GUsbDevice *device, GUsbContext *usb_ctx)
       return;
     }
 
-  priv->pending_devices++;
-  g_async_initable_new_async (found_driver,
-                              G_PRIORITY_LOW,
-                              priv->cancellable,
-                              async_device_init_done_cb,
-                              self,
-                              "fpi-usb-device", device,
-                              "fpi-driver-data", found_entry->driver_data,
-                              NULL);
+  fp_context_probe_device (self,
+                           found_driver,
+                           "fpi-usb-device", device,
+                           "fpi-driver-data", found_entry->driver_data,
+                           NULL);
 }
 
 static void
@@ -210,6 +342,7 @@ fp_context_finalize (GObject *object)
   g_cancellable_cancel (priv->cancellable);
   g_clear_object (&priv->cancellable);
   g_clear_pointer (&priv->drivers, g_array_unref);
+  g_clear_pointer (&priv->usb_candidates, g_hash_table_unref);
 
   g_object_run_dispose (G_OBJECT (priv->usb_ctx));
   g_clear_object (&priv->usb_ctx);
@@ -284,6 +417,40 @@ fp_context_init (FpContext *self)
         }
     }
 
+  /* Index the USB ID tables, so that hotplug events only need a lookup */
+  priv->usb_candidates = g_hash_table_new_full (NULL, NULL, NULL,
+                                                (GDestroyNotify) g_ptr_array_unref);
+  for (i = 0; i < priv->drivers->len; i++)
+    {
+      GType driver = g_array_index (priv->drivers, GType, i);
+      g_autoptr(FpDeviceClass) cls = g_type_class_ref (driver);
+      const FpIdEntry *entry;
+
+      if (cls->type != FP_DEVICE_TYPE_USB)
+        continue;
+
+      for (entry = cls->id_table; entry->pid; entry++)
+        {
+          FpContextUsbCandidate *candidate;
+          GPtrArray *candidates;
+
+          candidates = g_hash_table_lookup (priv->usb_candidates,
+                                            USB_ID_KEY (entry->vid, entry->pid));
+          if (!candidates)
+            {
+              candidates = g_ptr_array_new_with_free_func (g_free);
+              g_hash_table_insert (priv->usb_candidates,
+                                   USB_ID_KEY (entry->vid, entry->pid),
+                                   candidates);
+            }
+
+          candidate = g_new0 (FpContextUsbCandidate, 1);
+          candidate->driver = driver;
+          candidate->entry = entry;
+          g_ptr_array_add (candidates, candidate);
+        }
+    }
+
   priv->devices = g_ptr_array_new_with_free_func (g_object_unref);
 
   priv->cancellable = g_cancellable_new ();
@@ -321,22 +488,13 @@ fp_context_new (void)
   return g_object_new (FP_TYPE_CONTEXT, NULL);
 }
 
-/**
- * fp_context_enumerate:
- * @context: a #FpContext
- *
- * Enumerate all devices. You should call this function exactly once
- * at startup. Please note that it iterates the mainloop until all
- * devices are enumerated.
- */
-void
-fp_context_enumerate (FpContext *context)
+/* Starts probing all devices, unless that was done already */
+static void
+fp_context_start_enumerate (FpContext *context)
 {
   FpContextPrivate *priv = fp_context_get_instance_private (context);
   gint i;
 
-  g_return_if_fail (FP_IS_CONTEXT (context));
-
   if (priv->enumerated)
     return;
 
@@ -364,21 +522,141 @@ fp_context_enumerate (FpContext *context)
             continue;
 
           g_debug ("Found virtual environment device: %s, %s", entry->virtual_envvar, val);
-          priv->pending_devices++;
-          g_async_initable_new_async (driver,
-                                      G_PRIORITY_LOW,
-                                      priv->cancellable,
-                                      async_device_init_done_cb,
-                                      context,
-                                      "fpi-environ", val,
-                                      "fpi-driver-data", entry->driver_data,
-                                      NULL);
+          fp_context_probe_device (context,
+                                   driver,
+                                   "fpi-environ", val,
+                                   "fpi-driver-data", entry->driver_data,
+                                   NULL);
           g_debug ("created");
         }
     }
+}
+
+/**
+ * fp_context_enumerate:
+ * @context: a #FpContext
+ *
+ * Enumerate all devices. You should call this function exactly once
+ * at startup. Please note that it iterates the thread-default main
+ * context until all devices are enumerated or their probing timed out,
+ * see fp_context_set_probe_timeout().
+ */
+void
+fp_context_enumerate (FpContext *context)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (context);
+
+  g_return_if_fail (FP_IS_CONTEXT (context));
+
+  fp_context_start_enumerate (context);
 
   while (priv->pending_devices)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (g_main_context_get_thread_default (), TRUE);
+}
+
+/**
+ * fp_context_enumerate_async:
+ * @context: a #FpContext
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Enumerate all devices without blocking. Devices are probed in parallel
+ * and #FpContext::device-added is emitted for each of them as soon as it
+ * is ready. The operation completes once all devices that were present
+ * at the start are either ready, failed or timed out, see
+ * fp_context_set_probe_timeout(). Devices whose probe timed out are
+ * still added if it completes successfully later on.
+ *
+ * Like fp_context_enumerate(), this should only be called once.
+ */
+void
+fp_context_enumerate_async (FpContext          *context,
+                            GCancellable       *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  FpContextPrivate *priv = fp_context_get_instance_private (context);
+
+  g_return_if_fail (FP_IS_CONTEXT (context));
+
+  task = g_task_new (context, cancellable, callback, user_data);
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (priv->enumerate_task)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_PENDING,
+                               "Enumeration is already running");
+      return;
+    }
+
+  fp_context_start_enumerate (context);
+
+  if (priv->pending_devices == 0)
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  priv->enumerate_task = g_steal_pointer (&task);
+}
+
+/**
+ * fp_context_enumerate_finish:
+ * @context: a #FpContext
+ * @result: A #GAsyncResult
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish an asynchronous enumeration. See fp_context_enumerate_async().
+ *
+ * Returns: %FALSE on error, %TRUE otherwise
+ */
+gboolean
+fp_context_enumerate_finish (FpContext    *context,
+                             GAsyncResult *result,
+                             GError      **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * fp_context_set_probe_timeout:
+ * @context: a #FpContext
+ * @timeout_ms: Timeout in milliseconds, or 0 to wait indefinitely
+ *
+ * Sets how long probing a single device may take before enumeration
+ * stops waiting for it. The probe is not cancelled, so the device is
+ * still added with #FpContext::device-added if it succeeds later on.
+ * This applies to devices probed afterwards, including hotplugged ones.
+ * Enumeration waits for every device by default.
+ */
+void
+fp_context_set_probe_timeout (FpContext *context,
+                              guint      timeout_ms)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (context);
+
+  g_return_if_fail (FP_IS_CONTEXT (context));
+
+  priv->probe_timeout = timeout_ms;
+}
+
+/**
+ * fp_context_get_probe_timeout:
+ * @context: a #FpContext
+ *
+ * Returns: The timeout for probing a device in milliseconds, or 0
+ */
+guint
+fp_context_get_probe_timeout (FpContext *context)
+{
+  FpContextPrivate *priv = fp_context_get_instance_private (context);
+
+  g_return_val_if_fail (FP_IS_CONTEXT (context), 0);
+
+  return priv->probe_timeout;
 }
 
 /**
@@ -47,6 +47,18 @@ FpContext *fp_context_new (void);
 
 void fp_context_enumerate (FpContext *context);
 
+void fp_context_enumerate_async (FpContext          *context,
+                                 GCancellable       *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 gpointer            user_data);
+gboolean fp_context_enumerate_finish (FpContext    *context,
+                                      GAsyncResult *result,
+                                      GError      **error);
+
+void fp_context_set_probe_timeout (FpContext *context,
+                                   guint      timeout_ms);
+guint fp_context_get_probe_timeout (FpContext *context);
+
 GPtrArray *fp_context_get_devices (FpContext *context);
 
 G_END_DECLS
@@ -21,6 +21,37 @@
 #pragma once
 
 #include "fpi-device.h"
+#include "fpi-usb-transfer.h"
+
+/* Latency buckets of the transfer statistics, the first one holds
+ * everything below 128us and each further one doubles the range. */
+#define FPI_USB_STATISTICS_LATENCY_BUCKETS 16
+#define FPI_USB_STATISTICS_LATENCY_MIN_BITS 7
+
+typedef struct
+{
+  FpiTransferType type;
+  guint8          endpoint;
+
+  guint64         submitted;
+  guint64         completed;
+  guint64         errors;
+  guint64         timeouts;
+  guint64         cancelled;
+  guint64         short_transfers;
+  guint64         bytes;
+
+  guint64         latency_total_us;
+  guint64         latency_max_us;
+  guint64         latency_histogram[FPI_USB_STATISTICS_LATENCY_BUCKETS];
+} FpiUsbStatistics;
+
+typedef struct
+{
+  const gchar *stage;
+  gint64       start_us;
+  gint64       end_us;
+} FpiScanTiming;
 
 typedef struct
 {
@@ -40,6 +71,20 @@ typedef struct
   gint         nr_enroll_stages;
   GSList      *sources;
 
+  /* Context that all sources and transfers of the device are dispatched
+   * in, see fp_device_open() */
+  GMainContext *main_context;
+
+  /* Unused transfers kept for recycling, see fpi_usb_transfer_new() */
+  GQueue      *usb_transfer_pool;
+
+  /* Transfer statistics per type and endpoint, see fp_device_get_statistics() */
+  gboolean     collect_statistics;
+  GHashTable  *usb_statistics;
+
+  /* Stage timings of the last scan, see fp_device_get_scan_timings() */
+  GArray      *scan_timings;
+
   /* We always make sure that only one task is run at a time. */
   FpiDeviceAction     current_action;
   GTask              *current_task;
@@ -80,3 +125,22 @@ typedef struct
 } FpMatchData;
 
 void match_data_free (FpMatchData *match_data);
+
+GQueue *fpi_device_get_usb_transfer_pool (FpDevice *device);
+FpiUsbStatistics *fpi_device_get_usb_statistics (FpDevice       *device,
+                                                 FpiTransferType type,
+                                                 guint8          endpoint);
+
+void fpi_usb_transfer_record_submitted (FpiUsbTransfer *transfer);
+void fpi_usb_transfer_record_completed (FpiUsbTransfer *transfer,
+                                        GError         *error);
+
+typedef void (*FpiUsbTransferFakeSubmit) (FpiUsbTransfer *transfer,
+                                          GCancellable   *cancellable,
+                                          gpointer        user_data);
+
+void fpi_usb_transfer_set_fake_submit (FpiUsbTransferFakeSubmit func,
+                                       gpointer                 user_data);
+void fpi_usb_transfer_fake_complete (FpiUsbTransfer *transfer,
+                                     gssize          actual_length,
+                                     GError         *error);
@@ -22,6 +22,7 @@
 #include "fpi-log.h"
 
 #include "fp-device-private.h"
+#include "fpi-usb-transfer.h"
 
 /**
  * SECTION: fpi-device
@@ -87,7 +88,9 @@ fp_device_cancel_in_idle_cb (gpointer user_data)
 
   priv->current_idle_cancel_source = NULL;
 
+  g_main_context_push_thread_default (priv->main_context);
   cls->cancel (self);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return G_SOURCE_REMOVE;
 }
@@ -105,7 +108,7 @@ fp_device_cancelled_cb (GCancellable *cancellable, FpDevice *self)
                          fp_device_cancel_in_idle_cb,
                          self,
                          NULL);
-  g_source_attach (priv->current_idle_cancel_source, NULL);
+  g_source_attach (priv->current_idle_cancel_source, priv->main_context);
   g_source_unref (priv->current_idle_cancel_source);
 }
 
@@ -138,6 +141,9 @@ fp_device_constructed (GObject *object)
   priv->scan_type = cls->scan_type;
   priv->device_name = g_strdup (cls->full_name);
   priv->device_id = g_strdup ("0");
+  priv->usb_transfer_pool = g_queue_new ();
+  priv->usb_statistics = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  priv->scan_timings = g_array_new (FALSE, FALSE, sizeof (FpiScanTiming));
 
   G_OBJECT_CLASS (fp_device_parent_class)->constructed (object);
 }
@@ -155,8 +161,15 @@ fp_device_finalize (GObject *object)
 
   g_slist_free_full (priv->sources, (GDestroyNotify) g_source_destroy);
 
+  /* Unset first, so that the pooled transfers are really freed. */
+  g_queue_free_full (g_steal_pointer (&priv->usb_transfer_pool),
+                     (GDestroyNotify) fpi_usb_transfer_unref);
+  g_clear_pointer (&priv->usb_statistics, g_hash_table_unref);
+  g_clear_pointer (&priv->scan_timings, g_array_unref);
+
   g_clear_pointer (&priv->current_idle_cancel_source, g_source_destroy);
   g_clear_pointer (&priv->current_task_idle_return_source, g_source_destroy);
+  g_clear_pointer (&priv->main_context, g_main_context_unref);
 
   g_clear_pointer (&priv->device_id, g_free);
   g_clear_pointer (&priv->device_name, g_free);
@@ -392,6 +405,9 @@ fp_device_class_init (FpDeviceClass *klass)
 static void
 fp_device_init (FpDevice *self)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (self);
+
+  priv->main_context = g_main_context_ref_thread_default ();
 }
 
 /**
@@ -547,6 +563,235 @@ fp_device_has_storage (FpDevice *device)
   return cls->list != NULL;
 }
 
+/**
+ * fp_device_set_collect_statistics:
+ * @device: A #FpDevice
+ * @collect: Whether to collect statistics
+ *
+ * Enables or disables collecting statistics about the USB transfers of
+ * the device, see fp_device_get_statistics(), and the timings of the
+ * stages of every scan, see fp_device_get_scan_timings(). Collection is
+ * disabled by default. Disabling it keeps the statistics collected so far.
+ */
+void
+fp_device_set_collect_statistics (FpDevice *device,
+                                  gboolean  collect)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  priv->collect_statistics = !!collect;
+}
+
+/**
+ * fp_device_get_collect_statistics:
+ * @device: A #FpDevice
+ *
+ * Returns: Whether statistics about USB transfers are being collected
+ */
+gboolean
+fp_device_get_collect_statistics (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
+
+  return priv->collect_statistics;
+}
+
+/**
+ * fp_device_reset_statistics:
+ * @device: A #FpDevice
+ *
+ * Drops all statistics collected so far.
+ */
+void
+fp_device_reset_statistics (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  g_hash_table_remove_all (priv->usb_statistics);
+  g_array_set_size (priv->scan_timings, 0);
+}
+
+static gint
+scan_timing_compare (gconstpointer a, gconstpointer b)
+{
+  const FpiScanTiming *timing_a = a;
+  const FpiScanTiming *timing_b = b;
+
+  return (timing_a->start_us > timing_b->start_us) -
+         (timing_a->start_us < timing_b->start_us);
+}
+
+/**
+ * fp_device_get_scan_timings:
+ * @device: A #FpDevice
+ *
+ * Retrieves how long the stages of the last scan took, if
+ * fp_device_set_collect_statistics() was enabled during the scan. The
+ * timings are complete when the result of the scan is reported, e.g.
+ * from within the #FpMatchCb passed to fp_device_verify() or once the
+ * operation has finished.
+ *
+ * Every entry holds the name of the stage, its start time in
+ * microseconds as returned by g_get_monotonic_time() and its duration in
+ * microseconds. Entries are sorted by their start time. Image based
+ * devices report the following stages, depending on the operation:
+ *
+ * - "capture": from the finger being detected until the image is complete
+ * - "assemble": assembling the image of a swipe sensor, part of "capture"
+ * - "minutiae": detecting the minutiae in the image, split further into
+ *   the phases listed for fp_image_get_minutiae_timings()
+ * - "extract": creating the print from the minutiae
+ * - "match": comparing the print against the enrolled prints
+ *
+ * Returns: (transfer full): a #GVariant of type "a(stt)"
+ */
+GVariant *
+fp_device_get_scan_timings (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  g_autoptr(GArray) timings = NULL;
+  GVariantBuilder builder;
+  guint i;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+
+  timings = g_array_sized_new (FALSE, FALSE, sizeof (FpiScanTiming),
+                               priv->scan_timings->len);
+  g_array_append_vals (timings, priv->scan_timings->data,
+                       priv->scan_timings->len);
+  g_array_sort (timings, scan_timing_compare);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+  for (i = 0; i < timings->len; i++)
+    {
+      FpiScanTiming *timing = &g_array_index (timings, FpiScanTiming, i);
+
+      g_variant_builder_add (&builder, "(stt)",
+                             timing->stage,
+                             (guint64) timing->start_us,
+                             (guint64) (timing->end_us - timing->start_us));
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gint
+usb_statistics_compare (gconstpointer a, gconstpointer b)
+{
+  const FpiUsbStatistics *stats_a = a;
+  const FpiUsbStatistics *stats_b = b;
+
+  if (stats_a->type != stats_b->type)
+    return stats_a->type - stats_b->type;
+
+  return stats_a->endpoint - stats_b->endpoint;
+}
+
+/**
+ * fp_device_get_statistics:
+ * @device: A #FpDevice
+ *
+ * Retrieves the statistics about USB transfers collected while
+ * fp_device_set_collect_statistics() was enabled.
+ *
+ * The result contains one dictionary for every transfer type and endpoint
+ * that was used, with the following entries:
+ *
+ * - "type" (s): "bulk", "control" or "interrupt"
+ * - "endpoint" (y): the endpoint address, 0 for control transfers
+ * - "submitted" (t): number of transfers submitted
+ * - "completed" (t): number of transfers that completed without error
+ * - "errors" (t): number of transfers that failed, excluding timeouts
+ *   and cancellations
+ * - "timeouts" (t): number of transfers that timed out
+ * - "cancelled" (t): number of transfers that were cancelled
+ * - "short" (t): number of transfers that moved less data than requested
+ * - "bytes" (t): number of bytes moved
+ * - "latency-total-us" (t): summed time from submission to completion
+ * - "latency-max-us" (t): longest time from submission to completion
+ * - "latency-histogram" (at): number of transfers by time from submission
+ *   to completion. The first bucket counts transfers that took less than
+ *   128us, every further bucket covers twice the time of the previous
+ *   one, and the last bucket counts all slower transfers.
+ *
+ * Returns: (transfer full): a #GVariant of type "aa{sv}"
+ */
+GVariant *
+fp_device_get_statistics (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  g_autoptr(GList) entries = NULL;
+  GVariantBuilder builder;
+  GList *l;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+  entries = g_list_sort (g_hash_table_get_values (priv->usb_statistics),
+                         usb_statistics_compare);
+
+  for (l = entries; l; l = l->next)
+    {
+      FpiUsbStatistics *stats = l->data;
+      const gchar *type;
+
+      switch (stats->type)
+        {
+        case FP_TRANSFER_CONTROL:
+          type = "control";
+          break;
+
+        case FP_TRANSFER_INTERRUPT:
+          type = "interrupt";
+          break;
+
+        case FP_TRANSFER_BULK:
+        default:
+          type = "bulk";
+          break;
+        }
+
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&builder, "{sv}", "type",
+                             g_variant_new_string (type));
+      g_variant_builder_add (&builder, "{sv}", "endpoint",
+                             g_variant_new_byte (stats->endpoint));
+      g_variant_builder_add (&builder, "{sv}", "submitted",
+                             g_variant_new_uint64 (stats->submitted));
+      g_variant_builder_add (&builder, "{sv}", "completed",
+                             g_variant_new_uint64 (stats->completed));
+      g_variant_builder_add (&builder, "{sv}", "errors",
+                             g_variant_new_uint64 (stats->errors));
+      g_variant_builder_add (&builder, "{sv}", "timeouts",
+                             g_variant_new_uint64 (stats->timeouts));
+      g_variant_builder_add (&builder, "{sv}", "cancelled",
+                             g_variant_new_uint64 (stats->cancelled));
+      g_variant_builder_add (&builder, "{sv}", "short",
+                             g_variant_new_uint64 (stats->short_transfers));
+      g_variant_builder_add (&builder, "{sv}", "bytes",
+                             g_variant_new_uint64 (stats->bytes));
+      g_variant_builder_add (&builder, "{sv}", "latency-total-us",
+                             g_variant_new_uint64 (stats->latency_total_us));
+      g_variant_builder_add (&builder, "{sv}", "latency-max-us",
+                             g_variant_new_uint64 (stats->latency_max_us));
+      g_variant_builder_add (&builder, "{sv}", "latency-histogram",
+                             g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                        stats->latency_histogram,
+                                                        FPI_USB_STATISTICS_LATENCY_BUCKETS,
+                                                        sizeof (guint64)));
+      g_variant_builder_close (&builder);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 /**
  * fp_device_open:
  * @device: a #FpDevice
@@ -557,6 +802,14 @@ fp_device_has_storage (FpDevice *device)
  * Start an asynchronous operation to open the device. The callback will
  * be called once the operation has finished. Retrieve the result with
  * fp_device_open_finish().
+ *
+ * The device binds to the thread-default #GMainContext of the caller, see
+ * g_main_context_push_thread_default(). All USB transfers, timeouts and
+ * completions of the device are dispatched in that context until the
+ * device is opened again, which allows driving several devices from
+ * separate threads. Further operations on the device, including the
+ * synchronous variants, need to be started from a thread that can
+ * acquire this context.
  */
 void
 fp_device_open (FpDevice           *device,
@@ -586,6 +839,9 @@ fp_device_open (FpDevice           *device,
       return;
     }
 
+  g_main_context_unref (priv->main_context);
+  priv->main_context = g_main_context_ref_thread_default ();
+
   switch (priv->type)
     {
     case FP_DEVICE_TYPE_USB:
@@ -1277,7 +1533,7 @@ fp_device_open_sync (FpDevice     *device,
 
   fp_device_open (device, cancellable, async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (g_main_context_get_thread_default (), TRUE);
 
   return fp_device_open_finish (device, task, error);
 }
@@ -1297,13 +1553,17 @@ fp_device_close_sync (FpDevice     *device,
                       GCancellable *cancellable,
                       GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_close (device, cancellable, async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_close_finish (device, task, error);
 }
@@ -1331,15 +1591,19 @@ fp_device_enroll_sync (FpDevice        *device,
                        gpointer         progress_data,
                        GError         **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_enroll (device, template_print, cancellable,
                     progress_cb, progress_data, NULL,
                     async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_enroll_finish (device, task, error);
 }
@@ -1369,17 +1633,21 @@ fp_device_verify_sync (FpDevice     *device,
                        FpPrint     **print,
                        GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_verify (device,
                     enrolled_print,
                     cancellable,
                     match_cb, match_data, NULL,
                     async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_verify_finish (device, task, match, print, error);
 }
@@ -1409,17 +1677,21 @@ fp_device_identify_sync (FpDevice     *device,
                          FpPrint     **print,
                          GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_identify (device,
                       prints,
                       cancellable,
                       match_cb, match_data, NULL,
                       async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_identify_finish (device, task, match, print, error);
 }
@@ -1442,16 +1714,20 @@ fp_device_capture_sync (FpDevice     *device,
                         GCancellable *cancellable,
                         GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_capture (device,
                      wait_for_finger,
                      cancellable,
                      async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_capture_finish (device, task, error);
 }
@@ -1473,16 +1749,20 @@ fp_device_delete_print_sync (FpDevice     *device,
                              GCancellable *cancellable,
                              GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_delete_print (device,
                           enrolled_print,
                           cancellable,
                           async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_delete_print_finish (device, task, error);
 }
@@ -1502,15 +1782,19 @@ fp_device_list_prints_sync (FpDevice     *device,
                             GCancellable *cancellable,
                             GError      **error)
 {
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
   g_autoptr(GAsyncResult) task = NULL;
 
   g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
 
+  g_main_context_push_thread_default (priv->main_context);
+
   fp_device_list_prints (device,
                          NULL,
                          async_result_ready, &task);
   while (!task)
-    g_main_context_iteration (NULL, TRUE);
+    g_main_context_iteration (priv->main_context, TRUE);
+  g_main_context_pop_thread_default (priv->main_context);
 
   return fp_device_list_prints_finish (device, task, error);
 }
@@ -174,6 +174,13 @@ gboolean     fp_device_supports_identify (FpDevice *device);
 gboolean     fp_device_supports_capture (FpDevice *device);
 gboolean     fp_device_has_storage (FpDevice *device);
 
+void         fp_device_set_collect_statistics (FpDevice *device,
+                                               gboolean  collect);
+gboolean     fp_device_get_collect_statistics (FpDevice *device);
+void         fp_device_reset_statistics (FpDevice *device);
+GVariant    *fp_device_get_statistics (FpDevice *device);
+GVariant    *fp_device_get_scan_timings (FpDevice *device);
+
 /* Opening the device */
 void fp_device_open (FpDevice           *device,
                      GCancellable       *cancellable,
@@ -23,6 +23,10 @@
 
 #define IMG_ENROLL_STAGES 5
 
+/* Number of enroll scans that may be waiting for minutiae detection
+ * before the device stops re-arming for the next touch. */
+#define IMG_ENROLL_MAX_PENDING_SCANS 2
+
 typedef struct
 {
   FpiImageDeviceState state;
@@ -32,12 +36,28 @@ typedef struct
   gboolean            enroll_await_on_pending;
   gint                enroll_stage;
 
-  guint               pending_activation_timeout_id;
+  /* Captured images, in order, the head is having its minutiae detected */
+  GQueue             *pending_scans;
+
+  /* Recently matched scans, most recent first, and the checksum of the
+   * scan at the head of pending_scans if it may be looked up. */
+  GQueue             *match_cache;
+  guint               match_cache_size;
+  gchar              *scan_checksum;
+
+  GSource            *pending_activation_timeout;
   gboolean            pending_activation_timeout_waiting_finger_off;
 
   gint                bz3_threshold;
+
+  /* Start of the current scan and its minutiae detection, for the
+   * timings reported by fp_device_get_scan_timings(). */
+  gint64 capture_start;
+  gint64 minutiae_start;
 } FpImageDevicePrivate;
 
 
 void fpi_image_device_activate (FpImageDevice *image_device);
 void fpi_image_device_deactivate (FpImageDevice *image_device);
+void fpi_image_device_flush_pending_scans (FpImageDevice *image_device);
+void fpi_image_device_clear_match_cache (FpImageDevice *image_device);
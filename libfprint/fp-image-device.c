@@ -58,13 +58,13 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 /* Static helper functions */
 
-static gboolean
-pending_activation_timeout (gpointer user_data)
+static void
+pending_activation_timeout (FpDevice *device, gpointer user_data)
 {
-  FpImageDevice *self = FP_IMAGE_DEVICE (user_data);
+  FpImageDevice *self = FP_IMAGE_DEVICE (device);
   FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
 
-  priv->pending_activation_timeout_id = 0;
+  priv->pending_activation_timeout = NULL;
 
   if (priv->pending_activation_timeout_waiting_finger_off)
     fpi_device_action_error (FP_DEVICE (self),
@@ -73,8 +73,6 @@ pending_activation_timeout (gpointer user_data)
   else
     fpi_device_action_error (FP_DEVICE (self),
                              fpi_device_retry_new (FP_DEVICE_RETRY_GENERAL));
-
-  return G_SOURCE_REMOVE;
 }
 
 /* Callbacks/vfuncs */
@@ -104,6 +102,9 @@ fp_image_device_close (FpDevice *device)
    *  3. We are deactivating
    *     -> handled by deactivate_complete */
 
+  /* Cached results are only valid for one session */
+  fpi_image_device_clear_match_cache (self);
+
   if (!priv->active)
     cls->img_close (self);
   else if (priv->state != FPI_IMAGE_DEVICE_STATE_INACTIVE)
@@ -126,6 +127,9 @@ fp_image_device_cancel_action (FpDevice *device)
       action == FPI_DEVICE_ACTION_IDENTIFY ||
       action == FPI_DEVICE_ACTION_CAPTURE)
     {
+      /* Results of running minutiae detections are ignored */
+      fpi_image_device_flush_pending_scans (self);
+
       priv->cancelling = TRUE;
       fpi_image_device_deactivate (self);
       priv->cancelling = FALSE;
@@ -168,10 +172,14 @@ fp_image_device_start_capture_action (FpDevice *device)
 
       fpi_device_get_enroll_data (device, &enroll_print);
       fpi_print_set_type (enroll_print, FPI_PRINT_NBIS);
+
+      /* A new enrollment may be a replacement of a previous one */
+      fpi_image_device_clear_match_cache (self);
     }
 
   priv->enroll_stage = 0;
   priv->enroll_await_on_pending = FALSE;
+  fpi_image_device_flush_pending_scans (self);
 
   /* The device might still be deactivating from a previous call.
    * In that situation, try to wait for a bit before reporting back an
@@ -181,9 +189,9 @@ fp_image_device_start_capture_action (FpDevice *device)
   if (priv->state != FPI_IMAGE_DEVICE_STATE_INACTIVE || priv->active)
     {
       g_debug ("Got a new request while the device was still active");
-      g_assert (priv->pending_activation_timeout_id == 0);
-      priv->pending_activation_timeout_id =
-        g_timeout_add (100, pending_activation_timeout, device);
+      g_assert (priv->pending_activation_timeout == NULL);
+      priv->pending_activation_timeout =
+        fpi_device_add_timeout (device, 100, pending_activation_timeout, NULL, NULL);
 
       if (priv->state == FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_OFF)
         priv->pending_activation_timeout_waiting_finger_off = TRUE;
@@ -208,7 +216,11 @@ fp_image_device_finalize (GObject *object)
   FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
 
   g_assert (priv->active == FALSE);
-  g_clear_handle_id (&priv->pending_activation_timeout_id, g_source_remove);
+  g_clear_pointer (&priv->pending_activation_timeout, g_source_destroy);
+  g_queue_free_full (g_steal_pointer (&priv->pending_scans), g_object_unref);
+  fpi_image_device_clear_match_cache (self);
+  g_queue_free (g_steal_pointer (&priv->match_cache));
+  g_clear_pointer (&priv->scan_checksum, g_free);
 
   G_OBJECT_CLASS (fp_image_device_parent_class)->finalize (object);
 }
@@ -323,4 +335,8 @@ fp_image_device_class_init (FpImageDeviceClass *klass)
 static void
 fp_image_device_init (FpImageDevice *self)
 {
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+
+  priv->pending_scans = g_queue_new ();
+  priv->match_cache = g_queue_new ();
 }
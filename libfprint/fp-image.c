@@ -25,6 +25,9 @@
 
 #include <nbis.h>
 
+/* Phase timers of the NBIS minutiae detection, see nbis/include/mytime.h */
+__thread NBIS_TIMERS nbis_timers;
+
 /**
  * SECTION: fp-image
  * @title: FpImage
@@ -62,6 +65,7 @@ fp_image_finalize (GObject *object)
   g_clear_pointer (&self->data, g_free);
   g_clear_pointer (&self->binarized, g_free);
   g_clear_pointer (&self->minutiae, g_ptr_array_unref);
+  g_clear_pointer (&self->minutiae_timings, g_variant_unref);
 
   G_OBJECT_CLASS (fp_image_parent_class)->finalize (object);
 }
@@ -165,6 +169,7 @@ typedef struct
   FpiImageFlags       flags;
   guchar             *image;
   guchar             *binarized;
+  GVariant           *timings;
 } DetectMinutiaeData;
 
 static void
@@ -173,6 +178,7 @@ fp_image_detect_minutiae_free (DetectMinutiaeData *data)
   g_clear_pointer (&data->image, g_free);
   g_clear_pointer (&data->minutiae, free_minutiae);
   g_clear_pointer (&data->binarized, g_free);
+  g_clear_pointer (&data->timings, g_variant_unref);
   g_free (data);
 }
 
@@ -200,6 +206,9 @@ fp_image_detect_minutiae_cb (GObject      *source_object,
       g_clear_pointer (&image->binarized, g_free);
       image->binarized = g_steal_pointer (&data->binarized);
 
+      g_clear_pointer (&image->minutiae_timings, g_variant_unref);
+      image->minutiae_timings = g_steal_pointer (&data->timings);
+
       g_clear_pointer (&image->minutiae, g_ptr_array_unref);
       image->minutiae = g_ptr_array_new_full (data->minutiae->num,
                                               (GDestroyNotify) free_minutia);
@@ -265,6 +274,39 @@ invert_colors (guint8 *data, gint width, gint height)
     data[i] = 0xff - data[i];
 }
 
+static GVariant *
+minutiae_timings_new (const NBIS_TIMERS *timers)
+{
+  const struct
+  {
+    const gchar      *stage;
+    const NBIS_TIMER *timer;
+  } phases[] = {
+    { "minutiae-maps", &timers->imap },
+    { "minutiae-binarize", &timers->bin },
+    { "minutiae-detect", &timers->minutia },
+    { "minutiae-remove", &timers->rm_minutia },
+    { "minutiae-ridge-count", &timers->ridge_count },
+  };
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+  for (i = 0; i < G_N_ELEMENTS (phases); i++)
+    {
+      /* Skip phases that were never reached */
+      if (phases[i].timer->start <= 0)
+        continue;
+
+      g_variant_builder_add (&builder, "(stt)",
+                             phases[i].stage,
+                             (guint64) phases[i].timer->start,
+                             (guint64) phases[i].timer->duration);
+    }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
 static void
 fp_image_detect_minutiae_thread_func (GTask        *task,
                                       gpointer      source_object,
@@ -296,6 +338,8 @@ fp_image_detect_minutiae_thread_func (GTask        *task,
 
   data->flags &= ~(FPI_IMAGE_H_FLIPPED | FPI_IMAGE_V_FLIPPED | FPI_IMAGE_COLORS_INVERTED);
 
+  memset (&nbis_timers, 0, sizeof (nbis_timers));
+
   timer = g_timer_new ();
   r = get_minutiae (&minutiae, &quality_map, &direction_map,
                     &low_contrast_map, &low_flow_map, &high_curve_map,
@@ -304,6 +348,14 @@ fp_image_detect_minutiae_thread_func (GTask        *task,
                     data->ppmm, &g_lfsparms_V2);
   g_timer_stop (timer);
   fp_dbg ("Minutiae scan completed in %f secs", g_timer_elapsed (timer, NULL));
+  fp_dbg ("Minutiae phases: maps %" G_GINT64_FORMAT " us, binarize %" G_GINT64_FORMAT
+          " us, detect %" G_GINT64_FORMAT " us, remove %" G_GINT64_FORMAT
+          " us, ridge count %" G_GINT64_FORMAT " us",
+          nbis_timers.imap.duration, nbis_timers.bin.duration,
+          nbis_timers.minutia.duration, nbis_timers.rm_minutia.duration,
+          nbis_timers.ridge_count.duration);
+
+  data->timings = minutiae_timings_new (&nbis_timers);
 
   data->binarized = g_steal_pointer (&bdata);
   data->minutiae = minutiae;
@@ -418,6 +470,25 @@ fp_image_get_minutiae (FpImage *self)
   return self->minutiae;
 }
 
+/**
+ * fp_image_get_minutiae_timings:
+ * @self: A #FpImage
+ *
+ * Gets how long the phases of the last minutiae detection took. Every
+ * entry holds the name of the phase, its start time in microseconds as
+ * returned by g_get_monotonic_time() and its duration in microseconds.
+ * The phases are "minutiae-maps", "minutiae-binarize", "minutiae-detect",
+ * "minutiae-remove" and "minutiae-ridge-count". You need to first detect
+ * the minutiae using fp_image_detect_minutiae().
+ *
+ * Returns: (transfer none) (nullable): a #GVariant of type "a(stt)"
+ */
+GVariant *
+fp_image_get_minutiae_timings (FpImage *self)
+{
+  return self->minutiae_timings;
+}
+
 /**
  * fp_image_detect_minutiae:
  * @self: A #FpImage
@@ -38,6 +38,7 @@ guint         fp_image_get_height (FpImage *self);
 gdouble       fp_image_get_ppmm (FpImage *self);
 
 GPtrArray *   fp_image_get_minutiae (FpImage *self);
+GVariant *    fp_image_get_minutiae_timings (FpImage *self);
 
 void          fp_image_detect_minutiae (FpImage            *self,
                                         GCancellable       *cancellable,
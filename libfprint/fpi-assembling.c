@@ -25,6 +25,13 @@
 #include "fpi-image.h"
 
 #include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "fpi-assembling.h"
 
@@ -39,15 +46,172 @@
  * data in small stripes.
  */
 
+/* Entries of a ring start on this boundary */
+#define ASMBL_RING_ALIGN 16
+
+/**
+ * fpi_asmbl_ring_init:
+ * @ring: a #fpi_asmbl_ring
+ * @entry_size: size of every entry in bytes
+ * @capacity: maximum number of entries
+ *
+ * Allocates storage for @capacity entries of @entry_size bytes in @ring,
+ * which is initially empty. The storage is released with
+ * fpi_asmbl_ring_clear().
+ */
+void
+fpi_asmbl_ring_init (struct fpi_asmbl_ring *ring,
+                     gsize                  entry_size,
+                     unsigned int           capacity)
+{
+  g_return_if_fail (entry_size > 0 && capacity > 0);
+
+  ring->stride = (entry_size + ASMBL_RING_ALIGN - 1) & ~((gsize) ASMBL_RING_ALIGN - 1);
+  ring->capacity = capacity;
+  ring->data = g_malloc (ring->stride * capacity);
+  ring->first = 0;
+  ring->len = 0;
+}
+
+/**
+ * fpi_asmbl_ring_clear:
+ * @ring: a #fpi_asmbl_ring
+ *
+ * Frees the storage allocated by fpi_asmbl_ring_init().
+ */
+void
+fpi_asmbl_ring_clear (struct fpi_asmbl_ring *ring)
+{
+  g_clear_pointer (&ring->data, g_free);
+  ring->capacity = 0;
+  ring->first = 0;
+  ring->len = 0;
+}
+
+/**
+ * fpi_asmbl_ring_reset:
+ * @ring: a #fpi_asmbl_ring
+ *
+ * Drops all entries of @ring, keeping its storage.
+ */
+void
+fpi_asmbl_ring_reset (struct fpi_asmbl_ring *ring)
+{
+  ring->first = 0;
+  ring->len = 0;
+}
+
+/**
+ * fpi_asmbl_ring_push:
+ * @ring: a #fpi_asmbl_ring
+ *
+ * Appends an entry to @ring, dropping the oldest entry if @ring is full.
+ * The contents of the new entry are undefined, the caller is expected to
+ * fill it in.
+ *
+ * Returns: (transfer none): the new entry
+ */
+gpointer
+fpi_asmbl_ring_push (struct fpi_asmbl_ring *ring)
+{
+  g_return_val_if_fail (ring->data != NULL, NULL);
+
+  if (ring->len == ring->capacity)
+    ring->first = (ring->first + 1) % ring->capacity;
+  else
+    ring->len++;
+
+  return fpi_asmbl_ring_get (ring, ring->len - 1);
+}
+
+/* Sum of absolute differences between two runs of 8 bit pixels. */
+static unsigned int
+sad_row (const unsigned char *p1,
+         const unsigned char *p2,
+         unsigned int         len)
+{
+  unsigned int i = 0;
+  unsigned int err = 0;
+
+#if defined(__AVX2__)
+  __m256i acc = _mm256_setzero_si256 ();
+  __m128i acc128;
+
+  for (; i + 32 <= len; i += 32)
+    {
+      __m256i a = _mm256_loadu_si256 ((const __m256i *) (p1 + i));
+      __m256i b = _mm256_loadu_si256 ((const __m256i *) (p2 + i));
+      acc = _mm256_add_epi64 (acc, _mm256_sad_epu8 (a, b));
+    }
+  acc128 = _mm_add_epi64 (_mm256_castsi256_si128 (acc),
+                          _mm256_extracti128_si256 (acc, 1));
+  for (; i + 16 <= len; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (p1 + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (p2 + i));
+      acc128 = _mm_add_epi64 (acc128, _mm_sad_epu8 (a, b));
+    }
+  err = _mm_cvtsi128_si32 (acc128) +
+        _mm_cvtsi128_si32 (_mm_srli_si128 (acc128, 8));
+#elif defined(__SSE2__)
+  __m128i acc = _mm_setzero_si128 ();
+
+  for (; i + 16 <= len; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (p1 + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (p2 + i));
+      acc = _mm_add_epi64 (acc, _mm_sad_epu8 (a, b));
+    }
+  err = _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8));
+#elif defined(__ARM_NEON)
+  uint32x4_t acc = vdupq_n_u32 (0);
+
+  for (; i + 16 <= len; i += 16)
+    {
+      uint8x16_t d = vabdq_u8 (vld1q_u8 (p1 + i), vld1q_u8 (p2 + i));
+      acc = vpadalq_u16 (acc, vpaddlq_u8 (d));
+    }
+  err = vgetq_lane_u32 (acc, 0) + vgetq_lane_u32 (acc, 1) +
+        vgetq_lane_u32 (acc, 2) + vgetq_lane_u32 (acc, 3);
+#endif
+
+  for (; i < len; i++)
+    err += p1[i] > p2[i] ? p1[i] - p2[i] : p2[i] - p1[i];
+
+  return err;
+}
+
+/* Returns the frame as a row-major 8 bit bitmap. If the driver does not
+ * store frames in that layout, the pixels are unpacked into @buf, which
+ * must hold frame_width * frame_height bytes. */
+static const unsigned char *
+frame_get_linear_data (struct fpi_frame_asmbl_ctx *ctx,
+                       struct fpi_frame           *frame,
+                       unsigned char              *buf)
+{
+  unsigned int x, y;
+
+  if (ctx->linear_frames)
+    return frame->data;
+
+  for (y = 0; y < ctx->frame_height; y++)
+    for (x = 0; x < ctx->frame_width; x++)
+      buf[x + y * ctx->frame_width] = ctx->get_pixel (ctx, frame, x, y);
+
+  return buf;
+}
+
 static unsigned int
 calc_error (struct fpi_frame_asmbl_ctx *ctx,
-            struct fpi_frame           *first_frame,
-            struct fpi_frame           *second_frame,
+            const unsigned char        *first_frame,
+            const unsigned char        *second_frame,
             int                         dx,
-            int                         dy)
+            int                         dy,
+            unsigned int                limit)
 {
   unsigned int width, height;
-  unsigned int x1, y1, x2, y2, err, i, j;
+  unsigned int x1, x2, err, i;
+  guint64 max_sum;
 
   width = ctx->frame_width - (dx > 0 ? dx : -dx);
   height = ctx->frame_height - dy;
@@ -55,35 +219,23 @@ calc_error (struct fpi_frame_asmbl_ctx *ctx,
   if (height == 0 || width == 0)
     return INT_MAX;
 
-  y1 = 0;
-  y2 = dy;
-  i = 0;
+  /* The error only grows with every row. Once the sum reaches this, the
+   * normalized error cannot get below @limit anymore, so stop early. */
+  max_sum = ((guint64) limit * height * width +
+             ctx->frame_height * ctx->frame_width - 1) /
+            (ctx->frame_height * ctx->frame_width);
+
+  x1 = dx < 0 ? 0 : dx;
+  x2 = dx < 0 ? -dx : 0;
   err = 0;
-  do
+  for (i = 0; i < height; i++)
     {
-      x1 = dx < 0 ? 0 : dx;
-      x2 = dx < 0 ? -dx : 0;
-      j = 0;
-
-      do
-        {
-          unsigned char v1, v2;
-
-
-          v1 = ctx->get_pixel (ctx, first_frame, x1, y1);
-          v2 = ctx->get_pixel (ctx, second_frame, x2, y2);
-          err += v1 > v2 ? v1 - v2 : v2 - v1;
-          j++;
-          x1++;
-          x2++;
-
-        }
-      while (j < width);
-      i++;
-      y1++;
-      y2++;
+      err += sad_row (first_frame + x1 + i * ctx->frame_width,
+                      second_frame + x2 + (i + dy) * ctx->frame_width,
+                      width);
+      if (err >= max_sum)
+        return INT_MAX;
     }
-  while (i < height);
 
   /* Normalize error */
   err *= (ctx->frame_height * ctx->frame_width);
@@ -92,33 +244,34 @@ calc_error (struct fpi_frame_asmbl_ctx *ctx,
   return err;
 }
 
-/* This function is rather CPU-intensive. It's better to use hardware
- * to detect movement direction when possible.
- */
+/* Horizontal search range, and the half-size of the window that the
+ * predictive search covers around the previous delta. */
+#define SEARCH_MAX_DX 8
+#define PREDICTIVE_SEARCH_RADIUS 2
+
 static void
-find_overlap (struct fpi_frame_asmbl_ctx *ctx,
-              struct fpi_frame           *first_frame,
-              struct fpi_frame           *second_frame,
-              int                        *dx_out,
-              int                        *dy_out,
-              unsigned int               *min_error)
+search_overlap (struct fpi_frame_asmbl_ctx *ctx,
+                const unsigned char        *first_frame,
+                const unsigned char        *second_frame,
+                int                         dx_start,
+                int                         dx_end,
+                int                         dy_start,
+                int                         dy_end,
+                int                        *dx_out,
+                int                        *dy_out,
+                unsigned int               *min_error)
 {
   int dx, dy;
   unsigned int err;
 
   *min_error = 255 * ctx->frame_height * ctx->frame_width;
 
-  /* Seeking in horizontal and vertical dimensions,
-   * for horizontal dimension we'll check only 8 pixels
-   * in both directions. For vertical direction diff is
-   * rarely less than 2, so start with it.
-   */
-  for (dy = 2; dy < ctx->frame_height; dy++)
+  for (dy = dy_start; dy < dy_end; dy++)
     {
-      for (dx = -8; dx < 8; dx++)
+      for (dx = dx_start; dx < dx_end; dx++)
         {
           err = calc_error (ctx, first_frame, second_frame,
-                            dx, dy);
+                            dx, dy, *min_error);
           if (err < *min_error)
             {
               *min_error = err;
@@ -129,54 +282,179 @@ find_overlap (struct fpi_frame_asmbl_ctx *ctx,
     }
 }
 
-static unsigned int
+/* This function is rather CPU-intensive. It's better to use hardware
+ * to detect movement direction when possible.
+ *
+ * @prev_delta is the result for the previous pair of frames, if any. It is
+ * used as a starting point by FPI_FRAME_SEARCH_PREDICTIVE.
+ */
+static void
+find_overlap (struct fpi_frame_asmbl_ctx *ctx,
+              const unsigned char        *first_frame,
+              const unsigned char        *second_frame,
+              const int                  *prev_delta,
+              int                        *dx_out,
+              int                        *dy_out,
+              unsigned int               *min_error)
+{
+  if (ctx->search_mode == FPI_FRAME_SEARCH_PREDICTIVE && prev_delta)
+    {
+      int dx_start, dx_end, dy_start, dy_end;
+
+      dx_start = MAX (-prev_delta[0] - PREDICTIVE_SEARCH_RADIUS, -SEARCH_MAX_DX);
+      dx_end = MIN (-prev_delta[0] + PREDICTIVE_SEARCH_RADIUS + 1, SEARCH_MAX_DX);
+      dy_start = MAX (prev_delta[1] - PREDICTIVE_SEARCH_RADIUS, 2);
+      dy_end = MIN (prev_delta[1] + PREDICTIVE_SEARCH_RADIUS + 1, (int) ctx->frame_height);
+
+      if (dx_start < dx_end && dy_start < dy_end)
+        {
+          search_overlap (ctx, first_frame, second_frame,
+                          dx_start, dx_end, dy_start, dy_end,
+                          dx_out, dy_out, min_error);
+
+          /* Only trust the window if the minimum is good enough and lies
+           * inside it. A minimum on the border of the window (unless it is
+           * also the border of the full search) means the swipe speed
+           * changed more than the window covers. */
+          if (*min_error <= ctx->search_threshold * ctx->frame_width * ctx->frame_height &&
+              (-*dx_out > dx_start || dx_start == -SEARCH_MAX_DX) &&
+              (-*dx_out < dx_end - 1 || dx_end == SEARCH_MAX_DX) &&
+              (*dy_out > dy_start || dy_start == 2) &&
+              (*dy_out < dy_end - 1 || dy_end == (int) ctx->frame_height))
+            return;
+        }
+    }
+
+  /* Seeking in horizontal and vertical dimensions,
+   * for horizontal dimension we'll check only 8 pixels
+   * in both directions. For vertical direction diff is
+   * rarely less than 2, so start with it.
+   */
+  search_overlap (ctx, first_frame, second_frame,
+                  -SEARCH_MAX_DX, SEARCH_MAX_DX, 2, ctx->frame_height,
+                  dx_out, dy_out, min_error);
+}
+
+/* Estimates the movement in both swipe directions within a single pass
+ * over the frames. The deltas of the direction with the smaller average
+ * error are stored in the frames. */
+static void
 do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
-                        GSList *stripes, gboolean reverse)
+                        struct fpi_frame          **frames,
+                        guint                       num_frames)
 {
-  GSList *l;
   GTimer *timer;
-  guint num_frames = 1;
-  struct fpi_frame *prev_stripe;
+  guint i;
+  const unsigned char *prev_data;
+  unsigned char *bufs[2] = { NULL, NULL };
+  int cur_buf = 0;
+  int *rev_deltas;
+  int prev_delta[2];
+  gboolean have_prev_delta = FALSE;
   unsigned int min_error;
+  int err, rev_err;
   /* Max error is width * height * 255, for AES2501 which has the largest
    * sensor its 192*16*255 = 783360. So for 32bit value it's ~5482 frame before
    * we might get int overflow. Use 64bit value here to prevent integer overflow
    */
   unsigned long long total_error = 0;
+  unsigned long long total_rev_error = 0;
 
   timer = g_timer_new ();
 
+  /* Frames that are not stored as 8 bit bitmaps are unpacked once, into
+   * two alternating buffers holding the previous and the current frame. */
+  if (!ctx->linear_frames)
+    {
+      bufs[0] = g_malloc (ctx->frame_width * ctx->frame_height);
+      bufs[1] = g_malloc (ctx->frame_width * ctx->frame_height);
+    }
+
+  /* The forward deltas go straight into the frames, the reverse ones are
+   * kept aside until we know which direction won. */
+  rev_deltas = g_new (int, 2 * num_frames);
+
   /* Skip the first frame */
-  prev_stripe = stripes->data;
+  prev_data = frame_get_linear_data (ctx, frames[0], bufs[0]);
 
-  for (l = stripes->next; l != NULL; l = l->next, num_frames++)
+  for (i = 1; i < num_frames; i++)
     {
-      struct fpi_frame *cur_stripe = l->data;
+      struct fpi_frame *cur_stripe = frames[i];
+      const unsigned char *cur_data;
+      int *rev_delta = &rev_deltas[2 * i];
 
-      if (reverse)
-        {
-          find_overlap (ctx, prev_stripe, cur_stripe,
-                        &cur_stripe->delta_x, &cur_stripe->delta_y,
-                        &min_error);
-          cur_stripe->delta_y = -cur_stripe->delta_y;
-          cur_stripe->delta_x = -cur_stripe->delta_x;
-        }
-      else
-        {
-          find_overlap (ctx, cur_stripe, prev_stripe,
-                        &cur_stripe->delta_x, &cur_stripe->delta_y,
-                        &min_error);
-        }
+      cur_buf = !cur_buf;
+      cur_data = frame_get_linear_data (ctx, cur_stripe, bufs[cur_buf]);
+
+      find_overlap (ctx, cur_data, prev_data,
+                    have_prev_delta ? prev_delta : NULL,
+                    &cur_stripe->delta_x, &cur_stripe->delta_y,
+                    &min_error);
       total_error += min_error;
 
-      prev_stripe = cur_stripe;
+      find_overlap (ctx, prev_data, cur_data,
+                    have_prev_delta ? rev_delta - 2 : NULL,
+                    &rev_delta[0], &rev_delta[1],
+                    &min_error);
+      total_rev_error += min_error;
+
+      prev_data = cur_data;
+      prev_delta[0] = cur_stripe->delta_x;
+      prev_delta[1] = cur_stripe->delta_y;
+      have_prev_delta = TRUE;
     }
 
+  err = total_error / num_frames;
+  rev_err = total_rev_error / num_frames;
+  fp_dbg ("errors: %d rev: %d", err, rev_err);
+
+  if (err >= rev_err)
+    {
+      for (i = 1; i < num_frames; i++)
+        {
+          frames[i]->delta_x = -rev_deltas[2 * i];
+          frames[i]->delta_y = -rev_deltas[2 * i + 1];
+        }
+    }
+
+  g_free (rev_deltas);
+  g_free (bufs[0]);
+  g_free (bufs[1]);
+
   g_timer_stop (timer);
   fp_dbg ("calc delta completed in %f secs", g_timer_elapsed (timer, NULL));
   g_timer_destroy (timer);
+}
 
-  return total_error / num_frames;
+/* Both the list and the ring based entry points work on an array of the
+ * frames, which gives the assembling routines indexed access. */
+static struct fpi_frame **
+frames_from_list (GSList *stripes,
+                  guint  *num_frames)
+{
+  struct fpi_frame **frames;
+  GSList *l;
+  guint i;
+
+  *num_frames = g_slist_length (stripes);
+  frames = g_new (struct fpi_frame *, *num_frames);
+  for (l = stripes, i = 0; l != NULL; l = l->next, i++)
+    frames[i] = l->data;
+
+  return frames;
+}
+
+static struct fpi_frame **
+frames_from_ring (struct fpi_asmbl_ring *stripes)
+{
+  struct fpi_frame **frames;
+  guint i;
+
+  frames = g_new (struct fpi_frame *, stripes->len);
+  for (i = 0; i < stripes->len; i++)
+    frames[i] = fpi_asmbl_ring_get (stripes, i);
+
+  return frames;
 }
 
 /**
@@ -195,20 +473,47 @@ void
 fpi_do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
                             GSList                     *stripes)
 {
-  int err, rev_err;
+  g_autofree struct fpi_frame **frames = NULL;
+  guint num_frames;
 
-  err = do_movement_estimation (ctx, stripes, FALSE);
-  rev_err = do_movement_estimation (ctx, stripes, TRUE);
-  fp_dbg ("errors: %d rev: %d", err, rev_err);
-  if (err < rev_err)
-    do_movement_estimation (ctx, stripes, FALSE);
+  g_return_if_fail (stripes != NULL);
+
+  frames = frames_from_list (stripes, &num_frames);
+  do_movement_estimation (ctx, frames, num_frames);
+}
+
+/**
+ * fpi_do_movement_estimation_ring:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @stripes: a #fpi_asmbl_ring of #fpi_frame
+ *
+ * Same as fpi_do_movement_estimation(), for frames stored in a
+ * #fpi_asmbl_ring.
+ */
+void
+fpi_do_movement_estimation_ring (struct fpi_frame_asmbl_ctx *ctx,
+                                 struct fpi_asmbl_ring      *stripes)
+{
+  g_autofree struct fpi_frame **frames = NULL;
+
+  g_return_if_fail (stripes != NULL && stripes->len > 0);
+
+  frames = frames_from_ring (stripes);
+  do_movement_estimation (ctx, frames, stripes->len);
 }
 
+/* Copies a frame into a buffer of @dst_width by @dst_height pixels, with
+ * its top left corner at @x, @y. A negative @frame_stride copies the frame
+ * upside down, @frame_data must then point to its last row. */
 static inline void
 aes_blit_stripe (struct fpi_frame_asmbl_ctx *ctx,
-                 FpImage *img,
-                 struct fpi_frame *stripe,
-                 int x, int y)
+                 unsigned char              *dst,
+                 unsigned int                dst_width,
+                 unsigned int                dst_height,
+                 const unsigned char        *frame_data,
+                 int                         frame_stride,
+                 int                         x,
+                 int                         y)
 {
   unsigned int ix, iy;
   unsigned int fx, fy;
@@ -227,8 +532,8 @@ aes_blit_stripe (struct fpi_frame_asmbl_ctx *ctx,
       fx = 0;
       width = ctx->frame_width;
     }
-  if ((ix + width) > img->width)
-    width = img->width - ix;
+  if ((ix + width) > dst_width)
+    width = dst_width - ix;
 
   if (y < 0)
     {
@@ -249,17 +554,19 @@ aes_blit_stripe (struct fpi_frame_asmbl_ctx *ctx,
   if (fy > ctx->frame_height)
     return;
 
-  if (ix > img->width)
+  if (ix > dst_width)
     return;
 
-  if (iy > img->height)
+  if (iy > dst_height)
     return;
 
-  if ((iy + height) > img->height)
-    height = img->height - iy;
+  if ((iy + height) > dst_height)
+    height = dst_height - iy;
 
   for (; fy < height; fy++, iy++)
     {
+      const unsigned char *row = frame_data + (int) fy * frame_stride;
+
       if (x < 0)
         {
           ix = 0;
@@ -271,45 +578,29 @@ aes_blit_stripe (struct fpi_frame_asmbl_ctx *ctx,
           fx = 0;
         }
       for (; fx < width; fx++, ix++)
-        img->data[ix + (iy * img->width)] = ctx->get_pixel (ctx, stripe, fx, fy);
+        dst[ix + (iy * dst_width)] = row[fx];
     }
 }
 
-/**
- * fpi_assemble_frames:
- * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
- * @stripes: linked list of #fpi_frame
- *
- * fpi_assemble_frames() assembles individual frames into a single image.
- * It expects @delta_x and @delta_y of #fpi_frame to be populated.
- *
- * Returns: a newly allocated #fp_img.
- */
-FpImage *
-fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
-                     GSList                     *stripes)
+static FpImage *
+assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
+                 struct fpi_frame          **frames,
+                 guint                       num_frames)
 {
-  GSList *l;
   FpImage *img;
   int height = 0;
   int y, x;
+  guint i;
   gboolean reverse = FALSE;
-  struct fpi_frame *fpi_frame;
+  unsigned char *buf = NULL;
 
-  //FIXME g_return_if_fail
-  g_return_val_if_fail (stripes != NULL, NULL);
   BUG_ON (ctx->image_width < ctx->frame_width);
 
   /* No offset for 1st image */
-  fpi_frame = stripes->data;
-  fpi_frame->delta_x = 0;
-  fpi_frame->delta_y = 0;
-  for (l = stripes; l != NULL; l = l->next)
-    {
-      fpi_frame = l->data;
-
-      height += fpi_frame->delta_y;
-    }
+  frames[0]->delta_x = 0;
+  frames[0]->delta_y = 0;
+  for (i = 0; i < num_frames; i++)
+    height += frames[i]->delta_y;
 
   fp_dbg ("height is %d", height);
 
@@ -329,59 +620,550 @@ fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
   img->width = ctx->image_width;
   img->height = height;
 
+  if (!ctx->linear_frames)
+    buf = g_malloc (ctx->frame_width * ctx->frame_height);
+
   /* Assemble stripes */
   y = reverse ? (height - ctx->frame_height) : 0;
   x = (ctx->image_width - ctx->frame_width) / 2;
 
-  for (l = stripes; l != NULL; l = l->next)
+  for (i = 0; i < num_frames; i++)
     {
-      fpi_frame = l->data;
+      y += frames[i]->delta_y;
+      x += frames[i]->delta_x;
+
+      aes_blit_stripe (ctx, img->data, img->width, img->height,
+                       frame_get_linear_data (ctx, frames[i], buf),
+                       ctx->frame_width, x, y);
+    }
+
+  g_free (buf);
+
+  return img;
+}
+
+/**
+ * fpi_assemble_frames:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @stripes: linked list of #fpi_frame
+ *
+ * fpi_assemble_frames() assembles individual frames into a single image.
+ * It expects @delta_x and @delta_y of #fpi_frame to be populated.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
+                     GSList                     *stripes)
+{
+  g_autofree struct fpi_frame **frames = NULL;
+  guint num_frames;
+
+  //FIXME g_return_if_fail
+  g_return_val_if_fail (stripes != NULL, NULL);
+
+  frames = frames_from_list (stripes, &num_frames);
+  return assemble_frames (ctx, frames, num_frames);
+}
+
+/**
+ * fpi_assemble_frames_ring:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @stripes: a #fpi_asmbl_ring of #fpi_frame
+ *
+ * Same as fpi_assemble_frames(), for frames stored in a #fpi_asmbl_ring.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_frames_ring (struct fpi_frame_asmbl_ctx *ctx,
+                          struct fpi_asmbl_ring      *stripes)
+{
+  g_autofree struct fpi_frame **frames = NULL;
+
+  g_return_val_if_fail (stripes != NULL && stripes->len > 0, NULL);
+
+  frames = frames_from_ring (stripes);
+  return assemble_frames (ctx, frames, stripes->len);
+}
+
+/* Rows allocated at a time for the images of a #FpiFrameAssembler */
+#define ASSEMBLER_CANVAS_GROW_ROWS 256
+
+/* The image assembled in one swipe direction. Rows are stored in the order
+ * in which the image grows, which for the reverse direction is bottom up. */
+typedef struct
+{
+  unsigned char *data;
+  unsigned int   rows;
+  unsigned int   height;
+  int            x;
+  int            y;
+  int            delta[2];
+} FpiFrameCanvas;
+
+struct _FpiFrameAssembler
+{
+  struct fpi_frame_asmbl_ctx *ctx;
+  gboolean                    estimate_movement;
+
+  guint                       num_frames;
+  unsigned char              *frame_bufs[2];
+  int                         cur_buf;
+  unsigned long long          total_error;
+  unsigned long long          total_rev_error;
+  int                         total_delta_y;
 
-      y += fpi_frame->delta_y;
-      x += fpi_frame->delta_x;
+  FpiFrameCanvas              canvas;
+  FpiFrameCanvas              rev_canvas;
+};
 
-      aes_blit_stripe (ctx, img, fpi_frame, x, y);
+static void
+frame_canvas_blit (FpiFrameAssembler   *self,
+                   FpiFrameCanvas      *canvas,
+                   const unsigned char *frame_data,
+                   gboolean             upside_down)
+{
+  struct fpi_frame_asmbl_ctx *ctx = self->ctx;
+  unsigned int end = MAX (canvas->y, 0) + ctx->frame_height;
+
+  if (end > canvas->rows)
+    {
+      unsigned int rows = MAX (end, canvas->rows + ASSEMBLER_CANVAS_GROW_ROWS);
+
+      canvas->data = g_realloc (canvas->data, rows * ctx->image_width);
+      memset (canvas->data + canvas->rows * ctx->image_width, 0,
+              (rows - canvas->rows) * ctx->image_width);
+      canvas->rows = rows;
+    }
+  canvas->height = MAX (canvas->height, end);
+
+  if (upside_down)
+    aes_blit_stripe (ctx, canvas->data, ctx->image_width, canvas->rows,
+                     frame_data + (ctx->frame_height - 1) * ctx->frame_width,
+                     -(int) ctx->frame_width, canvas->x, canvas->y);
+  else
+    aes_blit_stripe (ctx, canvas->data, ctx->image_width, canvas->rows,
+                     frame_data, ctx->frame_width, canvas->x, canvas->y);
+}
+
+/**
+ * fpi_frame_assembler_new:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @estimate_movement: whether to estimate the movement between frames,
+ *   or to use the @delta_x and @delta_y provided by the hardware
+ *
+ * Creates a new #FpiFrameAssembler which assembles an image while frames
+ * are being captured. This is the streaming equivalent of calling
+ * fpi_do_movement_estimation() (if @estimate_movement is set) and
+ * fpi_assemble_frames() once the swipe is complete.
+ *
+ * @ctx needs to stay valid and unchanged while frames are added.
+ *
+ * Returns: a new #FpiFrameAssembler
+ */
+FpiFrameAssembler *
+fpi_frame_assembler_new (struct fpi_frame_asmbl_ctx *ctx,
+                         gboolean                    estimate_movement)
+{
+  FpiFrameAssembler *self;
+
+  BUG_ON (ctx->image_width < ctx->frame_width);
+
+  self = g_new0 (FpiFrameAssembler, 1);
+  self->ctx = ctx;
+  self->estimate_movement = estimate_movement;
+
+  return self;
+}
+
+/**
+ * fpi_frame_assembler_reset:
+ * @self: a #FpiFrameAssembler
+ *
+ * Discards all frames that were added so far.
+ */
+void
+fpi_frame_assembler_reset (FpiFrameAssembler *self)
+{
+  g_clear_pointer (&self->frame_bufs[0], g_free);
+  g_clear_pointer (&self->frame_bufs[1], g_free);
+  g_clear_pointer (&self->canvas.data, g_free);
+  g_clear_pointer (&self->rev_canvas.data, g_free);
+  memset (&self->canvas, 0, sizeof (self->canvas));
+  memset (&self->rev_canvas, 0, sizeof (self->rev_canvas));
+
+  self->num_frames = 0;
+  self->cur_buf = 0;
+  self->total_error = 0;
+  self->total_rev_error = 0;
+  self->total_delta_y = 0;
+}
+
+/**
+ * fpi_frame_assembler_free:
+ * @self: a #FpiFrameAssembler
+ *
+ * Frees the assembler and all frames added to it.
+ */
+void
+fpi_frame_assembler_free (FpiFrameAssembler *self)
+{
+  if (!self)
+    return;
+
+  fpi_frame_assembler_reset (self);
+  g_free (self);
+}
+
+/**
+ * fpi_frame_assembler_get_n_frames:
+ * @self: a #FpiFrameAssembler
+ *
+ * Returns: the number of frames added since the last reset
+ */
+guint
+fpi_frame_assembler_get_n_frames (FpiFrameAssembler *self)
+{
+  return self->num_frames;
+}
+
+/**
+ * fpi_frame_assembler_add_frame:
+ * @self: a #FpiFrameAssembler
+ * @frame: the next captured #fpi_frame
+ *
+ * Estimates the movement relative to the previous frame, if requested,
+ * and adds @frame to the image. The frame is not referenced after this
+ * call returns.
+ */
+void
+fpi_frame_assembler_add_frame (FpiFrameAssembler *self,
+                               struct fpi_frame  *frame)
+{
+  struct fpi_frame_asmbl_ctx *ctx = self->ctx;
+  unsigned int frame_size = ctx->frame_width * ctx->frame_height;
+  const unsigned char *prev_data;
+  unsigned char *cur_data;
+  int dx, dy, rev_dx, rev_dy;
+
+  if (!self->frame_bufs[0])
+    {
+      self->frame_bufs[0] = g_malloc (frame_size);
+      self->frame_bufs[1] = g_malloc (frame_size);
+    }
+
+  /* Keep a copy, the previous frame is needed for the next estimation */
+  prev_data = self->frame_bufs[self->cur_buf];
+  self->cur_buf = !self->cur_buf;
+  cur_data = self->frame_bufs[self->cur_buf];
+  if (ctx->linear_frames)
+    memcpy (cur_data, frame->data, frame_size);
+  else
+    frame_get_linear_data (ctx, frame, cur_data);
+
+  if (self->num_frames == 0)
+    {
+      self->canvas.x = (ctx->image_width - ctx->frame_width) / 2;
+      self->rev_canvas.x = self->canvas.x;
+      dx = dy = rev_dx = rev_dy = 0;
+    }
+  else if (self->estimate_movement)
+    {
+      unsigned int min_error;
+
+      find_overlap (ctx, cur_data, prev_data,
+                    self->num_frames > 1 ? self->canvas.delta : NULL,
+                    &self->canvas.delta[0], &self->canvas.delta[1],
+                    &min_error);
+      self->total_error += min_error;
+
+      find_overlap (ctx, prev_data, cur_data,
+                    self->num_frames > 1 ? self->rev_canvas.delta : NULL,
+                    &self->rev_canvas.delta[0], &self->rev_canvas.delta[1],
+                    &min_error);
+      self->total_rev_error += min_error;
+
+      dx = self->canvas.delta[0];
+      dy = self->canvas.delta[1];
+      rev_dx = -self->rev_canvas.delta[0];
+      rev_dy = -self->rev_canvas.delta[1];
+    }
+  else
+    {
+      dx = rev_dx = frame->delta_x;
+      dy = rev_dy = frame->delta_y;
+      self->total_delta_y += dy;
     }
 
+  /* The reverse image is built upside down, so that both grow downwards */
+  self->canvas.x += dx;
+  self->canvas.y += dy;
+  frame_canvas_blit (self, &self->canvas, cur_data, FALSE);
+
+  self->rev_canvas.x += rev_dx;
+  self->rev_canvas.y -= rev_dy;
+  frame_canvas_blit (self, &self->rev_canvas, cur_data, TRUE);
+
+  self->num_frames++;
+}
+
+/**
+ * fpi_frame_assembler_finish:
+ * @self: a #FpiFrameAssembler
+ *
+ * Chooses the swipe direction and returns the assembled image. The
+ * assembler is reset and can be used for the next swipe.
+ *
+ * Returns: (transfer full): a newly allocated #FpImage, or %NULL if no
+ *   frames were added.
+ */
+FpImage *
+fpi_frame_assembler_finish (FpiFrameAssembler *self)
+{
+  struct fpi_frame_asmbl_ctx *ctx = self->ctx;
+  FpiFrameCanvas *canvas;
+  FpImage *img;
+  gboolean reverse;
+  unsigned int height;
+
+  g_return_val_if_fail (self->num_frames > 0, NULL);
+
+  if (self->estimate_movement)
+    {
+      int err = self->total_error / self->num_frames;
+      int rev_err = self->total_rev_error / self->num_frames;
+
+      fp_dbg ("errors: %d rev: %d", err, rev_err);
+
+      /* Without any movement both errors are 0. Like fpi_assemble_frames(),
+       * keep the forward orientation then. */
+      reverse = self->num_frames > 1 && err >= rev_err;
+    }
+  else
+    {
+      reverse = self->total_delta_y < 0;
+    }
+
+  canvas = reverse ? &self->rev_canvas : &self->canvas;
+
+  /* Like fpi_assemble_frames(), everything past the last frame is cut */
+  height = MAX (canvas->y, 0) + ctx->frame_height;
+  height = MIN (height, canvas->height);
+  fp_dbg ("height is %d", height);
+
+  if (reverse)
+    {
+      unsigned char *tmp = g_malloc (ctx->image_width);
+      unsigned int i;
+
+      for (i = 0; i < height / 2; i++)
+        {
+          unsigned char *top = canvas->data + i * ctx->image_width;
+          unsigned char *bottom = canvas->data + (height - 1 - i) * ctx->image_width;
+
+          memcpy (tmp, top, ctx->image_width);
+          memcpy (top, bottom, ctx->image_width);
+          memcpy (bottom, tmp, ctx->image_width);
+        }
+      g_free (tmp);
+    }
+
+  /* Hand the canvas over to the image */
+  img = fp_image_new (ctx->image_width, 0);
+  img->flags = FPI_IMAGE_COLORS_INVERTED;
+  img->flags |= reverse ? 0 :  FPI_IMAGE_H_FLIPPED | FPI_IMAGE_V_FLIPPED;
+  img->width = ctx->image_width;
+  img->height = height;
+  g_free (img->data);
+  img->data = g_realloc (g_steal_pointer (&canvas->data), height * ctx->image_width);
+
+  fpi_frame_assembler_reset (self);
+
   return img;
 }
 
+/* Index of the first element of the sorted @window that is not smaller
+ * than @value. */
 static int
-cmpint (const void *p1, const void *p2, gpointer data)
+window_lower_bound (const int *window,
+                    int        len,
+                    int        value)
 {
-  int a = *((int *) p1);
-  int b = *((int *) p2);
+  int lo = 0, hi = len;
 
-  if (a < b)
-    return -1;
-  else if (a == b)
-    return 0;
-  else
-    return 1;
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+
+      if (window[mid] < value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
 }
 
-static void
-median_filter (int *data, int size, int filtersize)
+/**
+ * fpi_median_filter:
+ * @data: values to filter
+ * @size: number of items in @data
+ * @filtersize: size of the filter window
+ *
+ * Replaces every value in @data by the median of the values around it.
+ * The window is clipped at both ends of @data. For windows with an even
+ * number of values, the upper of the two middle values is used.
+ */
+void
+fpi_median_filter (int *data, int size, int filtersize)
 {
-  int i;
-  int *result = (int *) g_malloc0 (size * sizeof (int));
-  int *sortbuf = (int *) g_malloc0 (filtersize * sizeof (int));
+  int i, pos;
+  int half = MAX ((filtersize - 1) / 2, 0);
+  int len = 0;
+  int *result = g_new (int, MAX (size, 1));
+  /* Sorted values of the current window. It slides by removing one value
+   * and inserting another one, instead of sorting every window again. */
+  int *window = g_new (int, 2 * half + 1);
+
+  for (i = 0; i < MIN (half, size); i++)
+    {
+      pos = window_lower_bound (window, len, data[i]);
+      memmove (window + pos + 1, window + pos, (len - pos) * sizeof (int));
+      window[pos] = data[i];
+      len++;
+    }
 
   for (i = 0; i < size; i++)
     {
-      int i1 = i - (filtersize - 1) / 2;
-      int i2 = i + (filtersize - 1) / 2;
-      if (i1 < 0)
-        i1 = 0;
-      if (i2 >= size)
-        i2 = size - 1;
-      memmove (sortbuf, data + i1, (i2 - i1 + 1) * sizeof (int));
-      g_qsort_with_data (sortbuf, i2 - i1 + 1, sizeof (int), cmpint, NULL);
-      result[i] = sortbuf[(i2 - i1 + 1) / 2];
+      if (i + half < size)
+        {
+          int value = data[i + half];
+
+          pos = window_lower_bound (window, len, value);
+          memmove (window + pos + 1, window + pos, (len - pos) * sizeof (int));
+          window[pos] = value;
+          len++;
+        }
+
+      result[i] = window[len / 2];
+
+      if (i - half >= 0)
+        {
+          pos = window_lower_bound (window, len, data[i - half]);
+          memmove (window + pos, window + pos + 1, (len - pos - 1) * sizeof (int));
+          len--;
+        }
     }
   memmove (data, result, size * sizeof (int));
   g_free (result);
-  g_free (sortbuf);
+  g_free (window);
+}
+
+/* Computes output[i] = (w1 * p1[i] + w2 * p2[i]) / (w1 + w2) for 8 bit
+ * pixels. The division by the same d = w1 + w2 for every pixel is done as a
+ * multiplication and a shift, which gives exactly the same results:
+ *   a / d = (a * m) >> shift   for all 0 <= a < 2 ^ k
+ * with shift = k + ceil (log2 (d)) and m = 2 ^ shift / d + 1.
+ * The caller needs to make sure that 255 * d < 2 ^ 30, so that m and a fit
+ * into 32 bits and a * m into 64 bits.
+ */
+static void
+interpolate_linear (const unsigned char *p1,
+                    const unsigned char *p2,
+                    guint32              w1,
+                    guint32              w2,
+                    unsigned char       *output,
+                    int                  size)
+{
+  guint32 d = w1 + w2;
+  guint shift = g_bit_storage (255 * d) + (d > 1 ? g_bit_storage (d - 1) : 0);
+  guint32 m = (G_GUINT64_CONSTANT (1) << shift) / d + 1;
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i vw1 = _mm_set1_epi32 (w1);
+  __m128i vw2 = _mm_set1_epi32 (w2);
+  __m128i vm = _mm_set1_epi32 (m);
+  __m128i vshift = _mm_cvtsi32_si128 (shift);
+
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (p1 + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (p2 + i));
+      __m128i a16[2] = { _mm_unpacklo_epi8 (a, zero), _mm_unpackhi_epi8 (a, zero) };
+      __m128i b16[2] = { _mm_unpacklo_epi8 (b, zero), _mm_unpackhi_epi8 (b, zero) };
+      __m128i q[4];
+      int j;
+
+      for (j = 0; j < 4; j++)
+        {
+          __m128i a32, b32, even, odd;
+
+          if (j % 2 == 0)
+            {
+              a32 = _mm_unpacklo_epi16 (a16[j / 2], zero);
+              b32 = _mm_unpacklo_epi16 (b16[j / 2], zero);
+            }
+          else
+            {
+              a32 = _mm_unpackhi_epi16 (a16[j / 2], zero);
+              b32 = _mm_unpackhi_epi16 (b16[j / 2], zero);
+            }
+
+          /* 32 x 32 bit multiplications are only available for the even
+           * lanes, do the odd ones separately. */
+          even = _mm_add_epi64 (_mm_mul_epu32 (a32, vw1),
+                                _mm_mul_epu32 (b32, vw2));
+          odd = _mm_add_epi64 (_mm_mul_epu32 (_mm_srli_epi64 (a32, 32), vw1),
+                               _mm_mul_epu32 (_mm_srli_epi64 (b32, 32), vw2));
+          even = _mm_srl_epi64 (_mm_mul_epu32 (even, vm), vshift);
+          odd = _mm_srl_epi64 (_mm_mul_epu32 (odd, vm), vshift);
+          q[j] = _mm_or_si128 (even, _mm_slli_epi64 (odd, 32));
+        }
+
+      _mm_storeu_si128 ((__m128i *) (output + i),
+                        _mm_packus_epi16 (_mm_packs_epi32 (q[0], q[1]),
+                                          _mm_packs_epi32 (q[2], q[3])));
+    }
+#elif defined(__ARM_NEON)
+  uint32x4_t vw1 = vdupq_n_u32 (w1);
+  uint32x4_t vw2 = vdupq_n_u32 (w2);
+  uint32x2_t vm = vdup_n_u32 (m);
+  int64x2_t vshift = vdupq_n_s64 (-(gint64) shift);
+
+  for (; i + 8 <= size; i += 8)
+    {
+      uint16x8_t a16 = vmovl_u8 (vld1_u8 (p1 + i));
+      uint16x8_t b16 = vmovl_u8 (vld1_u8 (p2 + i));
+      uint32x4_t lo = vmlaq_u32 (vmulq_u32 (vmovl_u16 (vget_low_u16 (a16)), vw1),
+                                 vmovl_u16 (vget_low_u16 (b16)), vw2);
+      uint32x4_t hi = vmlaq_u32 (vmulq_u32 (vmovl_u16 (vget_high_u16 (a16)), vw1),
+                                 vmovl_u16 (vget_high_u16 (b16)), vw2);
+      uint32x4_t q_lo, q_hi;
+
+      q_lo = vcombine_u32 (vmovn_u64 (vshlq_u64 (vmull_u32 (vget_low_u32 (lo), vm), vshift)),
+                           vmovn_u64 (vshlq_u64 (vmull_u32 (vget_high_u32 (lo), vm), vshift)));
+      q_hi = vcombine_u32 (vmovn_u64 (vshlq_u64 (vmull_u32 (vget_low_u32 (hi), vm), vshift)),
+                           vmovn_u64 (vshlq_u64 (vmull_u32 (vget_high_u32 (hi), vm), vshift)));
+      vst1_u8 (output + i, vmovn_u16 (vcombine_u16 (vmovn_u32 (q_lo), vmovn_u32 (q_hi))));
+    }
+#endif
+
+  for (; i < size; i++)
+    output[i] = ((guint64) (w1 * p1[i] + w2 * p2[i]) * m) >> shift;
+}
+
+static inline unsigned char
+line_get_pixel (struct fpi_line_asmbl_ctx *ctx,
+                GSList                    *line,
+                unsigned int               x)
+{
+  if (ctx->linear_lines)
+    return ((unsigned char *) line->data)[ctx->pixel_offset + x];
+
+  return ctx->get_pixel (ctx, line, x);
 }
 
 static void
@@ -397,38 +1179,34 @@ interpolate_lines (struct fpi_line_asmbl_ctx *ctx,
   if (!line1 || !line2)
     return;
 
+  if (ctx->linear_lines && y1_f <= yi_f && yi_f < y2_f &&
+      255 * (guint64) (y2_f - y1_f) < (1 << 30))
+    {
+      interpolate_linear ((unsigned char *) line1->data + ctx->pixel_offset,
+                          (unsigned char *) line2->data + ctx->pixel_offset,
+                          y2_f - yi_f, yi_f - y1_f,
+                          output, size);
+      return;
+    }
+
   for (i = 0; i < size; i++)
     {
       gint unscaled;
-      p1 = ctx->get_pixel (ctx, line1, i);
-      p2 = ctx->get_pixel (ctx, line2, i);
+      p1 = line_get_pixel (ctx, line1, i);
+      p2 = line_get_pixel (ctx, line2, i);
 
       unscaled = (yi_f - y1_f) * p2 + (y2_f - yi_f) * p1;
       output[i] = (unscaled) / (y2_f - y1_f);
     }
 }
 
-/**
- * fpi_assemble_lines:
- * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
- * @lines: linked list of lines
- * @num_lines: number of items in @lines to process
- *
- * #fpi_assemble_lines assembles individual lines into a single image.
- * It also rescales image to account variable swiping speed.
- *
- * Note that @num_lines might be shorter than the length of the list,
- * if some lines should be skipped.
- *
- * Returns: a newly allocated #fp_img.
- */
-FpImage *
-fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
-                    GSList *lines, size_t num_lines)
+static FpImage *
+assemble_lines (struct fpi_line_asmbl_ctx *ctx,
+                GSList                   **rows,
+                size_t                     num_lines)
 {
   /* Number of output lines per distance between two scanners */
   int i;
-  GSList *row1, *row2;
   /* The y coordinate is tracked as a 16.16 fixed point number. All
    * variables postfixed with _f follow this format here and in
    * interpolate_lines.
@@ -441,13 +1219,9 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
   unsigned char *output = g_malloc0 (ctx->line_width * ctx->max_height);
   FpImage *img;
 
-  g_return_val_if_fail (lines != NULL, NULL);
-  g_return_val_if_fail (num_lines >= 2, NULL);
-
   fp_dbg ("%"G_GINT64_FORMAT, g_get_real_time ());
 
-  row1 = lines;
-  for (i = 0; (i < num_lines - 1) && row1; i += 2)
+  for (i = 0; i < num_lines - 1; i += 2)
     {
       int bestmatch = i;
       int bestdiff = 0;
@@ -456,33 +1230,27 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
       firstrow = i + 1;
       lastrow = MIN (i + ctx->max_search_offset, num_lines - 1);
 
-      row2 = g_slist_next (row1);
       for (j = firstrow; j <= lastrow; j++)
         {
           int diff = ctx->get_deviation (ctx,
-                                         row1,
-                                         row2);
+                                         rows[i],
+                                         rows[j]);
           if ((j == firstrow) || (diff < bestdiff))
             {
               bestdiff = diff;
               bestmatch = j;
             }
-          row2 = g_slist_next (row2);
         }
       offsets[i / 2] = bestmatch - i;
       fp_dbg ("%d", offsets[i / 2]);
-      row1 = g_slist_next (row1);
-      if (row1)
-        row1 = g_slist_next (row1);
     }
 
-  median_filter (offsets, (num_lines / 2) - 1, ctx->median_filter_size);
+  fpi_median_filter (offsets, (num_lines / 2) - 1, ctx->median_filter_size);
 
   fp_dbg ("offsets_filtered: %"G_GINT64_FORMAT, g_get_real_time ());
   for (i = 0; i <= (num_lines / 2) - 1; i++)
     fp_dbg ("%d", offsets[i]);
-  row1 = lines;
-  for (i = 0; i < num_lines - 1; i++, row1 = g_slist_next (row1))
+  for (i = 0; i < num_lines - 1; i++)
     {
       int offset = offsets[i / 2];
       if (offset > 0)
@@ -493,8 +1261,8 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
               if (line_ind > ctx->max_height - 1)
                 goto out;
               interpolate_lines (ctx,
-                                 row1, y_f,
-                                 g_slist_next (row1),
+                                 rows[i], y_f,
+                                 rows[i + 1],
                                  ynext_f,
                                  output + line_ind * ctx->line_width,
                                  line_ind << 16,
@@ -514,3 +1282,73 @@ out:
   g_free (output);
   return img;
 }
+
+/**
+ * fpi_assemble_lines:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @lines: linked list of lines
+ * @num_lines: number of items in @lines to process
+ *
+ * #fpi_assemble_lines assembles individual lines into a single image.
+ * It also rescales image to account variable swiping speed.
+ *
+ * Note that @num_lines might be shorter than the length of the list,
+ * if some lines should be skipped.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
+                    GSList *lines, size_t num_lines)
+{
+  g_autofree GSList **rows = NULL;
+  GSList *l;
+  size_t i;
+
+  g_return_val_if_fail (lines != NULL, NULL);
+  g_return_val_if_fail (num_lines >= 2, NULL);
+
+  rows = g_new (GSList *, num_lines);
+  for (l = lines, i = 0; i < num_lines; l = g_slist_next (l), i++)
+    {
+      g_return_val_if_fail (l != NULL, NULL);
+      rows[i] = l;
+    }
+
+  return assemble_lines (ctx, rows, num_lines);
+}
+
+/**
+ * fpi_assemble_lines_ring:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @lines: a #fpi_asmbl_ring of lines
+ *
+ * Same as fpi_assemble_lines(), for all the lines stored in a
+ * #fpi_asmbl_ring.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_lines_ring (struct fpi_line_asmbl_ctx *ctx,
+                         struct fpi_asmbl_ring     *lines)
+{
+  g_autofree GSList *nodes = NULL;
+  g_autofree GSList **rows = NULL;
+  unsigned int i;
+
+  g_return_val_if_fail (lines != NULL, NULL);
+  g_return_val_if_fail (lines->len >= 2, NULL);
+
+  /* The line callbacks take list nodes, back them with an array so that
+   * no list has to be built for every line. */
+  nodes = g_new (GSList, lines->len);
+  rows = g_new (GSList *, lines->len);
+  for (i = 0; i < lines->len; i++)
+    {
+      nodes[i].data = fpi_asmbl_ring_get (lines, i);
+      nodes[i].next = i + 1 < lines->len ? &nodes[i + 1] : NULL;
+      rows[i] = &nodes[i];
+    }
+
+  return assemble_lines (ctx, rows, lines->len);
+}
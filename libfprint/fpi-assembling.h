@@ -38,11 +38,82 @@ struct fpi_frame
   unsigned char data[0];
 };
 
+/**
+ * fpi_asmbl_ring:
+ * @data: storage for @capacity entries
+ * @stride: distance in bytes between the starts of two adjacent entries
+ * @capacity: number of entries that fit into @data
+ * @first: index of the oldest entry in @data
+ * @len: number of entries currently stored
+ *
+ * #fpi_asmbl_ring is a ring buffer of fixed-size frames or lines kept in a
+ * single block of memory. Drivers can receive data straight into the slots
+ * returned by fpi_asmbl_ring_push() and hand the ring to the assembling
+ * routines, instead of allocating every entry and building a #GSList.
+ *
+ * Once the ring is full, pushing another entry drops the oldest one.
+ *
+ * Drivers that already store their entries in an array can describe it
+ * with a #fpi_asmbl_ring by filling in the fields directly, with @first
+ * set to 0 and @capacity equal to @len.
+ */
+struct fpi_asmbl_ring
+{
+  unsigned char *data;
+  gsize          stride;
+  unsigned int   capacity;
+  unsigned int   first;
+  unsigned int   len;
+};
+
+void fpi_asmbl_ring_init (struct fpi_asmbl_ring *ring,
+                          gsize                  entry_size,
+                          unsigned int           capacity);
+void fpi_asmbl_ring_clear (struct fpi_asmbl_ring *ring);
+void fpi_asmbl_ring_reset (struct fpi_asmbl_ring *ring);
+gpointer fpi_asmbl_ring_push (struct fpi_asmbl_ring *ring);
+
+/**
+ * fpi_asmbl_ring_get:
+ * @ring: a #fpi_asmbl_ring
+ * @i: position of the entry, 0 being the oldest one
+ *
+ * Returns: (transfer none): the entry at position @i in @ring
+ */
+static inline gpointer
+fpi_asmbl_ring_get (const struct fpi_asmbl_ring *ring,
+                    unsigned int                 i)
+{
+  return ring->data + ((ring->first + i) % ring->capacity) * ring->stride;
+}
+
+/**
+ * FpiFrameSearchMode:
+ * @FPI_FRAME_SEARCH_EXHAUSTIVE: Search all vertical and horizontal offsets
+ *   for every pair of frames.
+ * @FPI_FRAME_SEARCH_PREDICTIVE: Search a small window around the offset of
+ *   the previous pair of frames first, and only fall back to the exhaustive
+ *   search if the best match in the window is not good enough.
+ *
+ * Strategy used by fpi_do_movement_estimation() to find the overlap
+ * between adjacent frames.
+ */
+typedef enum {
+  FPI_FRAME_SEARCH_EXHAUSTIVE = 0,
+  FPI_FRAME_SEARCH_PREDICTIVE,
+} FpiFrameSearchMode;
+
 /**
  * fpi_frame_asmbl_ctx:
  * @frame_width: width of the frame
  * @frame_height: height of the frame
  * @image_width: resulting image width
+ * @linear_frames: %TRUE if the @data of every #fpi_frame is a row-major
+ *                 8 bit bitmap of @frame_width by @frame_height pixels
+ * @search_mode: #FpiFrameSearchMode used for movement estimation
+ * @search_threshold: for %FPI_FRAME_SEARCH_PREDICTIVE, the largest mean
+ *                    difference per pixel (0 to 255) at which a match
+ *                    found around the previous offset is accepted
  * @get_pixel: pixel accessor, returns pixel brightness at x,y of frame
  *
  * #fpi_frame_asmbl_ctx is a structure holding the context for frame
@@ -51,16 +122,27 @@ struct fpi_frame
  * Drivers should define their own #fpi_frame_asmbl_ctx depending on
  * hardware parameters of scanner. @image_width is usually 25% wider than
  * @frame_width to take horizontal movement into account.
+ *
+ * Setting @linear_frames allows movement estimation to compare whole rows
+ * of the frames directly instead of going through @get_pixel. Otherwise
+ * every frame is unpacked once using @get_pixel.
+ *
+ * As swipe speed usually changes smoothly, drivers may select
+ * %FPI_FRAME_SEARCH_PREDICTIVE to speed up movement estimation. The
+ * @search_threshold needs to be tuned to the noise level of the sensor.
  */
 struct fpi_frame_asmbl_ctx
 {
-  unsigned int  frame_width;
-  unsigned int  frame_height;
-  unsigned int  image_width;
-  unsigned char (*get_pixel)(struct fpi_frame_asmbl_ctx *ctx,
-                             struct fpi_frame           *frame,
-                             unsigned int                x,
-                             unsigned int                y);
+  unsigned int       frame_width;
+  unsigned int       frame_height;
+  unsigned int       image_width;
+  gboolean           linear_frames;
+  FpiFrameSearchMode search_mode;
+  unsigned int       search_threshold;
+  unsigned char      (*get_pixel)(struct fpi_frame_asmbl_ctx *ctx,
+                                  struct fpi_frame           *frame,
+                                  unsigned int                x,
+                                  unsigned int                y);
 };
 
 void fpi_do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
@@ -69,6 +151,31 @@ void fpi_do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
 FpImage *fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
                               GSList                     *stripes);
 
+void fpi_do_movement_estimation_ring (struct fpi_frame_asmbl_ctx *ctx,
+                                      struct fpi_asmbl_ring      *stripes);
+
+FpImage *fpi_assemble_frames_ring (struct fpi_frame_asmbl_ctx *ctx,
+                                   struct fpi_asmbl_ring      *stripes);
+
+/**
+ * FpiFrameAssembler:
+ *
+ * Assembles frames of a swipe sensor into an image while they are being
+ * captured. Movement estimation and copying of each frame happen when it
+ * is added, so that only the choice of the swipe direction is left to do
+ * when the finger is removed.
+ */
+typedef struct _FpiFrameAssembler FpiFrameAssembler;
+
+FpiFrameAssembler *fpi_frame_assembler_new (struct fpi_frame_asmbl_ctx *ctx,
+                                            gboolean                    estimate_movement);
+void fpi_frame_assembler_free (FpiFrameAssembler *self);
+void fpi_frame_assembler_reset (FpiFrameAssembler *self);
+guint fpi_frame_assembler_get_n_frames (FpiFrameAssembler *self);
+void fpi_frame_assembler_add_frame (FpiFrameAssembler *self,
+                                    struct fpi_frame  *frame);
+FpImage *fpi_frame_assembler_finish (FpiFrameAssembler *self);
+
 /**
  * fpi_line_asmbl_ctx:
  * @line_width: width of line
@@ -76,9 +183,13 @@ FpImage *fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
  * @resolution: scale factor used for line assembling routines.
  * @median_filter_size: size of median filter for movement estimation
  * @max_search_offset: the number of lines to search for the next line
+ * @linear_lines: %TRUE if every line holds @line_width 8 bit pixels in a row,
+ *                starting at @pixel_offset
+ * @pixel_offset: offset in bytes of the first pixel within a line
  * @get_deviation: pointer to a function that returns the numerical difference
  *                 between two lines
- * @get_pixel: pixel accessor, returns pixel brightness at x of line
+ * @get_pixel: pixel accessor, returns pixel brightness at x of line. Not
+ *             used if @linear_lines is set.
  *
  * #fpi_line_asmbl_ctx is a structure holding the context for line assembling
  * routines.
@@ -95,7 +206,15 @@ FpImage *fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
  * The function pointed to by @get_deviation should return the numerical difference
  * between two lines. Higher values means lines are more different. If the reader
  * returns two lines at a time, this function should be used to estimate the
- * difference between pairs of lines.
+ * difference between pairs of lines. fpi_sum_std_sq_dev() and
+ * fpi_sum_sq_diff() can be used for that.
+ *
+ * Setting @linear_lines allows interpolating whole lines at once, instead
+ * of fetching every pixel through @get_pixel.
+ *
+ * When lines are assembled from a #fpi_asmbl_ring, @get_deviation and
+ * @get_pixel are passed list nodes whose data points to the ring entries.
+ * Only the data of the nodes should be accessed.
  */
 struct fpi_line_asmbl_ctx
 {
@@ -104,6 +223,8 @@ struct fpi_line_asmbl_ctx
   unsigned int resolution;
   unsigned int median_filter_size;
   unsigned int max_search_offset;
+  gboolean     linear_lines;
+  unsigned int pixel_offset;
   int          (*get_deviation)(struct fpi_line_asmbl_ctx *ctx,
                                 GSList                    *line1,
                                 GSList                    *line2);
@@ -115,3 +236,10 @@ struct fpi_line_asmbl_ctx
 FpImage *fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
                              GSList                    *lines,
                              size_t                     num_lines);
+
+FpImage *fpi_assemble_lines_ring (struct fpi_line_asmbl_ctx *ctx,
+                                  struct fpi_asmbl_ring     *lines);
+
+void fpi_median_filter (int *data,
+                        int  size,
+                        int  filtersize);
@@ -234,6 +234,110 @@ fpi_device_set_scan_type (FpDevice  *device,
   g_object_notify (G_OBJECT (device), "scan-type");
 }
 
+/**
+ * fpi_device_clear_scan_timings:
+ * @device: The #FpDevice
+ *
+ * Drops the stage timings of the previous scan, call this when a new
+ * scan starts. #FpImageDevice does this for its drivers.
+ */
+void
+fpi_device_clear_scan_timings (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  g_array_set_size (priv->scan_timings, 0);
+}
+
+/**
+ * fpi_device_add_scan_timing:
+ * @device: The #FpDevice
+ * @stage: (transfer none): Static name of the stage
+ * @start_us: Start of the stage as returned by g_get_monotonic_time()
+ *
+ * Records that @stage of the current scan ran from @start_us until now.
+ * Does nothing unless fp_device_set_collect_statistics() is enabled.
+ * See fp_device_get_scan_timings() for the stage names in use.
+ */
+void
+fpi_device_add_scan_timing (FpDevice    *device,
+                            const gchar *stage,
+                            gint64       start_us)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpiScanTiming timing;
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+
+  if (G_LIKELY (!priv->collect_statistics) || start_us <= 0)
+    return;
+
+  timing.stage = stage;
+  timing.start_us = start_us;
+  timing.end_us = g_get_monotonic_time ();
+  g_array_append_val (priv->scan_timings, timing);
+}
+
+/**
+ * fpi_device_add_scan_timings:
+ * @device: The #FpDevice
+ * @timings: (nullable): a #GVariant of type "a(stt)"
+ *
+ * Records stages of the current scan that were timed elsewhere, e.g. the
+ * result of fp_image_get_minutiae_timings(). The entries use the same
+ * format as fp_device_get_scan_timings(). Does nothing unless
+ * fp_device_set_collect_statistics() is enabled.
+ */
+void
+fpi_device_add_scan_timings (FpDevice *device,
+                             GVariant *timings)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  GVariantIter iter;
+  const gchar *stage;
+  guint64 start_us, duration_us;
+
+  g_return_if_fail (FP_IS_DEVICE (device));
+  g_return_if_fail (timings == NULL ||
+                    g_variant_is_of_type (timings, G_VARIANT_TYPE ("a(stt)")));
+
+  if (G_LIKELY (!priv->collect_statistics) || timings == NULL)
+    return;
+
+  g_variant_iter_init (&iter, timings);
+  while (g_variant_iter_next (&iter, "(&stt)", &stage, &start_us, &duration_us))
+    {
+      FpiScanTiming timing;
+
+      timing.stage = g_intern_string (stage);
+      timing.start_us = start_us;
+      timing.end_us = start_us + duration_us;
+      g_array_append_val (priv->scan_timings, timing);
+    }
+}
+
+/**
+ * fpi_device_get_main_context:
+ * @device: The #FpDevice
+ *
+ * Gets the #GMainContext that the device was opened in, see
+ * fp_device_open(). Drivers that attach their own #GSource need to use
+ * this context instead of the global default one.
+ *
+ * Returns: (transfer none): The #GMainContext of the device
+ */
+GMainContext *
+fpi_device_get_main_context (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+
+  return priv->main_context;
+}
+
 typedef struct
 {
   GSource   source;
@@ -255,8 +359,13 @@ timeout_dispatch (GSource *source, GSourceFunc gsource_func, gpointer user_data)
 {
   FpDeviceTimeoutSource *timeout_source = (FpDeviceTimeoutSource *) source;
   FpTimeoutFunc callback = (FpTimeoutFunc) gsource_func;
+  GMainContext *context = g_source_get_context (source);
 
+  /* Like GTask callbacks, so that asynchronous operations started from
+   * here complete in the context of the device. */
+  g_main_context_push_thread_default (context);
   callback (timeout_source->device, user_data);
+  g_main_context_pop_thread_default (context);
 
   return G_SOURCE_REMOVE;
 }
@@ -278,7 +387,8 @@ static GSourceFuncs timeout_funcs = {
  * @destroy_notify: (nullable): #GDestroyNotify for @user_data
  *
  * Register a timeout to run. Drivers should always make sure that timers are
- * cancelled when appropriate.
+ * cancelled when appropriate. The timeout is dispatched in the context
+ * returned by fpi_device_get_main_context().
  *
  * Returns: (transfer none): A newly created and attached #GSource
  */
@@ -296,7 +406,7 @@ fpi_device_add_timeout (FpDevice      *device,
                                                    sizeof (FpDeviceTimeoutSource));
   source->device = device;
 
-  g_source_attach (&source->source, NULL);
+  g_source_attach (&source->source, priv->main_context);
   g_source_set_callback (&source->source, (GSourceFunc) func, user_data, destroy_notify);
   g_source_set_ready_time (&source->source,
                            g_source_get_time (&source->source) + interval * (guint64) 1000);
@@ -326,6 +436,43 @@ fpi_device_get_usb_device (FpDevice *device)
   return priv->usb_device;
 }
 
+/* Private, used by fpi_usb_transfer_new() to recycle transfers.
+ * Returns NULL while the device is being finalized. */
+GQueue *
+fpi_device_get_usb_transfer_pool (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+
+  return priv->usb_transfer_pool;
+}
+
+/* Private, returns the statistics to update for a transfer, or NULL if
+ * fp_device_set_collect_statistics() was not enabled. */
+FpiUsbStatistics *
+fpi_device_get_usb_statistics (FpDevice       *device,
+                               FpiTransferType type,
+                               guint8          endpoint)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpiUsbStatistics *stats;
+  guint key;
+
+  if (G_LIKELY (!priv->collect_statistics))
+    return NULL;
+
+  key = type << 8 | endpoint;
+  stats = g_hash_table_lookup (priv->usb_statistics, GUINT_TO_POINTER (key));
+  if (!stats)
+    {
+      stats = g_new0 (FpiUsbStatistics, 1);
+      stats->type = type;
+      stats->endpoint = endpoint;
+      g_hash_table_insert (priv->usb_statistics, GUINT_TO_POINTER (key), stats);
+    }
+
+  return stats;
+}
+
 /**
  * fpi_device_get_virtual_env:
  * @device: The #FpDevice
@@ -749,7 +896,7 @@ fpi_device_return_task_in_idle (FpDevice              *device,
                          data,
                          (GDestroyNotify) fpi_device_task_return_data_free);
 
-  g_source_attach (priv->current_task_idle_return_source, NULL);
+  g_source_attach (priv->current_task_idle_return_source, priv->main_context);
   g_source_unref (priv->current_task_idle_return_source);
 }
 
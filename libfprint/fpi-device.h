@@ -203,6 +203,8 @@ void fpi_device_get_delete_data (FpDevice *device,
 GCancellable *fpi_device_get_cancellable (FpDevice *device);
 
 
+GMainContext * fpi_device_get_main_context (FpDevice *device);
+
 GSource * fpi_device_add_timeout (FpDevice      *device,
                                   gint           interval,
                                   FpTimeoutFunc  func,
@@ -215,6 +217,13 @@ void fpi_device_set_nr_enroll_stages (FpDevice *device,
 void fpi_device_set_scan_type (FpDevice  *device,
                                FpScanType scan_type);
 
+void fpi_device_clear_scan_timings (FpDevice *device);
+void fpi_device_add_scan_timing (FpDevice    *device,
+                                 const gchar *stage,
+                                 gint64       start_us);
+void fpi_device_add_scan_timings (FpDevice *device,
+                                  GVariant *timings);
+
 void fpi_device_action_error (FpDevice *device,
                               GError   *error);
 
@@ -22,6 +22,7 @@
 
 #include "fp-image-device-private.h"
 #include "fp-image-device.h"
+#include "fp-print-private.h"
 
 /**
  * SECTION: fpi-image
@@ -59,7 +60,7 @@ fpi_image_device_activate (FpImageDevice *self)
 
   /* We might have been waiting for deactivation to finish before
    * starting the next operation. */
-  g_clear_handle_id (&priv->pending_activation_timeout_id, g_source_remove);
+  g_clear_pointer (&priv->pending_activation_timeout, g_source_destroy);
 
   fp_dbg ("Activating image device\n");
   cls->activate (self);
@@ -89,6 +90,180 @@ fpi_image_device_deactivate (FpImageDevice *self)
   cls->deactivate (self);
 }
 
+void
+fpi_image_device_flush_pending_scans (FpImageDevice *self)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImage *image;
+
+  /* Any running minutiae detection is ignored once it finishes */
+  while ((image = g_queue_pop_head (priv->pending_scans)))
+    g_object_unref (image);
+
+  g_clear_pointer (&priv->scan_checksum, g_free);
+}
+
+/* Match cache
+ *
+ * Scans that are submitted again unchanged (e.g. by retrying clients) do
+ * not need minutiae detection and matching again. The cache is keyed by a
+ * checksum of the raw image, and stores the print extracted from it
+ * together with the results of matching it against templates, which are
+ * identified by a checksum of their minutiae. Only identical data is ever
+ * considered a hit, so a cached result is always the one the full
+ * pipeline would produce. */
+
+typedef struct
+{
+  gchar      *checksum;
+  FpPrint    *print;
+  GHashTable *results;
+} FpImageDeviceCacheEntry;
+
+static void
+fp_image_device_cache_entry_free (FpImageDeviceCacheEntry *entry)
+{
+  g_free (entry->checksum);
+  g_clear_object (&entry->print);
+  g_hash_table_unref (entry->results);
+  g_free (entry);
+}
+
+void
+fpi_image_device_clear_match_cache (FpImageDevice *self)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImageDeviceCacheEntry *entry;
+
+  while ((entry = g_queue_pop_head (priv->match_cache)))
+    fp_image_device_cache_entry_free (entry);
+}
+
+static gchar *
+image_checksum (FpImage *image)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  guint size[2] = { image->width, image->height };
+
+  g_checksum_update (checksum, (const guchar *) size, sizeof (size));
+  g_checksum_update (checksum, image->data, image->width * image->height);
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+static gchar *
+template_checksum (FpPrint *template)
+{
+  g_autoptr(GChecksum) checksum = NULL;
+  gint i;
+
+  if (template->type != FPI_PRINT_NBIS)
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  for (i = 0; i < template->prints->len; i++)
+    {
+      struct xyt_struct *xyt = g_ptr_array_index (template->prints, i);
+
+      g_checksum_update (checksum, (const guchar *) &xyt->nrows, sizeof (xyt->nrows));
+      g_checksum_update (checksum, (const guchar *) xyt->xcol, xyt->nrows * sizeof (int));
+      g_checksum_update (checksum, (const guchar *) xyt->ycol, xyt->nrows * sizeof (int));
+      g_checksum_update (checksum, (const guchar *) xyt->thetacol, xyt->nrows * sizeof (int));
+    }
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+/* Returns the entry for @checksum and marks it as most recently used */
+static FpImageDeviceCacheEntry *
+fp_image_device_cache_lookup (FpImageDevice *self, const gchar *checksum)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  GList *l;
+
+  if (!checksum)
+    return NULL;
+
+  for (l = priv->match_cache->head; l; l = l->next)
+    {
+      FpImageDeviceCacheEntry *entry = l->data;
+
+      if (g_strcmp0 (entry->checksum, checksum) != 0)
+        continue;
+
+      g_queue_unlink (priv->match_cache, l);
+      g_queue_push_head_link (priv->match_cache, l);
+
+      return entry;
+    }
+
+  return NULL;
+}
+
+/* Prints are handed out to the API user, so the cache never shares them */
+static FpPrint *
+fp_image_device_copy_print (FpImageDevice *self, FpPrint *print)
+{
+  FpPrint *copy;
+
+  copy = fp_print_new (FP_DEVICE (self));
+  fpi_print_set_type (copy, FPI_PRINT_NBIS);
+  fpi_print_add_print (copy, print);
+  g_set_object (&copy->image, print->image);
+
+  return copy;
+}
+
+static FpImageDeviceCacheEntry *
+fp_image_device_cache_insert (FpImageDevice *self, const gchar *checksum, FpPrint *print)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImageDeviceCacheEntry *entry;
+
+  entry = g_new0 (FpImageDeviceCacheEntry, 1);
+  entry->checksum = g_strdup (checksum);
+  entry->print = fp_image_device_copy_print (self, print);
+  entry->results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_queue_push_head (priv->match_cache, entry);
+
+  while (g_queue_get_length (priv->match_cache) > priv->match_cache_size)
+    fp_image_device_cache_entry_free (g_queue_pop_tail (priv->match_cache));
+
+  return entry;
+}
+
+/* Matches @print against @template, using and filling the results of
+ * @entry if it is not %NULL */
+static FpiMatchResult
+fp_image_device_match (FpImageDevice           *self,
+                       FpImageDeviceCacheEntry *entry,
+                       FpPrint                 *template,
+                       FpPrint                 *print,
+                       GError                 **error)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  g_autofree gchar *checksum = NULL;
+  FpiMatchResult result;
+  gpointer cached;
+
+  if (entry)
+    checksum = template_checksum (template);
+
+  if (checksum && g_hash_table_lookup_extended (entry->results, checksum, NULL, &cached))
+    {
+      fp_dbg ("Using cached match result");
+      return GPOINTER_TO_INT (cached);
+    }
+
+  result = fpi_print_bz3_match (template, print, priv->bz3_threshold, error);
+
+  if (checksum && result != FPI_MATCH_ERROR)
+    g_hash_table_insert (entry->results, g_steal_pointer (&checksum),
+                         GINT_TO_POINTER (result));
+
+  return result;
+}
+
 /* Static helper functions */
 
 static void
@@ -101,62 +276,66 @@ fp_image_device_change_state (FpImageDevice *self, FpiImageDeviceState state)
 
   /* We might have been waiting for the finger to go OFF to start the
    * next operation. */
-  g_clear_handle_id (&priv->pending_activation_timeout_id, g_source_remove);
+  g_clear_pointer (&priv->pending_activation_timeout, g_source_destroy);
 
   fp_dbg ("Image device internal state change from %d to %d\n", priv->state, state);
 
+  if (state == FPI_IMAGE_DEVICE_STATE_CAPTURE)
+    {
+      fpi_device_clear_scan_timings (FP_DEVICE (self));
+      priv->capture_start = g_get_monotonic_time ();
+    }
+
   priv->state = state;
   g_object_notify (G_OBJECT (self), "fpi-image-device-state");
   g_signal_emit_by_name (self, "fpi-image-device-state-changed", priv->state);
 }
 
+/* Enrollment is pipelined: the device waits for the next touch as soon as
+ * the finger was lifted, while the minutiae of earlier scans are still being
+ * detected. It only holds back if too many scans are pending already, or
+ * if the pending ones may be enough to complete the enrollment. */
 static void
 fp_image_device_enroll_maybe_await_finger_on (FpImageDevice *self)
 {
   FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  guint pending = g_queue_get_length (priv->pending_scans);
 
-  if (priv->enroll_await_on_pending)
-    {
-      priv->enroll_await_on_pending = FALSE;
-      fp_image_device_change_state (self, FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON);
-    }
-  else
+  if (!priv->enroll_await_on_pending ||
+      priv->state != FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_OFF)
+    return;
+
+  if (pending >= IMG_ENROLL_MAX_PENDING_SCANS ||
+      priv->enroll_stage + pending >= IMG_ENROLL_STAGES)
     {
-      priv->enroll_await_on_pending = TRUE;
+      fp_dbg ("Not awaiting the next touch, %u scans are pending", pending);
+      return;
     }
+
+  priv->enroll_await_on_pending = FALSE;
+  fp_image_device_change_state (self, FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON);
 }
 
+static void fp_image_device_detect_next_minutiae (FpImageDevice *self);
+
+/* Completes the scan at the head of the queue. @print is the print
+ * extracted from @image if it is already known. */
 static void
-fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+fp_image_device_scan_completed (FpImageDevice *self,
+                                FpImage       *image_in,
+                                FpPrint       *print_in,
+                                GError        *error)
 {
-  g_autoptr(FpImage) image = FP_IMAGE (source_object);
-  g_autoptr(FpPrint) print = NULL;
-  GError *error = NULL;
-  FpImageDevice *self = FP_IMAGE_DEVICE (user_data);
+  g_autoptr(FpImage) image = image_in;
+  g_autoptr(FpPrint) print = print_in;
+  g_autofree gchar *checksum = NULL;
   FpDevice *device = FP_DEVICE (self);
-  FpImageDevicePrivate *priv;
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImageDeviceCacheEntry *entry = NULL;
   FpiDeviceAction action;
+  gint64 start;
 
-  /* Note: We rely on the device to not disappear during an operation. */
-
-  if (!fp_image_detect_minutiae_finish (image, res, &error))
-    {
-      /* Cancel operation . */
-      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        {
-          fpi_device_action_error (device, g_steal_pointer (&error));
-          fpi_image_device_deactivate (self);
-          return;
-        }
-
-      /* Replace error with a retry condition. */
-      g_warning ("Failed to detect minutiae: %s", error->message);
-      g_clear_pointer (&error, g_error_free);
-
-      error = fpi_device_retry_new_msg (FP_DEVICE_RETRY_GENERAL, "Minutiae detection failed, please retry");
-    }
-
-  priv = fp_image_device_get_instance_private (FP_IMAGE_DEVICE (device));
+  checksum = g_steal_pointer (&priv->scan_checksum);
   action = fpi_device_get_current_action (device);
 
   if (action == FPI_DEVICE_ACTION_CAPTURE)
@@ -166,12 +345,21 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
       return;
     }
 
-  if (!error)
+  if (!error && print)
+    {
+      entry = fp_image_device_cache_lookup (self, checksum);
+    }
+  else if (!error)
     {
+      start = g_get_monotonic_time ();
       print = fp_print_new (device);
       fpi_print_set_type (print, FPI_PRINT_NBIS);
       if (!fpi_print_add_from_image (print, image, &error))
         g_clear_object (&print);
+      fpi_device_add_scan_timing (device, "extract", start);
+
+      if (print && checksum)
+        entry = fp_image_device_cache_insert (self, checksum, print);
     }
 
   if (action == FPI_DEVICE_ACTION_ENROLL)
@@ -191,12 +379,16 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
       /* Start another scan or deactivate. */
       if (priv->enroll_stage == IMG_ENROLL_STAGES)
         {
+          fpi_image_device_flush_pending_scans (self);
           fpi_device_enroll_complete (device, g_object_ref (enroll_print), NULL);
           fpi_image_device_deactivate (self);
         }
       else
         {
-          fp_image_device_enroll_maybe_await_finger_on (FP_IMAGE_DEVICE (device));
+          if (!g_queue_is_empty (priv->pending_scans))
+            fp_image_device_detect_next_minutiae (self);
+
+          fp_image_device_enroll_maybe_await_finger_on (self);
         }
     }
   else if (action == FPI_DEVICE_ACTION_VERIFY)
@@ -206,9 +398,15 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
 
       fpi_device_get_verify_data (device, &template);
       if (print)
-        result = fpi_print_bz3_match (template, print, priv->bz3_threshold, &error);
+        {
+          start = g_get_monotonic_time ();
+          result = fp_image_device_match (self, entry, template, print, &error);
+          fpi_device_add_scan_timing (device, "match", start);
+        }
       else
-        result = FPI_MATCH_ERROR;
+        {
+          result = FPI_MATCH_ERROR;
+        }
 
       if (!error || error->domain == FP_DEVICE_RETRY)
         fpi_device_verify_report (device, result, g_steal_pointer (&print), g_steal_pointer (&error));
@@ -222,16 +420,19 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
       FpPrint *result = NULL;
 
       fpi_device_get_identify_data (device, &templates);
+      start = g_get_monotonic_time ();
       for (i = 0; !error && i < templates->len; i++)
         {
           FpPrint *template = g_ptr_array_index (templates, i);
 
-          if (fpi_print_bz3_match (template, print, priv->bz3_threshold, &error) == FPI_MATCH_SUCCESS)
+          if (fp_image_device_match (self, entry, template, print, &error) == FPI_MATCH_SUCCESS)
             {
               result = template;
               break;
             }
         }
+      if (print)
+        fpi_device_add_scan_timing (device, "match", start);
 
       if (!error || error->domain == FP_DEVICE_RETRY)
         fpi_device_identify_report (device, result, g_steal_pointer (&print), g_steal_pointer (&error));
@@ -240,16 +441,115 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
     }
   else
     {
-      /* XXX: This can be hit currently due to a race condition in the enroll code!
-       *      In that case we scan a further image even though the minutiae for the previous
-       *      one have not yet been detected.
-       *      We need to keep track on the pending minutiae detection and the fact that
-       *      it will finish eventually (or we may need to retry on error and activate the
-       *      device again). */
+      /* Scans are dropped when the action ends */
       g_assert_not_reached ();
     }
 }
 
+static void
+fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  FpImage *image;
+  GError *error = NULL;
+  FpImageDevice *self = FP_IMAGE_DEVICE (user_data);
+  FpDevice *device = FP_DEVICE (self);
+  FpImageDevicePrivate *priv;
+
+  /* Note: We rely on the device to not disappear during an operation. */
+
+  priv = fp_image_device_get_instance_private (self);
+
+  /* The action ended while the minutiae were being detected */
+  if (g_queue_peek_head (priv->pending_scans) != (gpointer) source_object)
+    {
+      fp_dbg ("Ignoring minutiae of a dropped scan");
+      fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, NULL);
+      return;
+    }
+
+  image = g_queue_pop_head (priv->pending_scans);
+
+  if (!fp_image_detect_minutiae_finish (image, res, &error))
+    {
+      /* Cancel operation . */
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_object_unref (image);
+          fpi_image_device_flush_pending_scans (self);
+          fpi_device_action_error (device, g_steal_pointer (&error));
+          fpi_image_device_deactivate (self);
+          return;
+        }
+
+      /* Replace error with a retry condition. */
+      g_warning ("Failed to detect minutiae: %s", error->message);
+      g_clear_pointer (&error, g_error_free);
+
+      error = fpi_device_retry_new_msg (FP_DEVICE_RETRY_GENERAL, "Minutiae detection failed, please retry");
+    }
+
+  fpi_device_add_scan_timing (device, "minutiae", priv->minutiae_start);
+  fpi_device_add_scan_timings (device, fp_image_get_minutiae_timings (image));
+
+  fp_image_device_scan_completed (self, image, NULL, error);
+}
+
+static void
+fp_image_device_cached_scan (FpDevice *device, gpointer user_data)
+{
+  FpImageDevice *self = FP_IMAGE_DEVICE (device);
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImageDeviceCacheEntry *entry;
+
+  /* The action ended in the meantime */
+  if (g_queue_peek_head (priv->pending_scans) != user_data)
+    return;
+
+  entry = fp_image_device_cache_lookup (self, priv->scan_checksum);
+  g_assert (entry);
+
+  fp_image_device_scan_completed (self,
+                                  g_queue_pop_head (priv->pending_scans),
+                                  fp_image_device_copy_print (self, entry->print),
+                                  NULL);
+}
+
+static void
+fp_image_device_detect_next_minutiae (FpImageDevice *self)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImage *image = g_queue_peek_head (priv->pending_scans);
+  FpiDeviceAction action;
+
+  action = fpi_device_get_current_action (FP_DEVICE (self));
+
+  /* Only scans that are matched can be looked up, it is computed before
+   * minutiae detection as that normalizes the image data. */
+  g_clear_pointer (&priv->scan_checksum, g_free);
+  if (priv->match_cache_size > 0 &&
+      (action == FPI_DEVICE_ACTION_VERIFY || action == FPI_DEVICE_ACTION_IDENTIFY))
+    {
+      priv->scan_checksum = image_checksum (image);
+
+      if (fp_image_device_cache_lookup (self, priv->scan_checksum))
+        {
+          fp_dbg ("Scan is identical to a cached one, skipping minutiae detection");
+          fpi_device_add_timeout (FP_DEVICE (self), 0, fp_image_device_cached_scan,
+                                  g_object_ref (image), g_object_unref);
+          return;
+        }
+    }
+
+  priv->minutiae_start = g_get_monotonic_time ();
+
+  /* XXX: We also detect minutiae in capture mode, we solely do this
+   *      to normalize the image which will happen as a by-product. */
+  fp_image_detect_minutiae (image,
+                            fpi_device_get_cancellable (FP_DEVICE (self)),
+                            fpi_image_device_minutiae_detected,
+                            self);
+}
+
 /*********************************************************/
 /* Private API */
 
@@ -273,6 +573,40 @@ fpi_image_device_set_bz3_threshold (FpImageDevice *self,
   g_return_if_fail (bz3_threshold > 0);
 
   priv->bz3_threshold = bz3_threshold;
+
+  /* Cached match results depend on the threshold */
+  fpi_image_device_clear_match_cache (self);
+}
+
+/**
+ * fpi_image_device_set_match_cache_size:
+ * @self: a #FpImageDevice imaging fingerprint device
+ * @size: the number of scans to cache, or 0 to disable caching
+ *
+ * Enables caching of the prints extracted from the last @size scans used
+ * for verification or identification, together with their match results.
+ * If the same image is submitted again, minutiae detection and matching
+ * are skipped. Only byte-identical images are considered the same.
+ *
+ * The cache is cleared when the device is closed, when an enrollment
+ * starts and when the matching parameters are changed.
+ */
+void
+fpi_image_device_set_match_cache_size (FpImageDevice *self,
+                                       guint          size)
+{
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+  FpImageDeviceCacheEntry *entry;
+
+  g_return_if_fail (FP_IS_IMAGE_DEVICE (self));
+
+  priv->match_cache_size = size;
+
+  while (g_queue_get_length (priv->match_cache) > priv->match_cache_size)
+    {
+      entry = g_queue_pop_tail (priv->match_cache);
+      fp_image_device_cache_entry_free (entry);
+    }
 }
 
 /**
@@ -324,14 +658,19 @@ fpi_image_device_report_finger_status (FpImageDevice *self,
        *  3. We were waiting for finger removal to start the new action
        * Either way, we always end up deactivating except for the enroll case.
        *
-       * The enroll case is special as AWAIT_FINGER_ON should only happen after
-       * minutiae detection to prevent deactivation (without cancellation)
-       * from the AWAIT_FINGER_ON state.
+       * The enroll case is special as AWAIT_FINGER_ON should only happen if
+       * further scans are needed, to prevent deactivation (without
+       * cancellation) from the AWAIT_FINGER_ON state.
        */
       if (action != FPI_DEVICE_ACTION_ENROLL)
-        fpi_image_device_deactivate (self);
+        {
+          fpi_image_device_deactivate (self);
+        }
       else
-        fp_image_device_enroll_maybe_await_finger_on (self);
+        {
+          priv->enroll_await_on_pending = TRUE;
+          fp_image_device_enroll_maybe_await_finger_on (self);
+        }
     }
 }
 
@@ -364,16 +703,17 @@ fpi_image_device_image_captured (FpImageDevice *self, FpImage *image)
                     action == FPI_DEVICE_ACTION_IDENTIFY ||
                     action == FPI_DEVICE_ACTION_CAPTURE);
 
+  priv->enroll_await_on_pending = FALSE;
   fp_image_device_change_state (self, FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_OFF);
 
   g_debug ("Image device captured an image");
 
-  /* XXX: We also detect minutiae in capture mode, we solely do this
-   *      to normalize the image which will happen as a by-product. */
-  fp_image_detect_minutiae (image,
-                            fpi_device_get_cancellable (FP_DEVICE (self)),
-                            fpi_image_device_minutiae_detected,
-                            self);
+  fpi_device_add_scan_timing (FP_DEVICE (self), "capture", priv->capture_start);
+
+  /* Minutiae are detected one scan at a time, so results arrive in order */
+  g_queue_push_tail (priv->pending_scans, image);
+  if (g_queue_get_length (priv->pending_scans) == 1)
+    fp_image_device_detect_next_minutiae (self);
 }
 
 /**
@@ -411,7 +751,7 @@ fpi_image_device_retry_scan (FpImageDevice *self, FpDeviceRetry retry)
 
       /* Wait for finger removal and re-touch.
        * TODO: Do we need to check that the finger is already off? */
-      priv->enroll_await_on_pending = TRUE;
+      priv->enroll_await_on_pending = FALSE;
       fp_image_device_change_state (self, FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_OFF);
     }
   else if (action == FPI_DEVICE_ACTION_VERIFY)
@@ -497,6 +837,8 @@ fpi_image_device_session_error (FpImageDevice *self, GError *error)
   if (error->domain == FP_DEVICE_RETRY)
     g_warning ("Driver should report retries using fpi_image_device_retry_scan!");
 
+  fpi_image_device_flush_pending_scans (self);
+
   priv->cancelling = TRUE;
   fpi_image_device_deactivate (self);
   priv->cancelling = FALSE;
@@ -540,6 +882,16 @@ fpi_image_device_activate_complete (FpImageDevice *self, GError *error)
   fp_image_device_change_state (self, FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON);
 }
 
+static void
+pending_activation_idle (FpDevice *device, gpointer user_data)
+{
+  FpImageDevice *self = FP_IMAGE_DEVICE (device);
+  FpImageDevicePrivate *priv = fp_image_device_get_instance_private (self);
+
+  priv->pending_activation_timeout = NULL;
+  fpi_image_device_activate (self);
+}
+
 /**
  * fpi_image_device_deactivate_complete:
  * @self: a #FpImageDevice imaging fingerprint device
@@ -575,11 +927,12 @@ fpi_image_device_deactivate_complete (FpImageDevice *self, GError *error)
     }
 
   /* We might be waiting to be able to activate again. */
-  if (priv->pending_activation_timeout_id)
+  if (priv->pending_activation_timeout)
     {
-      g_clear_handle_id (&priv->pending_activation_timeout_id, g_source_remove);
-      priv->pending_activation_timeout_id =
-        g_idle_add ((GSourceFunc) fpi_image_device_activate, self);
+      g_source_destroy (priv->pending_activation_timeout);
+      priv->pending_activation_timeout =
+        fpi_device_add_timeout (FP_DEVICE (self), 0, pending_activation_idle, NULL, NULL);
+      g_source_set_priority (priv->pending_activation_timeout, G_PRIORITY_DEFAULT_IDLE);
     }
 }
 
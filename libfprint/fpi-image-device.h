@@ -97,6 +97,8 @@ struct _FpImageDeviceClass
 
 void fpi_image_device_set_bz3_threshold (FpImageDevice *self,
                                          gint           bz3_threshold);
+void fpi_image_device_set_match_cache_size (FpImageDevice *self,
+                                            guint          size);
 
 void fpi_image_device_session_error (FpImageDevice *self,
                                      GError        *error);
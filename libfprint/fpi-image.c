@@ -24,6 +24,11 @@
 #include "fpi-log.h"
 
 #include <nbis.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #if HAVE_PIXMAN
 #include <pixman.h>
@@ -97,15 +102,217 @@ fpi_mean_sq_diff_norm (const guint8 *buf1,
                        const guint8 *buf2,
                        gint          size)
 {
-  int res = 0, i;
+  return fpi_sum_sq_diff (buf1, buf2, size) / size;
+}
 
-  for (i = 0; i < size; i++)
+/**
+ * fpi_sum_sq_diff:
+ * @buf1: buffer (usually bitmap, one byte per pixel)
+ * @buf2: buffer (usually bitmap, one byte per pixel)
+ * @size: buffer size of smallest buffer
+ *
+ * This function calculates the sum of squared differences of two
+ * buffers, as per the following formula:
+ * |[<!-- -->
+ *    sq_diff = sum ((buf1[0..size] - buf2[0..size]) ^ 2)
+ * ]|
+ *
+ * Returns: the sum of squared differences between @buf1 and @buf2
+ */
+gint
+fpi_sum_sq_diff (const guint8 *buf1,
+                 const guint8 *buf2,
+                 gint          size)
+{
+  int res = 0, i = 0;
+
+#if defined(__SSE2__)
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i acc = _mm_setzero_si128 ();
+
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i *) (buf1 + i));
+      __m128i b = _mm_loadu_si128 ((const __m128i *) (buf2 + i));
+      __m128i lo = _mm_sub_epi16 (_mm_unpacklo_epi8 (a, zero),
+                                  _mm_unpacklo_epi8 (b, zero));
+      __m128i hi = _mm_sub_epi16 (_mm_unpackhi_epi8 (a, zero),
+                                  _mm_unpackhi_epi8 (b, zero));
+
+      acc = _mm_add_epi32 (acc, _mm_madd_epi16 (lo, lo));
+      acc = _mm_add_epi32 (acc, _mm_madd_epi16 (hi, hi));
+    }
+  acc = _mm_add_epi32 (acc, _mm_srli_si128 (acc, 8));
+  acc = _mm_add_epi32 (acc, _mm_srli_si128 (acc, 4));
+  res = _mm_cvtsi128_si32 (acc);
+#elif defined(__ARM_NEON)
+  int32x4_t acc = vdupq_n_s32 (0);
+
+  for (; i + 16 <= size; i += 16)
+    {
+      uint8x16_t a = vld1q_u8 (buf1 + i);
+      uint8x16_t b = vld1q_u8 (buf2 + i);
+      int16x8_t lo = vreinterpretq_s16_u16 (vsubl_u8 (vget_low_u8 (a), vget_low_u8 (b)));
+      int16x8_t hi = vreinterpretq_s16_u16 (vsubl_u8 (vget_high_u8 (a), vget_high_u8 (b)));
+
+      acc = vmlal_s16 (acc, vget_low_s16 (lo), vget_low_s16 (lo));
+      acc = vmlal_s16 (acc, vget_high_s16 (lo), vget_high_s16 (lo));
+      acc = vmlal_s16 (acc, vget_low_s16 (hi), vget_low_s16 (hi));
+      acc = vmlal_s16 (acc, vget_high_s16 (hi), vget_high_s16 (hi));
+    }
+  res = vgetq_lane_s32 (acc, 0) + vgetq_lane_s32 (acc, 1) +
+        vgetq_lane_s32 (acc, 2) + vgetq_lane_s32 (acc, 3);
+#endif
+
+  for (; i < size; i++)
     {
       int dev = (int) buf1[i] - (int) buf2[i];
       res += dev * dev;
     }
 
-  return res / size;
+  return res;
+}
+
+/**
+ * fpi_sum_std_sq_dev:
+ * @buf1: buffer (usually a line, one byte per pixel)
+ * @buf2: buffer (usually a line, one byte per pixel)
+ * @size: number of pixels to use from each buffer
+ * @stride: distance between two used pixels in the buffers
+ *
+ * Calculates the squared standard deviation of the sum of two buffers,
+ * as per the following formula:
+ * |[<!-- -->
+ *    sum[i] = buf1[i * stride] + buf2[i * stride]
+ *    mean = sum (sum[0..size]) / size
+ *    sq_dev = sum ((sum[0..size] - mean) ^ 2) / size
+ * ]|
+ * This function is usually used by line assembling drivers to find out
+ * how well two lines, captured by two scanners of the sensor, match.
+ *
+ * Returns: the squared standard deviation of the sum of @buf1 and @buf2
+ */
+gint
+fpi_sum_std_sq_dev (const guint8 *buf1,
+                    const guint8 *buf2,
+                    gint          size,
+                    gint          stride)
+{
+  guint32 sum = 0, sum_sq = 0, mean;
+  int i = 0;
+
+  g_return_val_if_fail (size > 0, 0);
+
+  /* Both sums are computed in one pass, which gives the same result as
+   * subtracting the (rounded) mean from every value:
+   *   sum ((s - mean) ^ 2) = sum (s ^ 2) - 2 * mean * sum (s) + size * mean ^ 2
+   * Intermediate results may wrap around, but the final one fits.
+   */
+#if defined(__SSE2__)
+  {
+    __m128i zero = _mm_setzero_si128 ();
+    __m128i ones = _mm_set1_epi16 (1);
+    __m128i low_bytes = _mm_set1_epi16 (0x00ff);
+    __m128i acc = _mm_setzero_si128 ();
+    __m128i acc_sq = _mm_setzero_si128 ();
+
+    if (stride == 1)
+      {
+        for (; i + 16 <= size; i += 16)
+          {
+            __m128i a = _mm_loadu_si128 ((const __m128i *) (buf1 + i));
+            __m128i b = _mm_loadu_si128 ((const __m128i *) (buf2 + i));
+            __m128i lo = _mm_add_epi16 (_mm_unpacklo_epi8 (a, zero),
+                                        _mm_unpacklo_epi8 (b, zero));
+            __m128i hi = _mm_add_epi16 (_mm_unpackhi_epi8 (a, zero),
+                                        _mm_unpackhi_epi8 (b, zero));
+
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (_mm_add_epi16 (lo, hi), ones));
+            acc_sq = _mm_add_epi32 (acc_sq, _mm_madd_epi16 (lo, lo));
+            acc_sq = _mm_add_epi32 (acc_sq, _mm_madd_epi16 (hi, hi));
+          }
+      }
+    else if (stride == 2)
+      {
+        /* Every load covers 8 used pixels. The last byte is never used,
+         * don't read past the last used pixel. */
+        for (; i + 8 < size; i += 8)
+          {
+            __m128i a = _mm_loadu_si128 ((const __m128i *) (buf1 + 2 * i));
+            __m128i b = _mm_loadu_si128 ((const __m128i *) (buf2 + 2 * i));
+            __m128i s = _mm_add_epi16 (_mm_and_si128 (a, low_bytes),
+                                       _mm_and_si128 (b, low_bytes));
+
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (s, ones));
+            acc_sq = _mm_add_epi32 (acc_sq, _mm_madd_epi16 (s, s));
+          }
+      }
+    acc = _mm_add_epi32 (acc, _mm_srli_si128 (acc, 8));
+    acc = _mm_add_epi32 (acc, _mm_srli_si128 (acc, 4));
+    acc_sq = _mm_add_epi32 (acc_sq, _mm_srli_si128 (acc_sq, 8));
+    acc_sq = _mm_add_epi32 (acc_sq, _mm_srli_si128 (acc_sq, 4));
+    sum = _mm_cvtsi128_si32 (acc);
+    sum_sq = _mm_cvtsi128_si32 (acc_sq);
+  }
+#elif defined(__ARM_NEON)
+  {
+    uint32x4_t acc = vdupq_n_u32 (0);
+    uint32x4_t acc_sq = vdupq_n_u32 (0);
+    uint16x8_t sums[2];
+
+#define ACCUMULATE_SUMS(s) \
+  acc = vpadalq_u16 (acc, s); \
+  acc_sq = vmlal_u16 (acc_sq, vget_low_u16 (s), vget_low_u16 (s)); \
+  acc_sq = vmlal_u16 (acc_sq, vget_high_u16 (s), vget_high_u16 (s));
+
+    if (stride == 1)
+      {
+        for (; i + 16 <= size; i += 16)
+          {
+            uint8x16_t a = vld1q_u8 (buf1 + i);
+            uint8x16_t b = vld1q_u8 (buf2 + i);
+
+            sums[0] = vaddl_u8 (vget_low_u8 (a), vget_low_u8 (b));
+            sums[1] = vaddl_u8 (vget_high_u8 (a), vget_high_u8 (b));
+            ACCUMULATE_SUMS (sums[0]);
+            ACCUMULATE_SUMS (sums[1]);
+          }
+      }
+    else if (stride == 2)
+      {
+        /* Every load covers 16 used pixels. The last byte is never used,
+         * don't read past the last used pixel. */
+        for (; i + 16 < size; i += 16)
+          {
+            uint8x16x2_t a = vld2q_u8 (buf1 + 2 * i);
+            uint8x16x2_t b = vld2q_u8 (buf2 + 2 * i);
+
+            sums[0] = vaddl_u8 (vget_low_u8 (a.val[0]), vget_low_u8 (b.val[0]));
+            sums[1] = vaddl_u8 (vget_high_u8 (a.val[0]), vget_high_u8 (b.val[0]));
+            ACCUMULATE_SUMS (sums[0]);
+            ACCUMULATE_SUMS (sums[1]);
+          }
+      }
+#undef ACCUMULATE_SUMS
+
+    sum = vgetq_lane_u32 (acc, 0) + vgetq_lane_u32 (acc, 1) +
+          vgetq_lane_u32 (acc, 2) + vgetq_lane_u32 (acc, 3);
+    sum_sq = vgetq_lane_u32 (acc_sq, 0) + vgetq_lane_u32 (acc_sq, 1) +
+             vgetq_lane_u32 (acc_sq, 2) + vgetq_lane_u32 (acc_sq, 3);
+  }
+#endif
+
+  for (; i < size; i++)
+    {
+      int s = (int) buf1[i * stride] + (int) buf2[i * stride];
+
+      sum += s;
+      sum_sq += s * s;
+    }
+
+  mean = sum / size;
+
+  return (gint) (sum_sq - 2 * mean * sum + size * mean * mean) / size;
 }
 
 #if HAVE_PIXMAN
@@ -67,6 +67,7 @@ struct _FpImage
   guint8    *binarized;
 
   GPtrArray *minutiae;
+  GVariant  *minutiae_timings;
   guint      ref_count;
 };
 
@@ -75,6 +76,13 @@ gint fpi_std_sq_dev (const guint8 *buf,
 gint fpi_mean_sq_diff_norm (const guint8 *buf1,
                             const guint8 *buf2,
                             gint          size);
+gint fpi_sum_sq_diff (const guint8 *buf1,
+                      const guint8 *buf2,
+                      gint          size);
+gint fpi_sum_std_sq_dev (const guint8 *buf1,
+                         const guint8 *buf2,
+                         gint          size,
+                         gint          stride);
 
 #if HAVE_PIXMAN
 FpImage *fpi_image_resize (FpImage *orig,
@@ -231,6 +231,15 @@ fpi_print_bz3_match (FpPrint *template, FpPrint *print, gint bz3_threshold, GErr
     }
 
   pstruct = g_ptr_array_index (print->prints, 0);
+
+  /* Bozorth scores prints with this few minutiae as zero, which never
+   * reaches a threshold. Skip building their webs. */
+  if (pstruct->nrows < MIN_COMPUTABLE_BOZORTH_MINUTIAE)
+    {
+      fp_dbg ("Probe has only %d minutiae, rejecting", pstruct->nrows);
+      return FPI_MATCH_FAIL;
+    }
+
   probe_len = bozorth_probe_init (pstruct);
 
   for (i = 0; i < template->prints->len; i++)
@@ -238,6 +247,9 @@ fpi_print_bz3_match (FpPrint *template, FpPrint *print, gint bz3_threshold, GErr
       struct xyt_struct *gstruct;
       gint score;
       gstruct = g_ptr_array_index (template->prints, i);
+      if (gstruct->nrows < MIN_COMPUTABLE_BOZORTH_MINUTIAE)
+        continue;
+
       score = bozorth_to_gallery (probe_len, pstruct, gstruct);
       fp_dbg ("score %d", score);
 
@@ -212,6 +212,7 @@ on_delayed_action_cancelled (GCancellable *cancellable,
                              FpiSsm       *machine)
 {
   CancelledActionIdleData *data;
+  GSource *idle_source;
 
   fp_dbg ("[%s] %s cancelled delayed state change",
           fp_device_get_driver (machine->dev), machine->name);
@@ -223,8 +224,11 @@ on_delayed_action_cancelled (GCancellable *cancellable,
   data->cancellable_id = machine->cancellable_id;
   machine->cancellable_id = 0;
 
-  g_idle_add_full (G_PRIORITY_HIGH_IDLE, on_delayed_action_cancelled_idle,
-                   data, NULL);
+  idle_source = g_idle_source_new ();
+  g_source_set_priority (idle_source, G_PRIORITY_HIGH_IDLE);
+  g_source_set_callback (idle_source, on_delayed_action_cancelled_idle, data, NULL);
+  g_source_attach (idle_source, fpi_device_get_main_context (machine->dev));
+  g_source_unref (idle_source);
 }
 
 static void
@@ -18,6 +18,11 @@
  */
 
 #include "fpi-usb-transfer.h"
+#include "fp-device-private.h"
+
+/* Limits for recycling transfers, see fpi_usb_transfer_new() */
+#define TRANSFER_POOL_SIZE 8
+#define TRANSFER_POOL_MAX_BUFFER_SIZE 4096
 
 /**
  * SECTION:fpi-usb-transfer
@@ -30,6 +35,13 @@
  *
  * Drivers should use this API only rather than accessing the GUsbDevice
  * directly in most cases.
+ *
+ * Transfers are recycled per device. Once the last reference to a
+ * transfer is dropped, it is kept for reuse by fpi_usb_transfer_new()
+ * together with the buffer allocated by fpi_usb_transfer_fill_bulk(),
+ * fpi_usb_transfer_fill_interrupt() or fpi_usb_transfer_fill_control().
+ * Drivers polling registers therefore do not allocate memory for every
+ * transfer.
  */
 
 
@@ -88,11 +100,79 @@ log_transfer (FpiUsbTransfer *transfer, gboolean submit, GError *error)
     }
 }
 
+/* Private, records the submission of @transfer if statistics are
+ * collected for its device. */
+void
+fpi_usb_transfer_record_submitted (FpiUsbTransfer *transfer)
+{
+  FpiUsbStatistics *stats;
+
+  stats = fpi_device_get_usb_statistics (transfer->device,
+                                         transfer->type,
+                                         transfer->endpoint);
+  if (G_LIKELY (!stats))
+    {
+      transfer->submit_time = 0;
+      return;
+    }
+
+  stats->submitted++;
+  transfer->submit_time = g_get_monotonic_time ();
+}
+
+/* Private, records the completion of @transfer with @error, which may be
+ * %NULL. Only transfers recorded as submitted are counted. */
+void
+fpi_usb_transfer_record_completed (FpiUsbTransfer *transfer,
+                                   GError         *error)
+{
+  FpiUsbStatistics *stats;
+  guint64 latency;
+  guint bucket;
+
+  if (G_LIKELY (!transfer->submit_time))
+    return;
+
+  stats = fpi_device_get_usb_statistics (transfer->device,
+                                         transfer->type,
+                                         transfer->endpoint);
+  if (!stats)
+    return;
+
+  latency = MAX (g_get_monotonic_time () - transfer->submit_time, 0);
+  transfer->submit_time = 0;
+
+  if (!error)
+    stats->completed++;
+  else if (g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT))
+    stats->timeouts++;
+  else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+           g_error_matches (error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_CANCELLED))
+    stats->cancelled++;
+  else
+    stats->errors++;
+
+  if (transfer->actual_length > 0)
+    stats->bytes += transfer->actual_length;
+  if (transfer->actual_length >= 0 && transfer->actual_length < transfer->length)
+    stats->short_transfers++;
+
+  bucket = MAX (g_bit_storage (latency), FPI_USB_STATISTICS_LATENCY_MIN_BITS) -
+           FPI_USB_STATISTICS_LATENCY_MIN_BITS;
+  bucket = MIN (bucket, FPI_USB_STATISTICS_LATENCY_BUCKETS - 1);
+
+  stats->latency_histogram[bucket]++;
+  stats->latency_total_us += latency;
+  stats->latency_max_us = MAX (stats->latency_max_us, latency);
+}
+
 /**
  * fpi_usb_transfer_new:
  * @device: The #FpDevice the transfer is for
  *
- * Creates a new #FpiUsbTransfer.
+ * Creates a new #FpiUsbTransfer. A previously freed transfer of @device
+ * is reused if one is available. The transfer holds a reference on
+ * @device until it is freed.
  *
  * Returns: (transfer full): A newly created #FpiUsbTransfer
  */
@@ -100,28 +180,99 @@ FpiUsbTransfer *
 fpi_usb_transfer_new (FpDevice * device)
 {
   FpiUsbTransfer *self;
+  GQueue *pool;
 
   g_assert (device != NULL);
 
+  pool = fpi_device_get_usb_transfer_pool (device);
+  if (pool && !g_queue_is_empty (pool))
+    {
+      self = g_queue_pop_head (pool);
+      g_assert_cmpint (self->ref_count, ==, 1);
+      g_object_ref (self->device);
+      return self;
+    }
+
   self = g_slice_new0 (FpiUsbTransfer);
   self->ref_count = 1;
 
-  self->device = device;
+  self->device = g_object_ref (device);
 
   return self;
 }
 
+/* Returns a zeroed buffer of @length bytes that stays owned by @transfer
+ * and is kept when the transfer is recycled. */
+static guint8 *
+fpi_usb_transfer_get_buffer (FpiUsbTransfer *transfer,
+                             gsize           length)
+{
+  if (transfer->pool_buffer_size < length)
+    {
+      g_free (transfer->pool_buffer);
+      transfer->pool_buffer = g_malloc0 (length);
+      transfer->pool_buffer_size = length;
+    }
+  else
+    {
+      memset (transfer->pool_buffer, 0, length);
+    }
+
+  return transfer->pool_buffer;
+}
+
 static void
 fpi_usb_transfer_free (FpiUsbTransfer *self)
 {
+  FpDevice *device;
+  GQueue *pool;
+
   g_assert (self);
   g_assert_cmpint (self->ref_count, ==, 0);
 
-  if (self->free_buffer && self->buffer)
+  if (self->free_buffer && self->buffer && self->buffer != self->pool_buffer)
     self->free_buffer (self->buffer);
   self->buffer = NULL;
 
-  g_slice_free (FpiUsbTransfer, self);
+  device = self->device;
+  pool = fpi_device_get_usb_transfer_pool (device);
+
+  /* The pool is only unset while the device is finalized and frees the
+   * pooled transfers, which do not hold a reference on the device. */
+  if (!pool)
+    {
+      g_free (self->pool_buffer);
+      g_slice_free (FpiUsbTransfer, self);
+      return;
+    }
+
+  if (pool->length < TRANSFER_POOL_SIZE)
+    {
+      guint8 *pool_buffer = self->pool_buffer;
+      gsize pool_buffer_size = self->pool_buffer_size;
+
+      if (pool_buffer_size > TRANSFER_POOL_MAX_BUFFER_SIZE)
+        {
+          g_clear_pointer (&pool_buffer, g_free);
+          pool_buffer_size = 0;
+        }
+
+      *self = (FpiUsbTransfer) {
+        .device = device,
+        .ref_count = 1,
+        .pool_buffer = pool_buffer,
+        .pool_buffer_size = pool_buffer_size,
+      };
+      g_queue_push_head (pool, self);
+    }
+  else
+    {
+      g_free (self->pool_buffer);
+      g_slice_free (FpiUsbTransfer, self);
+    }
+
+  /* Last, as this may finalize the device */
+  g_object_unref (device);
 }
 
 /**
@@ -177,9 +328,9 @@ fpi_usb_transfer_fill_bulk (FpiUsbTransfer *transfer,
 {
   fpi_usb_transfer_fill_bulk_full (transfer,
                                    endpoint,
-                                   g_malloc0 (length),
+                                   fpi_usb_transfer_get_buffer (transfer, length),
                                    length,
-                                   g_free);
+                                   NULL);
 }
 
 /**
@@ -245,8 +396,8 @@ fpi_usb_transfer_fill_control (FpiUsbTransfer       *transfer,
   transfer->idx = idx;
 
   transfer->length = length;
-  transfer->buffer = g_malloc0 (length);
-  transfer->free_buffer = g_free;
+  transfer->buffer = fpi_usb_transfer_get_buffer (transfer, length);
+  transfer->free_buffer = NULL;
 }
 
 /**
@@ -265,9 +416,9 @@ fpi_usb_transfer_fill_interrupt (FpiUsbTransfer *transfer,
 {
   fpi_usb_transfer_fill_interrupt_full (transfer,
                                         endpoint,
-                                        g_malloc0 (length),
+                                        fpi_usb_transfer_get_buffer (transfer, length),
                                         length,
-                                        g_free);
+                                        NULL);
 }
 
 /**
@@ -298,12 +449,14 @@ fpi_usb_transfer_fill_interrupt_full (FpiUsbTransfer *transfer,
   transfer->free_buffer = free_func;
 }
 
+static void transfer_complete (FpiUsbTransfer *transfer,
+                               GError         *error);
+
 static void
 transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
   GError *error = NULL;
   FpiUsbTransfer *transfer = user_data;
-  FpiUsbTransferCallback callback;
 
   switch (transfer->type)
     {
@@ -333,7 +486,16 @@ transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_dat
       g_assert_not_reached ();
     }
 
+  transfer_complete (transfer, error);
+}
+
+static void
+transfer_complete (FpiUsbTransfer *transfer, GError *error)
+{
+  FpiUsbTransferCallback callback;
+
   log_transfer (transfer, FALSE, error);
+  fpi_usb_transfer_record_completed (transfer, error);
 
   /* Check for short error, and set an error if requested */
   if (error == NULL &&
@@ -354,6 +516,33 @@ transfer_finish_cb (GObject *source_object, GAsyncResult *res, gpointer user_dat
 }
 
 
+/* Private, for the unit tests only. Once set, transfers submitted with
+ * fpi_usb_transfer_submit() are handed to @func instead of GUsb. They
+ * complete once the test calls fpi_usb_transfer_fake_complete(). */
+static FpiUsbTransferFakeSubmit fake_submit = NULL;
+static gpointer fake_submit_data = NULL;
+
+void
+fpi_usb_transfer_set_fake_submit (FpiUsbTransferFakeSubmit func,
+                                  gpointer                 user_data)
+{
+  fake_submit = func;
+  fake_submit_data = user_data;
+}
+
+/* Private, completes a transfer passed to the fake submit function like
+ * GUsb would, with @actual_length bytes of data or @error. */
+void
+fpi_usb_transfer_fake_complete (FpiUsbTransfer *transfer,
+                                gssize          actual_length,
+                                GError         *error)
+{
+  g_return_if_fail (transfer->callback != NULL);
+
+  transfer->actual_length = error ? -1 : actual_length;
+  transfer_complete (transfer, error);
+}
+
 /**
  * fpi_usb_transfer_submit:
  * @transfer: (transfer full): The transfer to submit, must have been filled.
@@ -375,6 +564,8 @@ fpi_usb_transfer_submit (FpiUsbTransfer        *transfer,
                          FpiUsbTransferCallback callback,
                          gpointer               user_data)
 {
+  GMainContext *context;
+
   g_return_if_fail (transfer);
   g_return_if_fail (callback);
 
@@ -385,6 +576,17 @@ fpi_usb_transfer_submit (FpiUsbTransfer        *transfer,
   transfer->user_data = user_data;
 
   log_transfer (transfer, TRUE, NULL);
+  fpi_usb_transfer_record_submitted (transfer);
+
+  if (G_UNLIKELY (fake_submit))
+    {
+      fake_submit (transfer, cancellable, fake_submit_data);
+      return;
+    }
+
+  /* GUsb completes the transfer in the thread-default context. */
+  context = fpi_device_get_main_context (transfer->device);
+  g_main_context_push_thread_default (context);
 
   switch (transfer->type)
     {
@@ -428,9 +630,12 @@ fpi_usb_transfer_submit (FpiUsbTransfer        *transfer,
 
     case FP_TRANSFER_NONE:
     default:
+      g_main_context_pop_thread_default (context);
       fpi_usb_transfer_unref (transfer);
       g_return_if_reached ();
     }
+
+  g_main_context_pop_thread_default (context);
 }
 
 /**
@@ -453,6 +658,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                               guint           timeout_ms,
                               GError        **error)
 {
+  g_autoptr(GError) local_error = NULL;
   gboolean res;
   gsize actual_length;
 
@@ -462,6 +668,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
   g_return_val_if_fail (transfer->callback == NULL, FALSE);
 
   log_transfer (transfer, TRUE, NULL);
+  fpi_usb_transfer_record_submitted (transfer);
 
   switch (transfer->type)
     {
@@ -473,7 +680,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                                         &actual_length,
                                         timeout_ms,
                                         NULL,
-                                        error);
+                                        &local_error);
       break;
 
     case FP_TRANSFER_CONTROL:
@@ -489,7 +696,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                                            &actual_length,
                                            timeout_ms,
                                            NULL,
-                                           error);
+                                           &local_error);
       break;
 
     case FP_TRANSFER_INTERRUPT:
@@ -500,7 +707,7 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                                              &actual_length,
                                              timeout_ms,
                                              NULL,
-                                             error);
+                                             &local_error);
       break;
 
     case FP_TRANSFER_NONE:
@@ -508,12 +715,340 @@ fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
       g_return_val_if_reached (FALSE);
     }
 
-  log_transfer (transfer, FALSE, *error);
+  /* Failures are counted as errors even if GUsb did not say why */
+  if (!res && !local_error)
+    local_error = g_error_new_literal (G_USB_DEVICE_ERROR,
+                                       G_USB_DEVICE_ERROR_IO,
+                                       "USB transfer failed");
+
+  log_transfer (transfer, FALSE, local_error);
 
   if (!res)
     transfer->actual_length = -1;
   else
     transfer->actual_length = actual_length;
 
+  fpi_usb_transfer_record_completed (transfer, local_error);
+
+  if (!res)
+    g_propagate_error (error, g_steal_pointer (&local_error));
+
   return res;
 }
+
+/**
+ * SECTION:fpi-usb-stream
+ * @title: USB streaming helper
+ * @short_description: Keep several transfers queued on an endpoint
+ *
+ * #FpiUsbStream continuously reads from an endpoint by keeping a number
+ * of #FpiUsbTransfer queued at all times. The device can then send more
+ * data while the driver is still processing a previous transfer, instead
+ * of having to wait for the next transfer to be submitted.
+ *
+ * Every transfer owns a buffer that is reused for the whole lifetime of
+ * the stream. Completed transfers are passed to the data callback in the
+ * order in which they were submitted, and are resubmitted right after
+ * the callback returns.
+ *
+ * Streaming ends when the driver calls fpi_usb_stream_stop(), when a
+ * transfer fails, or when the #GCancellable passed to
+ * fpi_usb_stream_start() is cancelled. The remaining transfers are then
+ * cancelled, and the done callback runs once all of them have returned.
+ */
+
+typedef struct
+{
+  FpiUsbTransfer *transfer;
+  gboolean        completed;
+  GError         *error;
+} FpiUsbStreamSlot;
+
+struct _FpiUsbStream
+{
+  FpDevice                *device;
+  FpiUsbStreamSlot        *slots;
+  guint                    n_slots;
+  guint                    next_slot;
+  guint                    in_flight;
+
+  guint                    timeout_ms;
+  GCancellable            *cancellable;
+  GCancellable            *parent_cancellable;
+  gulong                   cancel_id;
+
+  gboolean                 continue_on_timeout;
+  gboolean                 running;
+  gboolean                 stopping;
+  GError                  *error;
+
+  FpiUsbStreamDataCallback data_cb;
+  FpiUsbStreamDoneCallback done_cb;
+  gpointer                 user_data;
+};
+
+/**
+ * fpi_usb_stream_new:
+ * @device: The #FpDevice the stream is for
+ * @endpoint: The IN endpoint to read from
+ * @length: The length of every transfer in bytes
+ * @n_transfers: The number of transfers to keep in flight
+ *
+ * Creates a new #FpiUsbStream doing bulk transfers on @endpoint. The
+ * buffers of all transfers are allocated here and reused until the
+ * stream is freed.
+ *
+ * Returns: (transfer full): A newly created #FpiUsbStream
+ */
+FpiUsbStream *
+fpi_usb_stream_new (FpDevice *device,
+                    guint8    endpoint,
+                    gsize     length,
+                    guint     n_transfers)
+{
+  FpiUsbStream *self;
+  guint i;
+
+  g_assert (device != NULL);
+  g_assert (endpoint & FPI_USB_ENDPOINT_IN);
+  g_assert (n_transfers > 0);
+
+  self = g_new0 (FpiUsbStream, 1);
+  self->device = device;
+  self->n_slots = n_transfers;
+  self->slots = g_new0 (FpiUsbStreamSlot, n_transfers);
+
+  for (i = 0; i < n_transfers; i++)
+    {
+      self->slots[i].transfer = fpi_usb_transfer_new (device);
+      fpi_usb_transfer_fill_bulk (self->slots[i].transfer, endpoint, length);
+    }
+
+  return self;
+}
+
+/**
+ * fpi_usb_stream_free:
+ * @self: A #FpiUsbStream
+ *
+ * Frees the stream and all its transfers. The stream must not be running,
+ * but it may be freed from its done callback.
+ */
+void
+fpi_usb_stream_free (FpiUsbStream *self)
+{
+  guint i;
+
+  if (!self)
+    return;
+
+  g_return_if_fail (!self->running);
+
+  /* The transfer that completed last may still be referenced by its
+   * completion handler, it is freed once that returns. */
+  for (i = 0; i < self->n_slots; i++)
+    fpi_usb_transfer_unref (self->slots[i].transfer);
+
+  g_free (self->slots);
+  g_free (self);
+}
+
+/**
+ * fpi_usb_stream_set_continue_on_timeout:
+ * @self: A #FpiUsbStream
+ * @continue_on_timeout: Whether timeouts end the stream
+ *
+ * By default, a transfer that times out ends the stream like any other
+ * failed transfer. If @continue_on_timeout is set, timed out transfers
+ * are passed to the data callback instead, with an @actual_length of -1,
+ * and are resubmitted. This suits devices that only send data while a
+ * finger is present.
+ */
+void
+fpi_usb_stream_set_continue_on_timeout (FpiUsbStream *self,
+                                        gboolean      continue_on_timeout)
+{
+  g_return_if_fail (self);
+
+  self->continue_on_timeout = continue_on_timeout;
+}
+
+/**
+ * fpi_usb_stream_is_running:
+ * @self: A #FpiUsbStream
+ *
+ * Returns: %TRUE if the stream was started and its done callback did not
+ *   run yet
+ */
+gboolean
+fpi_usb_stream_is_running (FpiUsbStream *self)
+{
+  return self->running;
+}
+
+static void usb_stream_transfer_cb (FpiUsbTransfer *transfer,
+                                    FpDevice       *device,
+                                    gpointer        user_data,
+                                    GError         *error);
+
+static void
+usb_stream_submit (FpiUsbStream *self, FpiUsbStreamSlot *slot)
+{
+  self->in_flight++;
+  fpi_usb_transfer_submit (fpi_usb_transfer_ref (slot->transfer),
+                           self->timeout_ms,
+                           self->cancellable,
+                           usb_stream_transfer_cb,
+                           self);
+}
+
+static void
+usb_stream_cancel_cb (GCancellable *cancellable, gpointer user_data)
+{
+  g_cancellable_cancel (G_CANCELLABLE (user_data));
+}
+
+static void
+usb_stream_done (FpiUsbStream *self)
+{
+  GError *error = g_steal_pointer (&self->error);
+
+  if (self->parent_cancellable)
+    g_cancellable_disconnect (self->parent_cancellable, self->cancel_id);
+  self->cancel_id = 0;
+  g_clear_object (&self->parent_cancellable);
+  g_clear_object (&self->cancellable);
+
+  self->running = FALSE;
+
+  /* Must be last, the stream may be freed by the callback. */
+  self->done_cb (self, self->device, self->user_data, error);
+}
+
+static void
+usb_stream_transfer_cb (FpiUsbTransfer *transfer, FpDevice *device,
+                        gpointer user_data, GError *error)
+{
+  FpiUsbStream *self = user_data;
+  FpiUsbStreamSlot *slot;
+  guint i;
+
+  self->in_flight--;
+
+  for (i = 0; i < self->n_slots; i++)
+    if (self->slots[i].transfer == transfer)
+      break;
+  g_assert (i < self->n_slots);
+
+  self->slots[i].completed = TRUE;
+  self->slots[i].error = error;
+
+  /* Transfers on one endpoint normally complete in order, but only hand
+   * them to the driver in submission order regardless. */
+  slot = &self->slots[self->next_slot];
+  while (slot->completed)
+    {
+      slot->completed = FALSE;
+      self->next_slot = (self->next_slot + 1) % self->n_slots;
+
+      if (self->stopping)
+        {
+          g_clear_error (&slot->error);
+        }
+      else if (slot->error &&
+               !(self->continue_on_timeout &&
+                 g_error_matches (slot->error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT)))
+        {
+          self->error = g_steal_pointer (&slot->error);
+          fpi_usb_stream_stop (self);
+        }
+      else
+        {
+          g_clear_error (&slot->error);
+          self->data_cb (self, slot->transfer, self->device, self->user_data);
+
+          if (!self->stopping)
+            usb_stream_submit (self, slot);
+        }
+
+      slot = &self->slots[self->next_slot];
+    }
+
+  if (self->in_flight == 0)
+    usb_stream_done (self);
+}
+
+/**
+ * fpi_usb_stream_start:
+ * @self: A #FpiUsbStream
+ * @timeout_ms: Timeout for every transfer in ms
+ * @cancellable: (nullable): Cancellable to use, e.g. fpi_device_get_cancellable()
+ * @data_cb: Callback for every successfully completed transfer
+ * @done_cb: Callback once streaming has ended
+ * @user_data: Data to pass to the callbacks
+ *
+ * Submits all transfers of the stream. The transfer passed to @data_cb
+ * must not be kept around or resubmitted by the driver, its buffer is
+ * reused once the callback returns.
+ *
+ * @done_cb receives the error of the transfer that failed first, or a
+ * %NULL error if streaming was ended using fpi_usb_stream_stop(). The
+ * stream can be started again from @done_cb or afterwards.
+ */
+void
+fpi_usb_stream_start (FpiUsbStream            *self,
+                      guint                    timeout_ms,
+                      GCancellable            *cancellable,
+                      FpiUsbStreamDataCallback data_cb,
+                      FpiUsbStreamDoneCallback done_cb,
+                      gpointer                 user_data)
+{
+  guint i;
+
+  g_return_if_fail (self);
+  g_return_if_fail (data_cb && done_cb);
+  g_return_if_fail (!self->running);
+
+  self->timeout_ms = timeout_ms;
+  self->data_cb = data_cb;
+  self->done_cb = done_cb;
+  self->user_data = user_data;
+  self->running = TRUE;
+  self->stopping = FALSE;
+  self->next_slot = 0;
+
+  self->cancellable = g_cancellable_new ();
+  if (cancellable)
+    {
+      self->parent_cancellable = g_object_ref (cancellable);
+      self->cancel_id = g_cancellable_connect (cancellable,
+                                               G_CALLBACK (usb_stream_cancel_cb),
+                                               self->cancellable, NULL);
+    }
+
+  for (i = 0; i < self->n_slots; i++)
+    usb_stream_submit (self, &self->slots[i]);
+}
+
+/**
+ * fpi_usb_stream_stop:
+ * @self: A #FpiUsbStream
+ *
+ * Stops resubmitting transfers and cancels those that are still in
+ * flight. Data that arrives from now on is dropped. The done callback
+ * runs once all transfers have returned.
+ *
+ * This is usually called from the data callback once the driver has
+ * received all the data it needs.
+ */
+void
+fpi_usb_stream_stop (FpiUsbStream *self)
+{
+  g_return_if_fail (self);
+
+  if (!self->running || self->stopping)
+    return;
+
+  self->stopping = TRUE;
+  g_cancellable_cancel (self->cancellable);
+}
@@ -101,6 +101,13 @@ struct _FpiUsbTransfer
 
   /* Data free function */
   GDestroyNotify free_buffer;
+
+  /* Buffer kept when the transfer is recycled */
+  guint8 *pool_buffer;
+  gsize   pool_buffer_size;
+
+  /* Submission time if statistics are collected, otherwise 0 */
+  gint64 submit_time;
 };
 
 GType              fpi_usb_transfer_get_type (void) G_GNUC_CONST;
@@ -150,7 +157,57 @@ gboolean           fpi_usb_transfer_submit_sync (FpiUsbTransfer *transfer,
                                                  guint           timeout_ms,
                                                  GError        **error);
 
+typedef struct _FpiUsbStream FpiUsbStream;
+
+/**
+ * FpiUsbStreamDataCallback:
+ * @stream: The #FpiUsbStream
+ * @transfer: The completed transfer
+ * @dev: The #FpDevice the stream belongs to
+ * @user_data: User data passed to fpi_usb_stream_start()
+ *
+ * Called for every successfully completed transfer of a stream, in the
+ * order the transfers were submitted. See also
+ * fpi_usb_stream_set_continue_on_timeout().
+ */
+typedef void (*FpiUsbStreamDataCallback)(FpiUsbStream   *stream,
+                                         FpiUsbTransfer *transfer,
+                                         FpDevice       *dev,
+                                         gpointer        user_data);
+
+/**
+ * FpiUsbStreamDoneCallback:
+ * @stream: The #FpiUsbStream
+ * @dev: The #FpDevice the stream belongs to
+ * @user_data: User data passed to fpi_usb_stream_start()
+ * @error: The error of the first failed transfer, or %NULL if the stream
+ *   was stopped using fpi_usb_stream_stop()
+ *
+ * Called once streaming has ended and no transfer is in flight anymore.
+ */
+typedef void (*FpiUsbStreamDoneCallback)(FpiUsbStream *stream,
+                                         FpDevice     *dev,
+                                         gpointer      user_data,
+                                         GError       *error);
+
+FpiUsbStream       *fpi_usb_stream_new (FpDevice *device,
+                                        guint8    endpoint,
+                                        gsize     length,
+                                        guint     n_transfers);
+void               fpi_usb_stream_free (FpiUsbStream *self);
+void               fpi_usb_stream_set_continue_on_timeout (FpiUsbStream *self,
+                                                           gboolean      continue_on_timeout);
+
+void               fpi_usb_stream_start (FpiUsbStream            *self,
+                                         guint                    timeout_ms,
+                                         GCancellable            *cancellable,
+                                         FpiUsbStreamDataCallback data_cb,
+                                         FpiUsbStreamDoneCallback done_cb,
+                                         gpointer                 user_data);
+void               fpi_usb_stream_stop (FpiUsbStream *self);
+gboolean           fpi_usb_stream_is_running (FpiUsbStream *self);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiUsbTransfer, fpi_usb_transfer_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiUsbStream, fpi_usb_stream_free)
 
 G_END_DECLS
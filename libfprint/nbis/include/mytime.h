@@ -48,59 +48,56 @@ of the software.
 /* this file needed to support timer and ticks */
 /* UPDATED: 03/16/2005 by MDG */
 
-#ifdef TIMER
-#include <sys/types.h>
-#endif
-
-#ifdef __MSYS__
-#include <sys/time.h>
-#else
-#include <sys/times.h>
-#endif
+/* libfprint: The timers are always enabled. Instead of being stored in
+ * global variables, the phases are recorded in a thread-local structure
+ * so that concurrent minutiae detections do not interfere. The caller
+ * resets nbis_timers before lfs_detect_minutiae_V2() and reads it back
+ * afterwards. Times are in microseconds of g_get_monotonic_time(). */
+#include <glib.h>
+
+typedef struct {
+   gint64 start;
+   gint64 duration;
+} NBIS_TIMER;
+
+typedef struct {
+   NBIS_TIMER total;
+   NBIS_TIMER imap;
+   NBIS_TIMER bin;
+   NBIS_TIMER minutia;
+   NBIS_TIMER rm_minutia;
+   NBIS_TIMER ridge_count;
+} NBIS_TIMERS;
+
+extern __thread NBIS_TIMERS nbis_timers;
 
-#ifdef TIMER
 #define set_timer(_timer_); \
    {  \
-      _timer_ = ticks();
-#else
-#define set_timer(_timer_);
-#endif
+      _timer_.start = g_get_monotonic_time();
 
-#ifdef TIMER
 #define time_accum(_timer_, _var_); \
-      _var_ += (ticks() - _timer_)/(float)ticksPerSec(); \
+      _var_.duration += g_get_monotonic_time() - _timer_.start; \
    }
-#else
-#define time_accum(_timer_, _var_);
-#endif
 
-#ifdef TIMER
-#define print_time(_fp_, _fmt_, _var_); \
-    fprintf(_fp_, _fmt_, _var_);
-#else
 #define print_time(_fp_, _fmt_, _var_);
-#endif
-
-extern clock_t ticks(void);
-extern int ticksPerSec(void);
 
-extern clock_t total_timer;
-extern float total_time;
+#define total_timer nbis_timers.total
+#define total_time nbis_timers.total
 
-extern clock_t imap_timer;
-extern float imap_time;
+#define imap_timer nbis_timers.imap
+#define imap_time nbis_timers.imap
 
-extern clock_t bin_timer;
-extern float bin_time;
+#define bin_timer nbis_timers.bin
+#define bin_time nbis_timers.bin
 
-extern clock_t minutia_timer;
-extern float minutia_time;
+#define minutia_timer nbis_timers.minutia
+#define minutia_time nbis_timers.minutia
 
-extern clock_t rm_minutia_timer;
-extern float rm_minutia_time;
+#define rm_minutia_timer nbis_timers.rm_minutia
+#define rm_minutia_time nbis_timers.rm_minutia
 
-extern clock_t ridge_count_timer;
-extern float ridge_count_time;
+#define ridge_count_timer nbis_timers.ridge_count
+#define ridge_count_time nbis_timers.ridge_count
 
 #endif
 
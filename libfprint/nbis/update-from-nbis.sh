@@ -104,6 +104,7 @@ sed -i "/stack\[BZ_STACKSIZE\]/d" bozorth3/bz_sort.c
 
 # Remove unused functions
 patch -p0 < lfs.h.patch
+patch -p0 < mytime.h.patch
 remove_function binarize mindtct/binar.c
 remove_function binarize_image mindtct/binar.c
 remove_function isobinarize mindtct/binar.c
@@ -0,0 +1,451 @@
+/*
+ * Benchmark of the libfprint imaging pipeline
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Replays the captures stored in the tests directory (and any further PNG
+ * files given on the command line) through the stages that image devices
+ * run for every scan:
+ *
+ *  - "assemble": movement estimation and assembly of a stripe set that is
+ *    cut out of the vfs5011 capture
+ *  - "assemble-lines": fpi_assemble_lines() on lines in the vfs5011 format
+ *    that are sampled from the same capture
+ *  - "minutiae": fp_image_detect_minutiae()
+ *  - "extract": fpi_print_add_from_image()
+ *  - "match": fpi_print_bz3_match() of every print against every other one
+ *
+ * The results are written as JSON, see benchmark-utils.c.
+ */
+
+#include <string.h>
+#include <cairo.h>
+
+#include "fpi-assembling.h"
+#include "fpi-image.h"
+#include "fpi-print.h"
+#include "benchmark-utils.h"
+#include "test-config.h"
+
+#define DEFAULT_ITERATIONS 20
+#define FRAME_HEIGHT 20
+
+/* Lines as sent by the vfs5011, see the driver: the image line follows a
+ * header, and is followed by a narrower line of a second scanner that
+ * trails the first one by a few rows. */
+#define LINE_SIZE 240
+#define LINE_PIXEL_OFFSET 8
+#define LINE_SECOND_OFFSET 168
+#define LINE_SECOND_WIDTH 64
+#define LINE_SECOND_X 48
+#define LINE_SCANNER_DISTANCE 10
+#define BZ3_THRESHOLD 40
+
+static const gchar *default_captures[] = {
+  "elan",
+  "vfs5011",
+};
+
+static FpImage *
+load_capture (const gchar *path)
+{
+  cairo_surface_t *img;
+  FpImage *image;
+  guchar *data;
+  gint width, height, stride;
+
+  img = cairo_image_surface_create_from_png (path);
+  if (cairo_surface_status (img) != CAIRO_STATUS_SUCCESS)
+    g_error ("Could not load %s: %s", path,
+             cairo_status_to_string (cairo_surface_status (img)));
+
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  /* The captures are stored as grey RGB24, use the green channel */
+  image = fp_image_new (width, height);
+  for (gint y = 0; y < height; y++)
+    for (gint x = 0; x < width; x++)
+      image->data[x + y * width] = data[x * 4 + y * stride + 1];
+
+  cairo_surface_destroy (img);
+
+  return image;
+}
+
+static unsigned char
+linear_get_pixel (struct fpi_frame_asmbl_ctx *ctx,
+                  struct fpi_frame           *frame,
+                  unsigned int                x,
+                  unsigned int                y)
+{
+  return frame->data[x + y * ctx->frame_width];
+}
+
+/* Cuts a stripe set with irregular movement out of @image */
+static GSList *
+create_stripes (FpImage *image, struct fpi_frame_asmbl_ctx *ctx)
+{
+  GSList *frames = NULL;
+  guint offset = 0;
+  guint i = 0;
+
+  ctx->get_pixel = linear_get_pixel;
+  ctx->frame_width = image->width;
+  ctx->frame_height = FRAME_HEIGHT;
+  ctx->image_width = image->width;
+  ctx->linear_frames = TRUE;
+
+  for (guint y = 0; y + FRAME_HEIGHT < image->height; y += offset, i++)
+    {
+      struct fpi_frame *frame;
+
+      frame = g_malloc0 (sizeof (struct fpi_frame) + image->width * FRAME_HEIGHT);
+      memcpy (frame->data, image->data + y * image->width, image->width * FRAME_HEIGHT);
+      frames = g_slist_prepend (frames, frame);
+
+      offset = 5 + i % 7;
+    }
+
+  return g_slist_reverse (frames);
+}
+
+static void
+bench_assemble (FptBenchReport *report, guint iterations)
+{
+  g_autofree gchar *path = NULL;
+  g_autoptr(FpImage) image = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  FptBenchStage *stage;
+  GSList *frames;
+  guint i;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  image = load_capture (path);
+  frames = create_stripes (image, &ctx);
+
+  stage = fpt_bench_report_begin_stage (report, "assemble");
+  fpt_bench_stage_add_metric (stage, "frames", g_slist_length (frames));
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(FpImage) assembled = NULL;
+      gint64 start = g_get_monotonic_time ();
+
+      fpi_do_movement_estimation (&ctx, frames);
+      assembled = fpi_assemble_frames (&ctx, frames);
+
+      fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  g_slist_free_full (frames, g_free);
+}
+
+static int
+line_get_deviation (struct fpi_line_asmbl_ctx *ctx, GSList *line1, GSList *line2)
+{
+  return fpi_sum_std_sq_dev ((unsigned char *) line1->data + LINE_PIXEL_OFFSET + LINE_SECOND_X,
+                             (unsigned char *) line2->data + LINE_SECOND_OFFSET,
+                             LINE_SECOND_WIDTH, 1);
+}
+
+/* Samples lines from @image while the finger moves at a varying speed of
+ * less than a row per line, so most rows are seen more than once. */
+static GSList *
+create_lines (FpImage *image, struct fpi_line_asmbl_ctx *ctx)
+{
+  GSList *lines = NULL;
+  guint pos = LINE_SCANNER_DISTANCE << 8;
+  guint i = 0;
+
+  ctx->line_width = image->width;
+  ctx->max_height = 2000;
+  ctx->resolution = 10;
+  ctx->median_filter_size = 25;
+  ctx->max_search_offset = 30;
+  ctx->linear_lines = TRUE;
+  ctx->pixel_offset = LINE_PIXEL_OFFSET;
+  ctx->get_deviation = line_get_deviation;
+
+  /* The position is tracked in 1/256 rows */
+  for (; (pos >> 8) < image->height; pos += 104 + 16 * (i / 50 % 8), i++)
+    {
+      const guchar *row = image->data + (pos >> 8) * image->width;
+      const guchar *trailing = row - LINE_SCANNER_DISTANCE * image->width;
+      guchar *line = g_malloc0 (LINE_SIZE);
+
+      memcpy (line + LINE_PIXEL_OFFSET, row, image->width);
+      memcpy (line + LINE_SECOND_OFFSET, trailing + LINE_SECOND_X, LINE_SECOND_WIDTH);
+      lines = g_slist_prepend (lines, line);
+    }
+
+  return g_slist_reverse (lines);
+}
+
+static void
+bench_assemble_lines (FptBenchReport *report, guint iterations)
+{
+  g_autofree gchar *path = NULL;
+  g_autoptr(FpImage) image = NULL;
+  struct fpi_line_asmbl_ctx ctx = { 0, };
+  FptBenchStage *stage;
+  GSList *lines;
+  guint num_lines;
+  guint i;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  image = load_capture (path);
+  lines = create_lines (image, &ctx);
+  num_lines = g_slist_length (lines);
+
+  stage = fpt_bench_report_begin_stage (report, "assemble-lines");
+  fpt_bench_stage_add_metric (stage, "lines", num_lines);
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_autoptr(FpImage) assembled = NULL;
+      gint64 start = g_get_monotonic_time ();
+
+      assembled = fpi_assemble_lines (&ctx, lines, num_lines);
+
+      fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+      if (i == 0)
+        fpt_bench_stage_add_metric (stage, "height", assembled->height);
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  g_slist_free_full (lines, g_free);
+}
+
+static void
+on_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean *done = user_data;
+
+  if (!fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, &error))
+    g_error ("Minutiae detection failed: %s", error->message);
+
+  *done = TRUE;
+}
+
+static void
+detect_minutiae (FpImage *image)
+{
+  gboolean done = FALSE;
+
+  fp_image_detect_minutiae (image, NULL, on_minutiae_detected, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+bench_minutiae (FptBenchReport *report, GPtrArray *images, guint iterations)
+{
+  FptBenchStage *stage;
+  guint i, j;
+
+  stage = fpt_bench_report_begin_stage (report, "minutiae");
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < images->len; j++)
+        {
+          gint64 start = g_get_monotonic_time ();
+
+          detect_minutiae (g_ptr_array_index (images, j));
+
+          fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  for (j = 0; j < images->len; j++)
+    {
+      FpImage *image = g_ptr_array_index (images, j);
+      g_autofree gchar *name = g_strdup_printf ("minutiae-%u", j);
+
+      fpt_bench_stage_add_metric (stage, name, fp_image_get_minutiae (image)->len);
+    }
+}
+
+static FpPrint *
+create_print (FpImage *image)
+{
+  g_autoptr(GError) error = NULL;
+  FpPrint *print;
+
+  print = g_object_new (FP_TYPE_PRINT,
+                        "driver", "benchmark",
+                        "device-id", "benchmark",
+                        NULL);
+  g_object_ref_sink (print);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+
+  if (!fpi_print_add_from_image (print, image, &error))
+    g_error ("Could not create print: %s", error->message);
+
+  return print;
+}
+
+static void
+bench_extract (FptBenchReport *report, GPtrArray *images, GPtrArray *prints,
+               guint iterations)
+{
+  FptBenchStage *stage;
+  guint i, j;
+
+  stage = fpt_bench_report_begin_stage (report, "extract");
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < images->len; j++)
+        {
+          gint64 start = g_get_monotonic_time ();
+          FpPrint *print;
+
+          print = create_print (g_ptr_array_index (images, j));
+
+          fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+          /* Keep the last set of prints for matching */
+          if (i == iterations - 1)
+            g_ptr_array_add (prints, print);
+          else
+            g_object_unref (print);
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+}
+
+static void
+bench_match (FptBenchReport *report, GPtrArray *prints, guint iterations)
+{
+  FptBenchStage *stage;
+  guint mated = 0, non_mated = 0;
+  guint i, j, k;
+
+  stage = fpt_bench_report_begin_stage (report, "match");
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < prints->len; j++)
+        {
+          for (k = 0; k < prints->len; k++)
+            {
+              g_autoptr(GError) error = NULL;
+              gint64 start = g_get_monotonic_time ();
+              FpiMatchResult result;
+
+              result = fpi_print_bz3_match (g_ptr_array_index (prints, j),
+                                            g_ptr_array_index (prints, k),
+                                            BZ3_THRESHOLD, &error);
+
+              fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+              if (result == FPI_MATCH_ERROR)
+                g_error ("Matching failed: %s", error->message);
+
+              if (i == 0 && result == FPI_MATCH_SUCCESS)
+                {
+                  if (j == k)
+                    mated++;
+                  else
+                    non_mated++;
+                }
+            }
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  fpt_bench_stage_add_metric (stage, "mated-matches", mated);
+  fpt_bench_stage_add_metric (stage, "non-mated-matches", non_mated);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FptBenchReport) report = NULL;
+  g_autoptr(GPtrArray) images = NULL;
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autofree gchar *output = NULL;
+  gint iterations = DEFAULT_ITERATIONS;
+  guint i;
+  const GOptionEntry entries[] = {
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of runs of every stage", "N" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the JSON report to FILE instead of stdout", "FILE" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("[CAPTURE.png...] - benchmark the imaging pipeline");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (iterations < 1)
+    {
+      g_printerr ("The number of iterations must be positive\n");
+      return 1;
+    }
+
+  images = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < G_N_ELEMENTS (default_captures); i++)
+    {
+      g_autofree gchar *path = NULL;
+
+      path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests",
+                           default_captures[i], "capture.png", NULL);
+      g_ptr_array_add (images, load_capture (path));
+    }
+  for (i = 1; i < argc; i++)
+    g_ptr_array_add (images, load_capture (argv[i]));
+
+  /* Warm up caches and the GTask thread pool */
+  for (i = 0; i < images->len; i++)
+    detect_minutiae (g_ptr_array_index (images, i));
+
+  report = fpt_bench_report_new ("imaging", iterations);
+  prints = g_ptr_array_new_with_free_func (g_object_unref);
+
+  bench_assemble (report, iterations);
+  bench_assemble_lines (report, iterations);
+  bench_minutiae (report, images, iterations);
+  bench_extract (report, images, prints, iterations);
+  bench_match (report, prints, iterations);
+
+  if (!fpt_bench_report_write (report, output, &error))
+    {
+      g_printerr ("Could not write report: %s\n", error->message);
+      return 1;
+    }
+
+  return 0;
+}
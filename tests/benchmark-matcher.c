@@ -0,0 +1,543 @@
+/*
+ * Benchmark of the BZ3 matcher on a synthetic gallery
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Generates a gallery of synthetic fingers and measures:
+ *
+ *  - "verify-mated": 1:1 fpi_print_bz3_match() of a probe against the
+ *    template of the same finger
+ *  - "verify-non-mated": 1:1 matching against the template of another finger
+ *  - "identify": 1:N matching of a probe against the gallery, stopping at
+ *    the first template above the threshold, like image devices do
+ *  - "score": the raw Bozorth3 scores of mated and non-mated pairs
+ *
+ * The generator is deterministic for a given --seed, so the scores written
+ * with --scores can be compared between matcher implementations.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "fp-print-private.h"
+#include "benchmark-utils.h"
+
+#define MIN_MINUTIA_DISTANCE 8
+#define BORDER 16
+#define NON_MATED_PER_PROBE 10
+
+typedef struct
+{
+  gint    n_minutiae;
+  gint    width;
+  gint    height;
+  gdouble max_rotation;     /* degrees */
+  gint    max_translation;  /* pixels */
+  gint    position_jitter;  /* pixels */
+  gint    angle_jitter;     /* degrees */
+  gdouble drop_rate;        /* chance of a minutia to be missed */
+  gdouble spurious_rate;    /* spurious minutiae per real minutia */
+} GeneratorParams;
+
+typedef struct
+{
+  gdouble x;
+  gdouble y;
+  gdouble theta;
+} SynthMinutia;
+
+typedef struct
+{
+  gint         n;
+  SynthMinutia minutiae[MAX_BOZORTH_MINUTIAE];
+} SynthFinger;
+
+typedef struct
+{
+  gint x;
+  gint y;
+  gint theta;
+} XytRow;
+
+static GeneratorParams params = {
+  .n_minutiae = 40,
+  .width = 256,
+  .height = 360,
+  .max_rotation = 15,
+  .max_translation = 20,
+  .position_jitter = 2,
+  .angle_jitter = 5,
+  .drop_rate = 0.15,
+  .spurious_rate = 0.1,
+};
+
+/* NIST minutiae angles are in the range (-180, 180] */
+static gint
+normalize_angle (gdouble theta)
+{
+  gint angle = (gint) lround (theta) % 360;
+
+  if (angle <= -180)
+    angle += 360;
+  else if (angle > 180)
+    angle -= 360;
+
+  return angle;
+}
+
+static gboolean
+position_is_free (const SynthFinger *finger, gdouble x, gdouble y)
+{
+  gint i;
+
+  for (i = 0; i < finger->n; i++)
+    {
+      gdouble dx = finger->minutiae[i].x - x;
+      gdouble dy = finger->minutiae[i].y - y;
+
+      if (dx * dx + dy * dy < MIN_MINUTIA_DISTANCE * MIN_MINUTIA_DISTANCE)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+synth_finger_generate (SynthFinger *finger, GRand *rand)
+{
+  gdouble core_x, core_y;
+  gint attempts;
+
+  core_x = params.width * g_rand_double_range (rand, 0.35, 0.65);
+  core_y = params.height * g_rand_double_range (rand, 0.3, 0.6);
+
+  finger->n = 0;
+  for (attempts = 0; finger->n < params.n_minutiae && attempts < params.n_minutiae * 100; attempts++)
+    {
+      SynthMinutia *m = &finger->minutiae[finger->n];
+      gdouble x, y, orientation;
+
+      x = g_rand_double_range (rand, BORDER, params.width - BORDER);
+      y = g_rand_double_range (rand, BORDER, params.height - BORDER);
+      if (!position_is_free (finger, x, y))
+        continue;
+
+      /* Ridges run in a loop around the core. Endings and bifurcations
+       * point along the ridge in either direction. */
+      orientation = atan2 (y - core_y, x - core_x) * 90 / G_PI + 90;
+
+      m->x = x;
+      m->y = y;
+      m->theta = orientation + (g_rand_boolean (rand) ? 180 : 0) +
+                 g_rand_double_range (rand, -10, 10);
+      finger->n++;
+    }
+}
+
+static gint
+xyt_row_compare (gconstpointer a, gconstpointer b)
+{
+  const XytRow *row_a = a;
+  const XytRow *row_b = b;
+
+  if (row_a->x != row_b->x)
+    return row_a->x - row_b->x;
+
+  return row_a->y - row_b->y;
+}
+
+static gboolean
+xyt_row_add (XytRow *rows, gint *n_rows, gdouble x, gdouble y, gdouble theta)
+{
+  if (*n_rows >= MAX_BOZORTH_MINUTIAE)
+    return FALSE;
+
+  if (x < 0 || y < 0 || x >= params.width || y >= params.height)
+    return FALSE;
+
+  rows[*n_rows].x = (gint) lround (x);
+  rows[*n_rows].y = (gint) lround (y);
+  rows[*n_rows].theta = normalize_angle (theta);
+  (*n_rows)++;
+
+  return TRUE;
+}
+
+/* Creates one impression of @finger. The finger is rotated and moved as a
+ * whole, every minutia is displaced slightly, some are missed and some
+ * spurious ones are added. If @distort is %FALSE, the minutiae are used
+ * unchanged. */
+static void
+synth_finger_impression (const SynthFinger *finger,
+                         GRand             *rand,
+                         gboolean           distort,
+                         struct xyt_struct *xyt)
+{
+  XytRow rows[MAX_BOZORTH_MINUTIAE];
+  gdouble rotation = 0, dx = 0, dy = 0;
+  gdouble cx = params.width / 2.0, cy = params.height / 2.0;
+  gint n_spurious = 0;
+  gint n_rows = 0;
+  gint i;
+
+  if (distort)
+    {
+      rotation = g_rand_double_range (rand, -params.max_rotation, params.max_rotation);
+      dx = g_rand_int_range (rand, -params.max_translation, params.max_translation + 1);
+      dy = g_rand_int_range (rand, -params.max_translation, params.max_translation + 1);
+      n_spurious = (gint) lround (finger->n * params.spurious_rate);
+    }
+
+  for (i = 0; i < finger->n; i++)
+    {
+      const SynthMinutia *m = &finger->minutiae[i];
+      gdouble rad = rotation * G_PI / 180;
+      gdouble x, y, theta;
+
+      if (distort && g_rand_double (rand) < params.drop_rate)
+        continue;
+
+      x = cx + (m->x - cx) * cos (rad) - (m->y - cy) * sin (rad) + dx;
+      y = cy + (m->x - cx) * sin (rad) + (m->y - cy) * cos (rad) + dy;
+      theta = m->theta + rotation;
+
+      if (distort)
+        {
+          x += g_rand_int_range (rand, -params.position_jitter, params.position_jitter + 1);
+          y += g_rand_int_range (rand, -params.position_jitter, params.position_jitter + 1);
+          theta += g_rand_int_range (rand, -params.angle_jitter, params.angle_jitter + 1);
+        }
+
+      xyt_row_add (rows, &n_rows, x, y, theta);
+    }
+
+  for (i = 0; i < n_spurious; i++)
+    xyt_row_add (rows, &n_rows,
+                 g_rand_double_range (rand, BORDER, params.width - BORDER),
+                 g_rand_double_range (rand, BORDER, params.height - BORDER),
+                 g_rand_double_range (rand, -180, 180));
+
+  /* Same order as minutiae_to_xyt() produces */
+  qsort (rows, n_rows, sizeof (XytRow), xyt_row_compare);
+
+  xyt->nrows = n_rows;
+  for (i = 0; i < n_rows; i++)
+    {
+      xyt->xcol[i] = rows[i].x;
+      xyt->ycol[i] = rows[i].y;
+      xyt->thetacol[i] = rows[i].theta;
+    }
+}
+
+static FpPrint *
+synth_print_new (const SynthFinger *finger, GRand *rand, gint n_samples, gboolean distort)
+{
+  FpPrint *print;
+  gint i;
+
+  print = g_object_new (FP_TYPE_PRINT,
+                        "driver", "benchmark",
+                        "device-id", "benchmark",
+                        NULL);
+  g_object_ref_sink (print);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+
+  for (i = 0; i < n_samples; i++)
+    {
+      struct xyt_struct *xyt = g_new0 (struct xyt_struct, 1);
+
+      synth_finger_impression (finger, rand, distort || i > 0, xyt);
+      g_ptr_array_add (print->prints, xyt);
+    }
+
+  return print;
+}
+
+static void
+bench_verify (FptBenchReport *report,
+              const gchar    *name,
+              GPtrArray      *templates,
+              GPtrArray      *probes,
+              guint           offset,
+              gint            threshold,
+              guint           iterations)
+{
+  FptBenchStage *stage;
+  guint matches = 0;
+  guint i, j;
+
+  stage = fpt_bench_report_begin_stage (report, name);
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < probes->len; j++)
+        {
+          g_autoptr(GError) error = NULL;
+          FpPrint *template = g_ptr_array_index (templates, (j + offset) % templates->len);
+          gint64 start = g_get_monotonic_time ();
+          FpiMatchResult result;
+
+          result = fpi_print_bz3_match (template, g_ptr_array_index (probes, j),
+                                        threshold, &error);
+
+          fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+          if (result == FPI_MATCH_ERROR)
+            g_error ("Matching failed: %s", error->message);
+
+          if (i == 0 && result == FPI_MATCH_SUCCESS)
+            matches++;
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  fpt_bench_stage_add_metric (stage, "match-rate", matches / (gdouble) probes->len);
+}
+
+static void
+bench_identify (FptBenchReport *report,
+                GPtrArray      *templates,
+                GPtrArray      *probes,
+                gint            threshold,
+                guint           iterations)
+{
+  FptBenchStage *stage;
+  guint correct = 0, wrong = 0, missed = 0;
+  guint i, j, k;
+
+  stage = fpt_bench_report_begin_stage (report, "identify");
+
+  for (i = 0; i < iterations; i++)
+    {
+      for (j = 0; j < probes->len; j++)
+        {
+          gint64 start = g_get_monotonic_time ();
+          gint found = -1;
+
+          for (k = 0; k < templates->len; k++)
+            {
+              g_autoptr(GError) error = NULL;
+              FpiMatchResult result;
+
+              result = fpi_print_bz3_match (g_ptr_array_index (templates, k),
+                                            g_ptr_array_index (probes, j),
+                                            threshold, &error);
+              if (result == FPI_MATCH_ERROR)
+                g_error ("Matching failed: %s", error->message);
+
+              if (result == FPI_MATCH_SUCCESS)
+                {
+                  found = k;
+                  break;
+                }
+            }
+
+          fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+          if (i > 0)
+            continue;
+
+          if (found < 0)
+            missed++;
+          else if (found == j)
+            correct++;
+          else
+            wrong++;
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  fpt_bench_stage_add_metric (stage, "gallery-size", templates->len);
+  fpt_bench_stage_add_metric (stage, "correct", correct);
+  fpt_bench_stage_add_metric (stage, "wrong", wrong);
+  fpt_bench_stage_add_metric (stage, "missed", missed);
+}
+
+static gint
+score_compare (gconstpointer a, gconstpointer b)
+{
+  return *(const gint *) a - *(const gint *) b;
+}
+
+static void
+add_score_metric (FptBenchStage *stage, const gchar *prefix, const gchar *name, gdouble value)
+{
+  g_autofree gchar *full_name = g_strconcat (prefix, "-", name, NULL);
+
+  fpt_bench_stage_add_metric (stage, full_name, value);
+}
+
+static void
+add_score_metrics (FptBenchStage *stage, const gchar *prefix, GArray *scores, gint threshold)
+{
+  guint above = 0;
+  gdouble sum = 0;
+  guint i;
+
+  if (scores->len == 0)
+    return;
+
+  g_array_sort (scores, score_compare);
+  for (i = 0; i < scores->len; i++)
+    {
+      sum += g_array_index (scores, gint, i);
+      if (g_array_index (scores, gint, i) >= threshold)
+        above++;
+    }
+
+  add_score_metric (stage, prefix, "min", g_array_index (scores, gint, 0));
+  add_score_metric (stage, prefix, "p50", g_array_index (scores, gint, (scores->len - 1) / 2));
+  add_score_metric (stage, prefix, "mean", sum / scores->len);
+  add_score_metric (stage, prefix, "max", g_array_index (scores, gint, scores->len - 1));
+  add_score_metric (stage, prefix, "above-threshold", above / (gdouble) scores->len);
+}
+
+static gboolean
+bench_scores (FptBenchReport *report,
+              GPtrArray      *templates,
+              GPtrArray      *probes,
+              gint            threshold,
+              const gchar    *scores_file,
+              GError        **error)
+{
+  g_autoptr(GArray) mated = g_array_new (FALSE, FALSE, sizeof (gint));
+  g_autoptr(GArray) non_mated = g_array_new (FALSE, FALSE, sizeof (gint));
+  g_autoptr(GString) dump = g_string_new (NULL);
+  FptBenchStage *stage;
+  guint i, k;
+
+  stage = fpt_bench_report_begin_stage (report, "score");
+
+  for (i = 0; i < probes->len; i++)
+    {
+      FpPrint *probe = g_ptr_array_index (probes, i);
+      struct xyt_struct *pstruct = g_ptr_array_index (probe->prints, 0);
+      gint probe_len;
+
+      probe_len = bozorth_probe_init (pstruct);
+
+      for (k = 0; k <= MIN (NON_MATED_PER_PROBE, templates->len - 1); k++)
+        {
+          guint t = (i + k) % templates->len;
+          FpPrint *template = g_ptr_array_index (templates, t);
+          struct xyt_struct *gstruct = g_ptr_array_index (template->prints, 0);
+          gint64 start = g_get_monotonic_time ();
+          gint score;
+
+          score = bozorth_to_gallery (probe_len, pstruct, gstruct);
+
+          fpt_bench_stage_add (stage, g_get_monotonic_time () - start);
+
+          g_array_append_val (k == 0 ? mated : non_mated, score);
+          g_string_append_printf (dump, "%u %u %d\n", i, t, score);
+        }
+    }
+
+  fpt_bench_report_end_stage (report, stage);
+
+  add_score_metrics (stage, "mated", mated, threshold);
+  add_score_metrics (stage, "non-mated", non_mated, threshold);
+
+  if (scores_file)
+    return g_file_set_contents (scores_file, dump->str, dump->len, error);
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(FptBenchReport) report = NULL;
+  g_autoptr(GPtrArray) templates = NULL;
+  g_autoptr(GPtrArray) probes = NULL;
+  g_autoptr(GRand) rand = NULL;
+  g_autofree gchar *output = NULL;
+  g_autofree gchar *scores_file = NULL;
+  gint iterations = 5;
+  gint gallery_size = 50;
+  gint n_samples = 1;
+  gint threshold = 40;
+  gint seed = 1;
+  gint i;
+  const GOptionEntry entries[] = {
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of runs of every stage", "N" },
+    { "gallery", 'g', 0, G_OPTION_ARG_INT, &gallery_size, "Number of fingers in the gallery", "N" },
+    { "samples", 0, 0, G_OPTION_ARG_INT, &n_samples, "Number of impressions per template", "N" },
+    { "minutiae", 'm', 0, G_OPTION_ARG_INT, &params.n_minutiae, "Number of minutiae per finger", "N" },
+    { "rotation", 0, 0, G_OPTION_ARG_DOUBLE, &params.max_rotation, "Largest rotation of an impression in degrees", "DEG" },
+    { "translation", 0, 0, G_OPTION_ARG_INT, &params.max_translation, "Largest translation of an impression in pixels", "PX" },
+    { "drop-rate", 0, 0, G_OPTION_ARG_DOUBLE, &params.drop_rate, "Chance of a minutia to be missed", "RATE" },
+    { "spurious-rate", 0, 0, G_OPTION_ARG_DOUBLE, &params.spurious_rate, "Spurious minutiae per real minutia", "RATE" },
+    { "threshold", 't', 0, G_OPTION_ARG_INT, &threshold, "BZ3 match threshold", "SCORE" },
+    { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed of the generator", "SEED" },
+    { "scores", 0, 0, G_OPTION_ARG_FILENAME, &scores_file, "Write the score of every pair to FILE", "FILE" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the JSON report to FILE instead of stdout", "FILE" },
+    { NULL }
+  };
+
+  context = g_option_context_new ("- benchmark the BZ3 matcher");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (iterations < 1 || gallery_size < 1 || n_samples < 1 ||
+      params.n_minutiae < 1 || params.n_minutiae > MAX_BOZORTH_MINUTIAE)
+    {
+      g_printerr ("Invalid parameters\n");
+      return 1;
+    }
+
+  rand = g_rand_new_with_seed (seed);
+  templates = g_ptr_array_new_with_free_func (g_object_unref);
+  probes = g_ptr_array_new_with_free_func (g_object_unref);
+
+  for (i = 0; i < gallery_size; i++)
+    {
+      SynthFinger finger;
+
+      synth_finger_generate (&finger, rand);
+      g_ptr_array_add (templates, synth_print_new (&finger, rand, n_samples, FALSE));
+      g_ptr_array_add (probes, synth_print_new (&finger, rand, 1, TRUE));
+    }
+
+  report = fpt_bench_report_new ("matcher", iterations);
+
+  bench_verify (report, "verify-mated", templates, probes, 0, threshold, iterations);
+  bench_verify (report, "verify-non-mated", templates, probes, 1, threshold, iterations);
+  bench_identify (report, templates, probes, threshold, iterations);
+
+  if (!bench_scores (report, templates, probes, threshold, scores_file, &error))
+    {
+      g_printerr ("Could not write scores: %s\n", error->message);
+      return 1;
+    }
+
+  if (!fpt_bench_report_write (report, output, &error))
+    {
+      g_printerr ("Could not write report: %s\n", error->message);
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Benchmark helpers for libfprint
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "benchmark-utils.h"
+
+typedef struct
+{
+  gchar  *name;
+  gdouble value;
+} FptBenchMetric;
+
+struct _FptBenchStage
+{
+  gchar  *name;
+  GArray *latencies;
+  GArray *metrics;
+  glong   peak_rss_kb;
+};
+
+struct _FptBenchReport
+{
+  gchar     *name;
+  guint      iterations;
+  GPtrArray *stages;
+};
+
+static void
+reset_peak_rss (void)
+{
+  FILE *f;
+
+  /* Resets VmHWM, supported since Linux 4.0. Without it, the reported
+   * peak covers the whole process up to the end of the stage. */
+  f = fopen ("/proc/self/clear_refs", "w");
+  if (!f)
+    return;
+
+  fputs ("5", f);
+  fclose (f);
+}
+
+static glong
+get_peak_rss_kb (void)
+{
+  g_autofree gchar *status = NULL;
+  struct rusage usage;
+  const gchar *hwm;
+
+  if (g_file_get_contents ("/proc/self/status", &status, NULL, NULL) &&
+      (hwm = strstr (status, "VmHWM:")) != NULL)
+    return strtol (hwm + strlen ("VmHWM:"), NULL, 10);
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    return usage.ru_maxrss;
+
+  return -1;
+}
+
+static void
+fpt_bench_metric_clear (FptBenchMetric *metric)
+{
+  g_free (metric->name);
+}
+
+static void
+fpt_bench_stage_free (FptBenchStage *stage)
+{
+  g_free (stage->name);
+  g_array_unref (stage->latencies);
+  g_array_unref (stage->metrics);
+  g_free (stage);
+}
+
+FptBenchReport *
+fpt_bench_report_new (const gchar *name,
+                      guint        iterations)
+{
+  FptBenchReport *report = g_new0 (FptBenchReport, 1);
+
+  report->name = g_strdup (name);
+  report->iterations = iterations;
+  report->stages = g_ptr_array_new_with_free_func ((GDestroyNotify) fpt_bench_stage_free);
+
+  return report;
+}
+
+void
+fpt_bench_report_free (FptBenchReport *report)
+{
+  g_free (report->name);
+  g_ptr_array_unref (report->stages);
+  g_free (report);
+}
+
+FptBenchStage *
+fpt_bench_report_begin_stage (FptBenchReport *report,
+                              const gchar    *name)
+{
+  FptBenchStage *stage = g_new0 (FptBenchStage, 1);
+
+  stage->name = g_strdup (name);
+  stage->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  stage->metrics = g_array_new (FALSE, FALSE, sizeof (FptBenchMetric));
+  g_array_set_clear_func (stage->metrics, (GDestroyNotify) fpt_bench_metric_clear);
+  g_ptr_array_add (report->stages, stage);
+
+  reset_peak_rss ();
+
+  return stage;
+}
+
+void
+fpt_bench_report_end_stage (FptBenchReport *report,
+                            FptBenchStage  *stage)
+{
+  stage->peak_rss_kb = get_peak_rss_kb ();
+}
+
+void
+fpt_bench_stage_add (FptBenchStage *stage,
+                     gint64         latency_us)
+{
+  g_array_append_val (stage->latencies, latency_us);
+}
+
+void
+fpt_bench_stage_add_metric (FptBenchStage *stage,
+                            const gchar   *name,
+                            gdouble        value)
+{
+  FptBenchMetric metric = { g_strdup (name), value };
+
+  g_array_append_val (stage->metrics, metric);
+}
+
+static gint
+latency_compare (gconstpointer a, gconstpointer b)
+{
+  gint64 latency_a = *(const gint64 *) a;
+  gint64 latency_b = *(const gint64 *) b;
+
+  return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+/* Nearest-rank percentile of the sorted latencies */
+static gint64
+percentile (GArray *sorted, guint p)
+{
+  guint rank;
+
+  if (sorted->len == 0)
+    return 0;
+
+  rank = (sorted->len * p + 99) / 100;
+
+  return g_array_index (sorted, gint64, MAX (rank, 1) - 1);
+}
+
+static void
+append_double (GString *json, gdouble value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_string_append (json, g_ascii_formatd (buf, sizeof (buf), "%.3f", value));
+}
+
+static void
+append_stage (GString *json, FptBenchStage *stage)
+{
+  g_autoptr(GArray) sorted = NULL;
+  gint64 total_us = 0;
+  guint i;
+
+  sorted = g_array_sized_new (FALSE, FALSE, sizeof (gint64), stage->latencies->len);
+  g_array_append_vals (sorted, stage->latencies->data, stage->latencies->len);
+  g_array_sort (sorted, latency_compare);
+
+  for (i = 0; i < sorted->len; i++)
+    total_us += g_array_index (sorted, gint64, i);
+
+  g_string_append_printf (json, "    {\n      \"name\": \"%s\",\n", stage->name);
+  g_string_append_printf (json, "      \"ops\": %u,\n", sorted->len);
+  g_string_append (json, "      \"ops_per_sec\": ");
+  append_double (json, total_us > 0 ? sorted->len * (gdouble) G_USEC_PER_SEC / total_us : 0);
+  g_string_append (json, ",\n      \"mean_us\": ");
+  append_double (json, sorted->len > 0 ? total_us / (gdouble) sorted->len : 0);
+  g_string_append_printf (json, ",\n      \"p50_us\": %" G_GINT64_FORMAT ",\n", percentile (sorted, 50));
+  g_string_append_printf (json, "      \"p99_us\": %" G_GINT64_FORMAT ",\n", percentile (sorted, 99));
+  g_string_append_printf (json, "      \"max_us\": %" G_GINT64_FORMAT ",\n", percentile (sorted, 100));
+  g_string_append_printf (json, "      \"peak_rss_kb\": %ld,\n", stage->peak_rss_kb);
+  g_string_append (json, "      \"metrics\": {");
+
+  for (i = 0; i < stage->metrics->len; i++)
+    {
+      FptBenchMetric *metric = &g_array_index (stage->metrics, FptBenchMetric, i);
+
+      g_string_append_printf (json, "%s\n        \"%s\": ", i > 0 ? "," : "", metric->name);
+      append_double (json, metric->value);
+    }
+
+  g_string_append (json, stage->metrics->len > 0 ? "\n      }\n    }" : "}\n    }");
+}
+
+/* Writes the report as JSON to @filename, or to stdout if it is %NULL */
+gboolean
+fpt_bench_report_write (FptBenchReport *report,
+                        const gchar    *filename,
+                        GError        **error)
+{
+  g_autoptr(GString) json = g_string_new (NULL);
+  guint i;
+
+  g_string_append_printf (json, "{\n  \"benchmark\": \"%s\",\n", report->name);
+  g_string_append_printf (json, "  \"iterations\": %u,\n", report->iterations);
+  g_string_append (json, "  \"stages\": [\n");
+
+  for (i = 0; i < report->stages->len; i++)
+    {
+      if (i > 0)
+        g_string_append (json, ",\n");
+      append_stage (json, g_ptr_array_index (report->stages, i));
+    }
+
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (!filename)
+    {
+      fputs (json->str, stdout);
+      return TRUE;
+    }
+
+  return g_file_set_contents (filename, json->str, json->len, error);
+}
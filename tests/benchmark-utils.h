@@ -0,0 +1,48 @@
+/*
+ * Benchmark helpers for libfprint
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* A benchmark report consists of stages. Every stage collects the latency
+ * of the operations run during it, the peak resident set size while it
+ * was active and any number of additional named metrics. */
+typedef struct _FptBenchReport FptBenchReport;
+typedef struct _FptBenchStage  FptBenchStage;
+
+FptBenchReport *fpt_bench_report_new (const gchar *name,
+                                      guint        iterations);
+void fpt_bench_report_free (FptBenchReport *report);
+
+FptBenchStage *fpt_bench_report_begin_stage (FptBenchReport *report,
+                                             const gchar    *name);
+void fpt_bench_report_end_stage (FptBenchReport *report,
+                                 FptBenchStage  *stage);
+
+void fpt_bench_stage_add (FptBenchStage *stage,
+                          gint64         latency_us);
+void fpt_bench_stage_add_metric (FptBenchStage *stage,
+                                 const gchar   *name,
+                                 gdouble        value);
+
+gboolean fpt_bench_report_write (FptBenchReport *report,
+                                 const gchar    *filename,
+                                 GError        **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FptBenchReport, fpt_bench_report_free)
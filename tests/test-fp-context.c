@@ -92,6 +92,115 @@ test_context_enumerates_new_devices (void)
   fpt_teardown_virtual_device_environment ();
 }
 
+typedef struct
+{
+  guint    devices_added;
+  guint    added_before_done;
+  gboolean done;
+} EnumerateData;
+
+static void
+on_device_added (FpContext *context, FpDevice *device, EnumerateData *data)
+{
+  data->devices_added++;
+}
+
+static void
+on_enumerate_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  EnumerateData *data = user_data;
+
+  g_assert_true (fp_context_enumerate_finish (FP_CONTEXT (source_object), res, &error));
+  g_assert_no_error (error);
+
+  data->added_before_done = data->devices_added;
+  data->done = TRUE;
+}
+
+static void
+test_context_enumerates_async (void)
+{
+  g_autoptr(FpContext) context = NULL;
+  EnumerateData data = { 0, };
+  gint64 start;
+
+  context = fp_context_new ();
+  g_signal_connect (context, "device-added", G_CALLBACK (on_device_added), &data);
+
+  fpt_setup_virtual_device_environment ();
+
+  start = g_get_monotonic_time ();
+  fp_context_enumerate_async (context, NULL, on_enumerate_done, &data);
+
+  while (!data.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_test_message ("Enumeration took %" G_GINT64_FORMAT " us",
+                  g_get_monotonic_time () - start);
+
+  g_assert_cmpuint (data.added_before_done, ==, 1);
+  g_assert_cmpuint (fp_context_get_devices (context)->len, ==, 1);
+
+  fpt_teardown_virtual_device_environment ();
+}
+
+static void
+test_context_probe_timeout (void)
+{
+  g_autoptr(FpContext) context = NULL;
+  EnumerateData data = { 0, };
+
+  context = fp_context_new ();
+  g_signal_connect (context, "device-added", G_CALLBACK (on_device_added), &data);
+  g_assert_cmpuint (fp_context_get_probe_timeout (context), ==, 0);
+
+  fp_context_set_probe_timeout (context, 50);
+  g_assert_cmpuint (fp_context_get_probe_timeout (context), ==, 50);
+
+  fpt_setup_virtual_device_environment ();
+  g_setenv ("FP_VIRTUAL_IMAGE_PROBE_DELAY", "500", TRUE);
+
+  fp_context_enumerate_async (context, NULL, on_enumerate_done, &data);
+
+  while (!data.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Enumeration stopped waiting for the stalled probe */
+  g_assert_cmpuint (data.added_before_done, ==, 0);
+  g_assert_cmpuint (fp_context_get_devices (context)->len, ==, 0);
+
+  /* But the probe was not cancelled, the device shows up once it is done */
+  while (data.devices_added == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (fp_context_get_devices (context)->len, ==, 1);
+  g_assert_cmpstr (fp_device_get_driver (g_ptr_array_index (fp_context_get_devices (context), 0)),
+                   ==, "virtual_image");
+
+  g_unsetenv ("FP_VIRTUAL_IMAGE_PROBE_DELAY");
+  fpt_teardown_virtual_device_environment ();
+}
+
+static void
+test_context_probe_no_timeout (void)
+{
+  g_autoptr(FpContext) context = NULL;
+
+  context = fp_context_new ();
+  fp_context_set_probe_timeout (context, 500);
+
+  fpt_setup_virtual_device_environment ();
+  g_setenv ("FP_VIRTUAL_IMAGE_PROBE_DELAY", "50", TRUE);
+
+  /* A probe that finishes in time holds up enumeration */
+  fp_context_enumerate (context);
+  g_assert_cmpuint (fp_context_get_devices (context)->len, ==, 1);
+
+  g_unsetenv ("FP_VIRTUAL_IMAGE_PROBE_DELAY");
+  fpt_teardown_virtual_device_environment ();
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -101,6 +210,9 @@ main (int argc, char *argv[])
   g_test_add_func ("/context/no-devices", test_context_has_no_devices);
   g_test_add_func ("/context/has-virtual-device", test_context_has_virtual_device);
   g_test_add_func ("/context/enumerates-new-devices", test_context_enumerates_new_devices);
+  g_test_add_func ("/context/enumerates-async", test_context_enumerates_async);
+  g_test_add_func ("/context/probe-timeout", test_context_probe_timeout);
+  g_test_add_func ("/context/probe-no-timeout", test_context_probe_no_timeout);
 
   return g_test_run ();
 }
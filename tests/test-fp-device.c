@@ -19,6 +19,7 @@
 
 #include <libfprint/fprint.h>
 
+#include "fp-device-private.h"
 #include "test-utils.h"
 
 static void
@@ -214,6 +215,287 @@ test_device_has_storage (void)
   g_assert_false (fp_device_has_storage (tctx->device));
 }
 
+static void
+record_transfer (FpDevice       *device,
+                 FpiTransferType type,
+                 guint8          endpoint,
+                 gsize           length,
+                 gssize          actual_length,
+                 GError         *error)
+{
+  FpiUsbTransfer *transfer = fpi_usb_transfer_new (device);
+
+  switch (type)
+    {
+    case FP_TRANSFER_BULK:
+      fpi_usb_transfer_fill_bulk (transfer, endpoint, length);
+      break;
+
+    case FP_TRANSFER_INTERRUPT:
+      fpi_usb_transfer_fill_interrupt (transfer, endpoint, length);
+      break;
+
+    default:
+      fpi_usb_transfer_fill_control (transfer,
+                                     G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST,
+                                     G_USB_DEVICE_REQUEST_TYPE_VENDOR,
+                                     G_USB_DEVICE_RECIPIENT_DEVICE,
+                                     0x0c, 0, 0, length);
+    }
+
+  fpi_usb_transfer_record_submitted (transfer);
+  transfer->actual_length = actual_length;
+  fpi_usb_transfer_record_completed (transfer, error);
+
+  fpi_usb_transfer_unref (transfer);
+}
+
+static void
+assert_statistics (GVariant    *stats,
+                   const gchar *type,
+                   guint8       endpoint,
+                   guint64      submitted,
+                   guint64      completed,
+                   guint64      errors,
+                   guint64      timeouts,
+                   guint64      cancelled,
+                   guint64      short_transfers,
+                   guint64      bytes)
+{
+  g_autoptr(GVariant) histogram = NULL;
+  const gchar *stats_type;
+  guint64 value, total = 0;
+  guint8 stats_endpoint;
+  gsize i;
+
+  g_assert_true (g_variant_lookup (stats, "type", "&s", &stats_type));
+  g_assert_cmpstr (stats_type, ==, type);
+  g_assert_true (g_variant_lookup (stats, "endpoint", "y", &stats_endpoint));
+  g_assert_cmpuint (stats_endpoint, ==, endpoint);
+
+  g_assert_true (g_variant_lookup (stats, "submitted", "t", &value));
+  g_assert_cmpuint (value, ==, submitted);
+  g_assert_true (g_variant_lookup (stats, "completed", "t", &value));
+  g_assert_cmpuint (value, ==, completed);
+  g_assert_true (g_variant_lookup (stats, "errors", "t", &value));
+  g_assert_cmpuint (value, ==, errors);
+  g_assert_true (g_variant_lookup (stats, "timeouts", "t", &value));
+  g_assert_cmpuint (value, ==, timeouts);
+  g_assert_true (g_variant_lookup (stats, "cancelled", "t", &value));
+  g_assert_cmpuint (value, ==, cancelled);
+  g_assert_true (g_variant_lookup (stats, "short", "t", &value));
+  g_assert_cmpuint (value, ==, short_transfers);
+  g_assert_true (g_variant_lookup (stats, "bytes", "t", &value));
+  g_assert_cmpuint (value, ==, bytes);
+
+  /* Every finished transfer is in exactly one latency bucket */
+  histogram = g_variant_lookup_value (stats, "latency-histogram", G_VARIANT_TYPE ("at"));
+  g_assert_nonnull (histogram);
+  for (i = 0; i < g_variant_n_children (histogram); i++)
+    {
+      g_variant_get_child (histogram, i, "t", &value);
+      total += value;
+    }
+  g_assert_cmpuint (total, ==, completed + errors + timeouts + cancelled);
+}
+
+static void
+test_device_statistics (void)
+{
+  g_autoptr(FptContext) tctx = fpt_context_new_with_virtual_imgdev ();
+  g_autoptr(GVariant) stats = NULL;
+  g_autoptr(GVariant) timings = NULL;
+  g_autoptr(GVariant) entry = NULL;
+  g_autoptr(GError) timeout_error = NULL;
+  g_autoptr(GError) cancelled_error = NULL;
+  g_autoptr(GError) failed_error = NULL;
+
+  g_assert_false (fp_device_get_collect_statistics (tctx->device));
+  fp_device_set_collect_statistics (tctx->device, TRUE);
+  g_assert_true (fp_device_get_collect_statistics (tctx->device));
+
+  /* The virtual device does not do any USB transfers */
+  fp_device_open_sync (tctx->device, NULL, NULL);
+  stats = fp_device_get_statistics (tctx->device);
+  g_assert_true (g_variant_is_of_type (stats, G_VARIANT_TYPE ("aa{sv}")));
+  g_assert_cmpuint (g_variant_n_children (stats), ==, 0);
+  g_clear_pointer (&stats, g_variant_unref);
+
+  /* Nothing was scanned yet */
+  timings = fp_device_get_scan_timings (tctx->device);
+  g_assert_true (g_variant_is_of_type (timings, G_VARIANT_TYPE ("a(stt)")));
+  g_assert_cmpuint (g_variant_n_children (timings), ==, 0);
+
+  /* Record transfers as done when submitting them for real */
+  timeout_error = g_error_new_literal (G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT, "timeout");
+  cancelled_error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED, "cancelled");
+  failed_error = g_error_new_literal (G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_IO, "failed");
+
+  record_transfer (tctx->device, FP_TRANSFER_BULK, FPI_USB_ENDPOINT_IN | 2, 64, 64, NULL);
+  record_transfer (tctx->device, FP_TRANSFER_BULK, FPI_USB_ENDPOINT_IN | 2, 64, 10, NULL);
+  record_transfer (tctx->device, FP_TRANSFER_BULK, FPI_USB_ENDPOINT_IN | 2, 64, 0, timeout_error);
+  record_transfer (tctx->device, FP_TRANSFER_INTERRUPT, FPI_USB_ENDPOINT_IN | 1, 8, 0, cancelled_error);
+  record_transfer (tctx->device, FP_TRANSFER_CONTROL, 0, 8, 8, NULL);
+  record_transfer (tctx->device, FP_TRANSFER_CONTROL, 0, 8, -1, failed_error);
+
+  /* Entries are sorted by type and endpoint */
+  stats = fp_device_get_statistics (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (stats), ==, 3);
+
+  entry = g_variant_get_child_value (stats, 0);
+  assert_statistics (entry, "bulk", FPI_USB_ENDPOINT_IN | 2, 3, 2, 0, 1, 0, 2, 74);
+  g_clear_pointer (&entry, g_variant_unref);
+
+  entry = g_variant_get_child_value (stats, 1);
+  assert_statistics (entry, "control", 0, 2, 1, 1, 0, 0, 0, 8);
+  g_clear_pointer (&entry, g_variant_unref);
+
+  entry = g_variant_get_child_value (stats, 2);
+  assert_statistics (entry, "interrupt", FPI_USB_ENDPOINT_IN | 1, 1, 0, 0, 0, 1, 1, 0);
+  g_clear_pointer (&entry, g_variant_unref);
+  g_clear_pointer (&stats, g_variant_unref);
+
+  /* Nothing is recorded while collection is disabled */
+  fp_device_set_collect_statistics (tctx->device, FALSE);
+  g_assert_false (fp_device_get_collect_statistics (tctx->device));
+  record_transfer (tctx->device, FP_TRANSFER_BULK, FPI_USB_ENDPOINT_IN | 3, 64, 64, NULL);
+
+  stats = fp_device_get_statistics (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (stats), ==, 3);
+  g_clear_pointer (&stats, g_variant_unref);
+
+  fp_device_reset_statistics (tctx->device);
+  stats = fp_device_get_statistics (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (stats), ==, 0);
+}
+
+static void
+test_device_scan_timings (void)
+{
+  g_autoptr(FptContext) tctx = fpt_context_new_with_virtual_imgdev ();
+  g_autoptr(GVariant) timings = NULL;
+  const gchar *stage;
+  guint64 start_us, duration_us;
+  gint64 start;
+
+  fp_device_open_sync (tctx->device, NULL, NULL);
+
+  /* Nothing is recorded unless enabled */
+  start = g_get_monotonic_time ();
+  fpi_device_add_scan_timing (tctx->device, "capture", start);
+  timings = fp_device_get_scan_timings (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (timings), ==, 0);
+  g_clear_pointer (&timings, g_variant_unref);
+
+  fp_device_set_collect_statistics (tctx->device, TRUE);
+
+  /* Stages are recorded as they end, but reported in order of their start */
+  fpi_device_add_scan_timing (tctx->device, "match", start + 300);
+  fpi_device_add_scan_timing (tctx->device, "minutiae", start + 100);
+  fpi_device_add_scan_timing (tctx->device, "capture", start);
+
+  timings = fp_device_get_scan_timings (tctx->device);
+  g_assert_true (g_variant_is_of_type (timings, G_VARIANT_TYPE ("a(stt)")));
+  g_assert_cmpuint (g_variant_n_children (timings), ==, 3);
+
+  g_variant_get_child (timings, 0, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "capture");
+  g_assert_cmpuint (start_us, ==, start);
+
+  g_variant_get_child (timings, 1, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "minutiae");
+  g_assert_cmpuint (start_us, ==, start + 100);
+
+  g_variant_get_child (timings, 2, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "match");
+  g_assert_cmpuint (start_us, ==, start + 300);
+  g_clear_pointer (&timings, g_variant_unref);
+
+  /* A new scan starts out empty */
+  fpi_device_clear_scan_timings (tctx->device);
+  timings = fp_device_get_scan_timings (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (timings), ==, 0);
+
+  fp_device_set_collect_statistics (tctx->device, FALSE);
+}
+
+static void
+test_device_scan_timings_merge (void)
+{
+  g_autoptr(FptContext) tctx = fpt_context_new_with_virtual_imgdev ();
+  g_autoptr(GVariant) timings = NULL;
+  g_autoptr(GVariant) phases = NULL;
+  GVariantBuilder builder;
+  const gchar *stage;
+  guint64 start_us, duration_us;
+  gint64 start;
+
+  fp_device_open_sync (tctx->device, NULL, NULL);
+  fp_device_set_collect_statistics (tctx->device, TRUE);
+
+  /* Stages timed elsewhere are merged in order of their start */
+  start = g_get_monotonic_time ();
+  fpi_device_add_scan_timing (tctx->device, "capture", start);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stt)"));
+  g_variant_builder_add (&builder, "(stt)", "minutiae-detect", (guint64) start + 150, (guint64) 50);
+  g_variant_builder_add (&builder, "(stt)", "minutiae-maps", (guint64) start + 100, (guint64) 40);
+  phases = g_variant_ref_sink (g_variant_builder_end (&builder));
+  fpi_device_add_scan_timings (tctx->device, phases);
+
+  timings = fp_device_get_scan_timings (tctx->device);
+  g_assert_cmpuint (g_variant_n_children (timings), ==, 3);
+
+  g_variant_get_child (timings, 0, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "capture");
+  g_assert_cmpuint (start_us, ==, start);
+
+  g_variant_get_child (timings, 1, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "minutiae-maps");
+  g_assert_cmpuint (start_us, ==, start + 100);
+  g_assert_cmpuint (duration_us, ==, 40);
+
+  g_variant_get_child (timings, 2, "(&stt)", &stage, &start_us, &duration_us);
+  g_assert_cmpstr (stage, ==, "minutiae-detect");
+  g_assert_cmpuint (start_us, ==, start + 150);
+  g_assert_cmpuint (duration_us, ==, 50);
+
+  fp_device_set_collect_statistics (tctx->device, FALSE);
+}
+
+static gpointer
+device_thread_func (gpointer user_data)
+{
+  FpDevice *device = user_data;
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GError) error = NULL;
+
+  g_main_context_push_thread_default (context);
+
+  g_assert_true (fp_device_open_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_true (fp_device_is_open (device));
+
+  g_assert_true (fp_device_close_sync (device, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_false (fp_device_is_open (device));
+
+  g_main_context_pop_thread_default (context);
+
+  return NULL;
+}
+
+static void
+test_device_thread_context (void)
+{
+  g_autoptr(FptContext) tctx = fpt_context_new_with_virtual_imgdev ();
+  GThread *thread;
+
+  /* The device is driven entirely from the context of the thread */
+  thread = g_thread_new ("device", device_thread_func, tctx->device);
+  g_thread_join (thread);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -233,6 +515,10 @@ main (int argc, char *argv[])
   g_test_add_func ("/device/sync/supports_identify", test_device_supports_identify);
   g_test_add_func ("/device/sync/supports_capture", test_device_supports_capture);
   g_test_add_func ("/device/sync/has_storage", test_device_has_storage);
+  g_test_add_func ("/device/sync/statistics", test_device_statistics);
+  g_test_add_func ("/device/sync/scan_timings", test_device_scan_timings);
+  g_test_add_func ("/device/sync/scan_timings_merge", test_device_scan_timings_merge);
+  g_test_add_func ("/device/sync/thread_context", test_device_thread_context);
 
   return g_test_run ();
 }
@@ -124,12 +124,928 @@ test_frame_assembling (void)
   g_assert (1);
 }
 
+static void
+test_frame_assembling_reverse (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  int width, height, offset;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+
+  g_autoptr(FpImage) fp_img = NULL;
+  GSList *frames = NULL;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+
+  img = cairo_image_surface_create_from_png (path);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+
+  ctx.get_pixel = cairo_get_pixel;
+  ctx.frame_width = width;
+  ctx.frame_height = 20;
+  ctx.image_width = width;
+
+  offset = 10;
+
+  /* Swipe in the other direction, the list starts at the bottom */
+  for (int y = 0; y + ctx.frame_height < height; y += offset)
+    {
+      cairo_frame *frame = g_new0 (cairo_frame, 1);
+
+      frame->surf = img;
+      frame->width = width;
+      frame->height = height;
+      frame->stride = cairo_image_surface_get_stride (img);
+      frame->data = cairo_image_surface_get_data (img);
+      frame->x = 0;
+      frame->y = y;
+
+      frames = g_slist_prepend (frames, frame);
+    }
+
+  fpi_do_movement_estimation (&ctx, frames);
+  for (GSList *l = frames->next; l != NULL; l = l->next)
+    {
+      cairo_frame * frame = l->data;
+
+      g_assert_cmpint (frame->frame.delta_x, ==, 0);
+      g_assert_cmpint (frame->frame.delta_y, ==, -offset);
+    }
+
+  fp_img = fpi_assemble_frames (&ctx, frames);
+  g_assert_cmpint (fp_img->flags & FPI_IMAGE_V_FLIPPED, ==, 0);
+
+  g_slist_free_full (frames, g_free);
+  cairo_surface_destroy (img);
+}
+
+static unsigned char
+linear_get_pixel (struct fpi_frame_asmbl_ctx *ctx,
+                  struct fpi_frame           *frame,
+                  unsigned int                x,
+                  unsigned int                y)
+{
+  return frame->data[x + y * ctx->frame_width];
+}
+
+static void
+test_frame_assembling_linear (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  int width, height, stride, offset;
+  guchar *data;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+
+  g_autoptr(FpImage) fp_img = NULL;
+  g_autoptr(FpImage) fp_linear_img = NULL;
+  g_autoptr(GArray) offsets = g_array_new (FALSE, FALSE, sizeof (int));
+  GSList *frames = NULL;
+  GSList *linear_frames = NULL;
+  GSList *l, *ll;
+  int i;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+
+  img = cairo_image_surface_create_from_png (path);
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.frame_width = width;
+  ctx.frame_height = 20;
+  ctx.image_width = width;
+
+  /* Irregular movement; every frame is stored twice so that the direct
+   * and the pixel accessor path work on identical data. */
+  offset = 0;
+  for (int y = 0; y + ctx.frame_height < height; y += offset)
+    {
+      struct fpi_frame *frame;
+      gsize frame_size = sizeof (struct fpi_frame) + width * ctx.frame_height;
+
+      frame = g_malloc0 (frame_size);
+      for (int fy = 0; fy < ctx.frame_height; fy++)
+        for (int fx = 0; fx < width; fx++)
+          frame->data[fx + fy * width] = data[fx * 4 + (fy + y) * stride + 1];
+
+      linear_frames = g_slist_append (linear_frames, frame);
+      frames = g_slist_append (frames, g_memdup (frame, frame_size));
+
+      g_array_append_val (offsets, offset);
+      offset = 5 + offsets->len % 7;
+    }
+
+  ctx.linear_frames = FALSE;
+  fpi_do_movement_estimation (&ctx, frames);
+  ctx.linear_frames = TRUE;
+  fpi_do_movement_estimation (&ctx, linear_frames);
+
+  for (l = frames->next, ll = linear_frames->next, i = 1; l != NULL; l = l->next, ll = ll->next, i++)
+    {
+      struct fpi_frame *frame = l->data;
+      struct fpi_frame *linear_frame = ll->data;
+
+      g_assert_cmpint (frame->delta_x, ==, 0);
+      g_assert_cmpint (frame->delta_y, ==, g_array_index (offsets, int, i));
+      g_assert_cmpint (linear_frame->delta_x, ==, frame->delta_x);
+      g_assert_cmpint (linear_frame->delta_y, ==, frame->delta_y);
+    }
+
+  ctx.linear_frames = FALSE;
+  fp_img = fpi_assemble_frames (&ctx, frames);
+  ctx.linear_frames = TRUE;
+  fp_linear_img = fpi_assemble_frames (&ctx, linear_frames);
+
+  g_assert_cmpint (fp_img->width, ==, fp_linear_img->width);
+  g_assert_cmpint (fp_img->height, ==, fp_linear_img->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   fp_linear_img->data, fp_linear_img->width * fp_linear_img->height);
+
+  g_slist_free_full (frames, g_free);
+  g_slist_free_full (linear_frames, g_free);
+  cairo_surface_destroy (img);
+}
+
+/* Cuts frames of @frame_width out of the middle of @img. Between two
+ * frames the position moves down by @offsets and sideways by @drifts,
+ * which may be %NULL for a straight swipe. */
+static GSList *
+create_linear_frames (cairo_surface_t *img,
+                      int              frame_width,
+                      int              frame_height,
+                      const int       *offsets,
+                      const int       *drifts,
+                      int              num_offsets)
+{
+  guchar *data = cairo_image_surface_get_data (img);
+  int width = cairo_image_surface_get_width (img);
+  int height = cairo_image_surface_get_height (img);
+  int stride = cairo_image_surface_get_stride (img);
+  GSList *frames = NULL;
+  int x = (width - frame_width) / 2;
+  int y = 0;
+
+  for (int i = 0; y + frame_height < height && x >= 0 && x + frame_width <= width; i++)
+    {
+      struct fpi_frame *frame;
+
+      frame = g_malloc0 (sizeof (struct fpi_frame) + frame_width * frame_height);
+      for (int fy = 0; fy < frame_height; fy++)
+        for (int fx = 0; fx < frame_width; fx++)
+          frame->data[fx + fy * frame_width] = data[(fx + x) * 4 + (fy + y) * stride + 1];
+
+      frames = g_slist_prepend (frames, frame);
+
+      y += offsets[i % num_offsets];
+      if (drifts)
+        x += drifts[i % num_offsets];
+    }
+
+  return g_slist_reverse (frames);
+}
+
+/* Checks the deltas against the movement that create_linear_frames()
+ * applied, for frames in the order of the swipe or reversed. */
+static void
+assert_frame_deltas (GSList    *frames,
+                     gboolean   reverse,
+                     const int *offsets,
+                     const int *drifts,
+                     int        num_offsets)
+{
+  int num_frames = g_slist_length (frames);
+  GSList *l;
+  int i;
+
+  for (l = frames->next, i = 1; l != NULL; l = l->next, i++)
+    {
+      struct fpi_frame *frame = l->data;
+      int step = reverse ? num_frames - 1 - i : i - 1;
+      int sign = reverse ? -1 : 1;
+
+      g_assert_cmpint (frame->delta_x, ==, sign * (drifts ? drifts[step % num_offsets] : 0));
+      g_assert_cmpint (frame->delta_y, ==, sign * offsets[step % num_offsets]);
+    }
+}
+
+static void
+test_frame_assembling_predictive (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  /* A smooth change of speed, followed by a jump that the predictive
+   * search can only handle by falling back to the full search. */
+  const int offsets[] = { 4, 4, 5, 6, 6, 7, 8, 8, 7, 6, 14, 13, 5, 4, 3 };
+  /* A finger that wanders sideways, changing direction on the way. */
+  const int drifts[] = { 1, 2, 2, 3, 2, 1, 0, -1, -2, -2, -1, 0, 1, -1, 0 };
+  int width;
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.linear_frames = TRUE;
+  ctx.frame_height = 20;
+  ctx.search_threshold = 32;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  width = cairo_image_surface_get_width (img);
+  ctx.image_width = width;
+
+  for (int drift = 0; drift <= 1; drift++)
+    {
+      /* Leave room for the frames to move sideways */
+      ctx.frame_width = drift ? width - 40 : width;
+
+      /* Both swipe directions */
+      for (int reverse = 0; reverse <= 1; reverse++)
+        {
+          g_autoptr(FpImage) fp_img = NULL;
+          g_autoptr(FpImage) fp_predictive_img = NULL;
+          GSList *frames, *predictive_frames;
+          GSList *l, *pl;
+
+          frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height,
+                                         offsets, drift ? drifts : NULL, G_N_ELEMENTS (offsets));
+          predictive_frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height,
+                                                    offsets, drift ? drifts : NULL, G_N_ELEMENTS (offsets));
+          if (reverse)
+            {
+              frames = g_slist_reverse (frames);
+              predictive_frames = g_slist_reverse (predictive_frames);
+            }
+
+          ctx.search_mode = FPI_FRAME_SEARCH_EXHAUSTIVE;
+          fpi_do_movement_estimation (&ctx, frames);
+          assert_frame_deltas (frames, reverse, offsets, drift ? drifts : NULL, G_N_ELEMENTS (offsets));
+          fp_img = fpi_assemble_frames (&ctx, frames);
+
+          ctx.search_mode = FPI_FRAME_SEARCH_PREDICTIVE;
+          fpi_do_movement_estimation (&ctx, predictive_frames);
+          assert_frame_deltas (predictive_frames, reverse, offsets, drift ? drifts : NULL, G_N_ELEMENTS (offsets));
+          fp_predictive_img = fpi_assemble_frames (&ctx, predictive_frames);
+
+          for (l = frames, pl = predictive_frames; l != NULL; l = l->next, pl = pl->next)
+            {
+              struct fpi_frame *frame = l->data;
+              struct fpi_frame *predictive_frame = pl->data;
+
+              g_assert_cmpint (frame->delta_x, ==, predictive_frame->delta_x);
+              g_assert_cmpint (frame->delta_y, ==, predictive_frame->delta_y);
+            }
+
+          g_assert_cmpint (fp_img->height, ==, fp_predictive_img->height);
+          g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                           fp_predictive_img->data, fp_predictive_img->width * fp_predictive_img->height);
+
+          g_slist_free_full (frames, g_free);
+          g_slist_free_full (predictive_frames, g_free);
+        }
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_assembling_predictive_periodic (void)
+{
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0);
+  const int offsets[] = { 5, 6, 6, 7, 6, 5 };
+  const int drifts[] = { 3, 4, 4, 3, 3, 4 };
+  guchar *data;
+  int width, height, stride;
+  GSList *frames;
+
+  /* Every row repeats with a period of 6 pixels, so a sideways movement
+   * of d pixels matches just as well at d - 6. The full search tries the
+   * true offset first, the alias only lies inside the predictive window
+   * if that window is placed at the wrong side. */
+  img = cairo_image_surface_create (CAIRO_FORMAT_RGB24, 320, 200);
+  cairo_surface_flush (img);
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  for (int y = 0; y < height; y++)
+    {
+      guchar row[6];
+
+      for (guint i = 0; i < G_N_ELEMENTS (row); i++)
+        row[i] = g_rand_int_range (rand, 0, 256);
+      for (int x = 0; x < width; x++)
+        data[x * 4 + y * stride + 1] = row[x % G_N_ELEMENTS (row)];
+    }
+  cairo_surface_mark_dirty (img);
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.linear_frames = TRUE;
+  ctx.frame_width = 64;
+  ctx.frame_height = 16;
+  ctx.image_width = width;
+  ctx.search_threshold = 32;
+
+  for (int mode = FPI_FRAME_SEARCH_EXHAUSTIVE; mode <= FPI_FRAME_SEARCH_PREDICTIVE; mode++)
+    {
+      frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height,
+                                     offsets, drifts, G_N_ELEMENTS (offsets));
+      g_assert_cmpuint (g_slist_length (frames), >, 10);
+
+      ctx.search_mode = mode;
+      fpi_do_movement_estimation (&ctx, frames);
+      assert_frame_deltas (frames, FALSE, offsets, drifts, G_N_ELEMENTS (offsets));
+
+      g_slist_free_full (frames, g_free);
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_assembling_streaming (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  const int offsets[] = { 4, 5, 6, 7, 8, 9, 8, 7, 6, 5 };
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.linear_frames = TRUE;
+  ctx.frame_height = 20;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  ctx.frame_width = cairo_image_surface_get_width (img);
+  ctx.image_width = ctx.frame_width * 3 / 2;
+
+  for (int estimate = 0; estimate <= 1; estimate++)
+    {
+      for (int reverse = 0; reverse <= 1; reverse++)
+        {
+          g_autoptr(FpImage) fp_img = NULL;
+          g_autoptr(FpImage) fp_streamed_img = NULL;
+          FpiFrameAssembler *assembler;
+          GSList *frames, *l;
+
+          frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height, offsets, NULL, G_N_ELEMENTS (offsets));
+          if (reverse)
+            frames = g_slist_reverse (frames);
+
+          /* Emulate hardware movement estimation, the deltas only need to
+           * be the same for both assembling paths. */
+          if (!estimate)
+            {
+              int i = 0;
+
+              for (l = frames; l != NULL; l = l->next, i++)
+                {
+                  struct fpi_frame *frame = l->data;
+
+                  frame->delta_x = i % 3 - 1;
+                  frame->delta_y = offsets[i % G_N_ELEMENTS (offsets)] * (reverse ? -1 : 1);
+                }
+            }
+
+          assembler = fpi_frame_assembler_new (&ctx, estimate);
+          for (l = frames; l != NULL; l = l->next)
+            fpi_frame_assembler_add_frame (assembler, l->data);
+          g_assert_cmpuint (fpi_frame_assembler_get_n_frames (assembler), ==, g_slist_length (frames));
+          fp_streamed_img = fpi_frame_assembler_finish (assembler);
+          g_assert_cmpuint (fpi_frame_assembler_get_n_frames (assembler), ==, 0);
+          fpi_frame_assembler_free (assembler);
+
+          if (estimate)
+            fpi_do_movement_estimation (&ctx, frames);
+          fp_img = fpi_assemble_frames (&ctx, frames);
+
+          g_assert_cmpint (fp_img->width, ==, fp_streamed_img->width);
+          g_assert_cmpint (fp_img->height, ==, fp_streamed_img->height);
+          g_assert_cmpint (fp_img->flags, ==, fp_streamed_img->flags);
+          g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                           fp_streamed_img->data, fp_streamed_img->width * fp_streamed_img->height);
+
+          g_slist_free_full (frames, g_free);
+        }
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_assembling_streaming_single (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  const int offsets[] = { 4 };
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.linear_frames = TRUE;
+  ctx.frame_height = 20;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  ctx.frame_width = cairo_image_surface_get_width (img);
+  ctx.image_width = ctx.frame_width * 3 / 2;
+
+  /* A swipe that ends after its first frame has no movement, which must
+   * not make the streaming assembler pick the reverse orientation. */
+  for (int estimate = 0; estimate <= 1; estimate++)
+    {
+      g_autoptr(FpImage) fp_img = NULL;
+      g_autoptr(FpImage) fp_streamed_img = NULL;
+      FpiFrameAssembler *assembler;
+      GSList *frames;
+
+      frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height,
+                                     offsets, NULL, G_N_ELEMENTS (offsets));
+      g_slist_free_full (frames->next, g_free);
+      frames->next = NULL;
+
+      assembler = fpi_frame_assembler_new (&ctx, estimate);
+      fpi_frame_assembler_add_frame (assembler, frames->data);
+      fp_streamed_img = fpi_frame_assembler_finish (assembler);
+      fpi_frame_assembler_free (assembler);
+
+      if (estimate)
+        fpi_do_movement_estimation (&ctx, frames);
+      fp_img = fpi_assemble_frames (&ctx, frames);
+
+      g_assert_cmpint (fp_img->width, ==, fp_streamed_img->width);
+      g_assert_cmpint (fp_img->height, ==, fp_streamed_img->height);
+      g_assert_cmpint (fp_img->flags, ==, fp_streamed_img->flags);
+      g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                       fp_streamed_img->data, fp_streamed_img->width * fp_streamed_img->height);
+
+      g_slist_free_full (frames, g_free);
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_assembling_ring (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(FpImage) fp_img = NULL;
+  g_autoptr(FpImage) fp_ring_img = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  struct fpi_asmbl_ring ring;
+  const int offsets[] = { 4, 5, 6, 7, 8, 9, 8, 7, 6, 5 };
+  GSList *frames, *l;
+  guint num_frames, capacity, i;
+
+  ctx.get_pixel = linear_get_pixel;
+  ctx.linear_frames = TRUE;
+  ctx.frame_height = 20;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  ctx.frame_width = cairo_image_surface_get_width (img);
+  ctx.image_width = ctx.frame_width * 3 / 2;
+
+  /* Push all frames into a ring that is too small to hold them, so that
+   * the oldest ones are dropped and the ring wraps around. */
+  frames = create_linear_frames (img, ctx.frame_width, ctx.frame_height, offsets, NULL, G_N_ELEMENTS (offsets));
+  num_frames = g_slist_length (frames);
+  capacity = num_frames - 7;
+
+  fpi_asmbl_ring_init (&ring, sizeof (struct fpi_frame) + ctx.frame_width * ctx.frame_height, capacity);
+  for (l = frames; l != NULL; l = l->next)
+    memcpy (fpi_asmbl_ring_push (&ring), l->data,
+            sizeof (struct fpi_frame) + ctx.frame_width * ctx.frame_height);
+  g_assert_cmpuint (ring.len, ==, capacity);
+
+  for (i = 0; i < num_frames - capacity; i++)
+    {
+      g_free (frames->data);
+      frames = g_slist_delete_link (frames, frames);
+    }
+
+  fpi_do_movement_estimation (&ctx, frames);
+  fp_img = fpi_assemble_frames (&ctx, frames);
+
+  fpi_do_movement_estimation_ring (&ctx, &ring);
+  fp_ring_img = fpi_assemble_frames_ring (&ctx, &ring);
+
+  for (l = frames, i = 0; l != NULL; l = l->next, i++)
+    {
+      struct fpi_frame *frame = l->data;
+      struct fpi_frame *ring_frame = fpi_asmbl_ring_get (&ring, i);
+
+      g_assert_cmpint (frame->delta_x, ==, ring_frame->delta_x);
+      g_assert_cmpint (frame->delta_y, ==, ring_frame->delta_y);
+    }
+
+  g_assert_cmpint (fp_img->height, ==, fp_ring_img->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   fp_ring_img->data, fp_ring_img->width * fp_ring_img->height);
+
+  fpi_asmbl_ring_clear (&ring);
+  g_slist_free_full (frames, g_free);
+  cairo_surface_destroy (img);
+}
+
+static unsigned char
+line_get_pixel (struct fpi_line_asmbl_ctx *ctx,
+                GSList                    *line,
+                unsigned int               x)
+{
+  return ((unsigned char *) line->data)[x];
+}
+
+static int
+line_get_deviation (struct fpi_line_asmbl_ctx *ctx,
+                    GSList                    *line1,
+                    GSList                    *line2)
+{
+  unsigned char *l1 = line1->data;
+  unsigned char *l2 = line2->data;
+  int res = 0;
+
+  for (unsigned int i = 0; i < ctx->line_width; i++)
+    res += ABS (l1[i] - l2[i]);
+
+  return res;
+}
+
+static void
+test_line_assembling_ring (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(FpImage) fp_img = NULL;
+  g_autoptr(FpImage) fp_ring_img = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_line_asmbl_ctx ctx = {
+    .resolution = 10,
+    .median_filter_size = 5,
+    .max_search_offset = 10,
+    .get_deviation = line_get_deviation,
+    .get_pixel = line_get_pixel,
+  };
+  struct fpi_asmbl_ring ring;
+  GSList *lines = NULL;
+  guchar *data;
+  int width, height, stride;
+  int y;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  ctx.line_width = width;
+  ctx.max_height = height * 2;
+
+  /* Repeat every row to emulate a slow swipe, through a ring that drops
+   * the first lines. */
+  fpi_asmbl_ring_init (&ring, width, height);
+  for (y = 0; y < height; y++)
+    {
+      for (int n = 0; n < 2; n++)
+        {
+          guchar *line = fpi_asmbl_ring_push (&ring);
+
+          for (int x = 0; x < width; x++)
+            line[x] = data[x * 4 + y * stride + 1];
+        }
+    }
+  g_assert_cmpuint (ring.len, ==, height);
+
+  for (y = ring.len - 1; y >= 0; y--)
+    lines = g_slist_prepend (lines, fpi_asmbl_ring_get (&ring, y));
+
+  fp_img = fpi_assemble_lines (&ctx, lines, ring.len);
+  fp_ring_img = fpi_assemble_lines_ring (&ctx, &ring);
+
+  g_assert_cmpint (fp_img->height, >, 0);
+  g_assert_cmpint (fp_img->height, ==, fp_ring_img->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   fp_ring_img->data, fp_ring_img->width * fp_ring_img->height);
+
+  g_slist_free (lines);
+  fpi_asmbl_ring_clear (&ring);
+  cairo_surface_destroy (img);
+}
+
+/* Lines laid out like the ones of vfs5011: the image pixels start at byte 8,
+ * and the second scanner, used to estimate the speed, at byte 168. */
+#define TEST_LINE_SIZE 240
+#define TEST_LINE_PIXEL_OFFSET 8
+#define TEST_LINE_SCANNER_DISTANCE 4
+
+static unsigned char
+test_line_get_pixel (struct fpi_line_asmbl_ctx *ctx,
+                     GSList                    *line,
+                     unsigned int               x)
+{
+  return ((unsigned char *) line->data)[TEST_LINE_PIXEL_OFFSET + x];
+}
+
+static int
+test_line_get_deviation (struct fpi_line_asmbl_ctx *ctx,
+                         GSList                    *line1,
+                         GSList                    *line2)
+{
+  return fpi_sum_std_sq_dev ((unsigned char *) line1->data + 56,
+                             (unsigned char *) line2->data + 168,
+                             64, 1);
+}
+
+/* Emulates a swipe over the image at a varying speed */
+static void
+create_test_lines (cairo_surface_t       *img,
+                   struct fpi_asmbl_ring *lines,
+                   unsigned int           num_lines)
+{
+  guchar *data = cairo_image_surface_get_data (img);
+  int width = cairo_image_surface_get_width (img);
+  int height = cairo_image_surface_get_height (img);
+  int stride = cairo_image_surface_get_stride (img);
+  int y_f = 0;
+
+  fpi_asmbl_ring_init (lines, TEST_LINE_SIZE, num_lines);
+  for (unsigned int i = 0; i < num_lines; i++)
+    {
+      guchar *line = fpi_asmbl_ring_push (lines);
+      int y = (y_f >> 8) % (height - TEST_LINE_SCANNER_DISTANCE);
+
+      memset (line, 0, TEST_LINE_SIZE);
+      for (int x = 0; x < MIN (width, 160); x++)
+        line[TEST_LINE_PIXEL_OFFSET + x] = data[x * 4 + y * stride + 1];
+      for (int x = 0; x < 64; x++)
+        line[168 + x] = 255 - data[(x + 48) * 4 + (y + TEST_LINE_SCANNER_DISTANCE) * stride + 1];
+
+      /* Between 1/4 and 3/4 image rows per line */
+      y_f += 64 + (i % 128);
+    }
+}
+
+static void
+test_line_assembling_linear (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(FpImage) fp_img = NULL;
+  g_autoptr(FpImage) fp_linear_img = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_line_asmbl_ctx ctx = {
+    .line_width = 160,
+    .max_height = 2000,
+    .resolution = 10,
+    .median_filter_size = 25,
+    .max_search_offset = 30,
+    .pixel_offset = TEST_LINE_PIXEL_OFFSET,
+    .get_deviation = test_line_get_deviation,
+    .get_pixel = test_line_get_pixel,
+  };
+  struct fpi_asmbl_ring lines;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  create_test_lines (img, &lines, 1000);
+
+  ctx.linear_lines = FALSE;
+  fp_img = fpi_assemble_lines_ring (&ctx, &lines);
+  ctx.linear_lines = TRUE;
+  fp_linear_img = fpi_assemble_lines_ring (&ctx, &lines);
+
+  g_assert_cmpint (fp_img->height, >, 0);
+  g_assert_cmpint (fp_img->height, ==, fp_linear_img->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   fp_linear_img->data, fp_linear_img->width * fp_linear_img->height);
+
+  fpi_asmbl_ring_clear (&lines);
+  cairo_surface_destroy (img);
+}
+
+static void
+test_line_assembling_perf (void)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_line_asmbl_ctx ctx = {
+    .line_width = 160,
+    .max_height = 2000,
+    .resolution = 10,
+    .median_filter_size = 25,
+    .max_search_offset = 30,
+    .linear_lines = TRUE,
+    .pixel_offset = TEST_LINE_PIXEL_OFFSET,
+    .get_deviation = test_line_get_deviation,
+    .get_pixel = test_line_get_pixel,
+  };
+  struct fpi_asmbl_ring lines;
+  double time;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Not running performance tests");
+      return;
+    }
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  create_test_lines (img, &lines, 2000);
+
+  for (int linear = 0; linear <= 1; linear++)
+    {
+      g_autoptr(FpImage) fp_img = NULL;
+
+      ctx.linear_lines = linear;
+      g_test_timer_start ();
+      fp_img = fpi_assemble_lines_ring (&ctx, &lines);
+      time = g_test_timer_elapsed ();
+
+      g_test_message ("Assembling %u lines into %u rows%s: %f secs",
+                      lines.len, fp_img->height,
+                      linear ? "" : " with a pixel accessor", time);
+    }
+  g_test_minimized_result (time, "%f secs", time);
+
+  fpi_asmbl_ring_clear (&lines);
+  cairo_surface_destroy (img);
+}
+
+static int
+reference_sum_std_sq_dev (const guint8 *buf1, const guint8 *buf2, int size, int stride)
+{
+  int res = 0, mean = 0;
+
+  for (int i = 0; i < size; i++)
+    mean += (int) buf1[i * stride] + (int) buf2[i * stride];
+  mean /= size;
+
+  for (int i = 0; i < size; i++)
+    {
+      int dev = (int) buf1[i * stride] + (int) buf2[i * stride] - mean;
+      res += dev * dev;
+    }
+
+  return res / size;
+}
+
+static void
+test_line_deviation (void)
+{
+  guint8 buf1[600], buf2[600];
+  GRand *rand = g_rand_new_with_seed (0x50);
+
+  for (int round = 0; round < 3; round++)
+    {
+      /* Random, constant and maximally different data */
+      for (int i = 0; i < sizeof (buf1); i++)
+        {
+          buf1[i] = round == 0 ? g_rand_int_range (rand, 0, 256) : 255;
+          buf2[i] = round == 0 ? g_rand_int_range (rand, 0, 256) : (round == 1 ? 255 : 0);
+        }
+
+      for (int size = 1; size <= 144; size++)
+        {
+          int diff = 0;
+
+          for (int i = 0; i < size; i++)
+            diff += ((int) buf1[i] - buf2[i]) * ((int) buf1[i] - buf2[i]);
+
+          g_assert_cmpint (fpi_sum_sq_diff (buf1, buf2, size), ==, diff);
+          g_assert_cmpint (fpi_mean_sq_diff_norm (buf1, buf2, size), ==, diff / size);
+
+          for (int stride = 1; stride <= 3; stride++)
+            {
+              /* Offset the start, like drivers do to skip a header */
+              g_assert_cmpint (fpi_sum_std_sq_dev (buf1 + 1, buf2 + 3, size, stride), ==,
+                               reference_sum_std_sq_dev (buf1 + 1, buf2 + 3, size, stride));
+            }
+        }
+    }
+
+  g_rand_free (rand);
+}
+
+static int
+cmpint (const void *p1, const void *p2, gpointer data)
+{
+  int a = *((int *) p1);
+  int b = *((int *) p2);
+
+  return (a > b) - (a < b);
+}
+
+/* The straightforward median filter, sorting every window */
+static void
+reference_median_filter (int *data, int size, int filtersize)
+{
+  int *result = g_new0 (int, size);
+  int *sortbuf = g_new0 (int, filtersize);
+
+  for (int i = 0; i < size; i++)
+    {
+      int i1 = MAX (i - (filtersize - 1) / 2, 0);
+      int i2 = MIN (i + (filtersize - 1) / 2, size - 1);
+
+      memcpy (sortbuf, data + i1, (i2 - i1 + 1) * sizeof (int));
+      g_qsort_with_data (sortbuf, i2 - i1 + 1, sizeof (int), cmpint, NULL);
+      result[i] = sortbuf[(i2 - i1 + 1) / 2];
+    }
+  memcpy (data, result, size * sizeof (int));
+  g_free (result);
+  g_free (sortbuf);
+}
+
+static void
+test_median_filter (void)
+{
+  const int sizes[] = { 0, 1, 2, 7, 24, 25, 26, 500 };
+  const int filtersizes[] = { 1, 2, 3, 8, 25, 51 };
+  GRand *rand = g_rand_new_with_seed (0x5011);
+
+  for (int i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      for (int j = 0; j < G_N_ELEMENTS (filtersizes); j++)
+        {
+          g_autofree int *data = g_new (int, sizes[i] + 1);
+          g_autofree int *expected = g_new (int, sizes[i] + 1);
+
+          /* Offsets found by line assembling are small and repeat a lot */
+          for (int k = 0; k < sizes[i]; k++)
+            data[k] = g_rand_int_range (rand, 1, 30);
+          memcpy (expected, data, sizes[i] * sizeof (int));
+
+          reference_median_filter (expected, sizes[i], filtersizes[j]);
+          fpi_median_filter (data, sizes[i], filtersizes[j]);
+
+          g_assert_cmpmem (data, sizes[i] * sizeof (int),
+                           expected, sizes[i] * sizeof (int));
+        }
+    }
+
+  g_rand_free (rand);
+}
+
+static void
+test_median_filter_perf (void)
+{
+  const int size = 100000;
+  const int filtersize = 25;
+  g_autofree int *data = g_new (int, size);
+  g_autofree int *expected = g_new (int, size);
+  GRand *rand = g_rand_new_with_seed (0x5011);
+  double reference_time, time;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Not running performance tests");
+      g_rand_free (rand);
+      return;
+    }
+
+  for (int k = 0; k < size; k++)
+    data[k] = g_rand_int_range (rand, 1, 30);
+  memcpy (expected, data, size * sizeof (int));
+
+  g_test_timer_start ();
+  reference_median_filter (expected, size, filtersize);
+  reference_time = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  fpi_median_filter (data, size, filtersize);
+  time = g_test_timer_elapsed ();
+
+  g_assert_cmpmem (data, size * sizeof (int), expected, size * sizeof (int));
+
+  g_test_message ("Median filter of %d values: %f secs, sorting every window: %f secs",
+                  size, time, reference_time);
+  g_test_minimized_result (time, "%f secs", time);
+
+  g_rand_free (rand);
+}
+
 int
 main (int argc, char *argv[])
 {
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/assembling/frames", test_frame_assembling);
+  g_test_add_func ("/assembling/frames-reverse", test_frame_assembling_reverse);
+  g_test_add_func ("/assembling/frames-linear", test_frame_assembling_linear);
+  g_test_add_func ("/assembling/frames-predictive", test_frame_assembling_predictive);
+  g_test_add_func ("/assembling/frames-predictive-periodic", test_frame_assembling_predictive_periodic);
+  g_test_add_func ("/assembling/frames-streaming", test_frame_assembling_streaming);
+  g_test_add_func ("/assembling/frames-streaming-single", test_frame_assembling_streaming_single);
+  g_test_add_func ("/assembling/frames-ring", test_frame_assembling_ring);
+  g_test_add_func ("/assembling/lines-ring", test_line_assembling_ring);
+  g_test_add_func ("/assembling/lines-linear", test_line_assembling_linear);
+  g_test_add_func ("/assembling/lines-perf", test_line_assembling_perf);
+  g_test_add_func ("/assembling/line-deviation", test_line_deviation);
+  g_test_add_func ("/assembling/median-filter", test_median_filter);
+  g_test_add_func ("/assembling/median-filter-perf", test_median_filter_perf);
 
   return g_test_run ();
 }
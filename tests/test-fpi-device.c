@@ -24,6 +24,8 @@
 #include "fpi-device.h"
 #include "fpi-compat.h"
 #include "fpi-log.h"
+#include "fpi-usb-transfer.h"
+#include "fp-device-private.h"
 #include "test-device-fake.h"
 
 /* Utility functions */
@@ -280,6 +282,348 @@ test_driver_get_driver_data (void)
   g_assert_cmpuint (fpi_device_get_driver_data (device), ==, driver_data);
 }
 
+static void
+test_driver_usb_transfer_recycle (void)
+{
+  g_autoptr(FpDevice) device = NULL;
+  FpiUsbTransfer *transfer;
+  FpiUsbTransfer *recycled;
+  guint8 *buffer;
+
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_bulk (transfer, FPI_USB_ENDPOINT_IN | 1, 64);
+  buffer = transfer->buffer;
+  memset (buffer, 0xff, 64);
+  transfer->ssm = GINT_TO_POINTER (1);
+  fpi_usb_transfer_unref (transfer);
+
+  /* The transfer and its buffer are reused, but start out cleared */
+  recycled = fpi_usb_transfer_new (device);
+  g_assert (recycled == transfer);
+  g_assert (recycled->device == device);
+  g_assert_null (recycled->ssm);
+  g_assert_null (recycled->buffer);
+
+  fpi_usb_transfer_fill_bulk (recycled, FPI_USB_ENDPOINT_IN | 1, 32);
+  g_assert (recycled->buffer == buffer);
+  g_assert_cmpint (recycled->length, ==, 32);
+  g_assert_cmpint (recycled->buffer[0], ==, 0);
+  g_assert_cmpint (recycled->buffer[31], ==, 0);
+  fpi_usb_transfer_unref (recycled);
+
+  /* A buffer that is too small is replaced */
+  recycled = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_interrupt (recycled, FPI_USB_ENDPOINT_IN | 1, 128);
+  g_assert_cmpint (recycled->length, ==, 128);
+  g_assert_cmpint (recycled->buffer[127], ==, 0);
+  fpi_usb_transfer_unref (recycled);
+}
+
+static void
+test_driver_usb_transfer_device_ref (void)
+{
+  FpDevice *device;
+  FpDevice *weak_device;
+  FpiUsbTransfer *transfer;
+
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  weak_device = device;
+  g_object_add_weak_pointer (G_OBJECT (device), (gpointer) & weak_device);
+
+  /* A pooled transfer does not hold a reference on the device */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_unref (transfer);
+
+  /* A live transfer keeps the device alive until it is freed */
+  transfer = fpi_usb_transfer_new (device);
+  fpi_usb_transfer_fill_control (transfer,
+                                 G_USB_DEVICE_DIRECTION_DEVICE_TO_HOST,
+                                 G_USB_DEVICE_REQUEST_TYPE_VENDOR,
+                                 G_USB_DEVICE_RECIPIENT_DEVICE,
+                                 0x0c, 0, 0, 8);
+  g_object_unref (device);
+  g_assert_nonnull (weak_device);
+
+  /* Freeing it recycles it into the pool of the finalized device */
+  fpi_usb_transfer_unref (transfer);
+  g_assert_null (weak_device);
+}
+
+typedef struct
+{
+  GPtrArray *submitted;
+  GPtrArray *cancellables;
+  GString   *received;
+  guint      stop_after;
+  gboolean   done;
+  GError    *error;
+} UsbStreamTestData;
+
+static void
+usb_stream_test_data_clear (UsbStreamTestData *data)
+{
+  g_clear_pointer (&data->submitted, g_ptr_array_unref);
+  g_clear_pointer (&data->cancellables, g_ptr_array_unref);
+  if (data->received)
+    g_string_free (g_steal_pointer (&data->received), TRUE);
+  g_clear_error (&data->error);
+}
+
+static void
+usb_stream_test_data_reset (UsbStreamTestData *data)
+{
+  usb_stream_test_data_clear (data);
+
+  data->submitted = g_ptr_array_new ();
+  data->cancellables = g_ptr_array_new_with_free_func (g_object_unref);
+  data->received = g_string_new (NULL);
+  data->stop_after = 0;
+  data->done = FALSE;
+}
+
+static void
+usb_stream_fake_submit (FpiUsbTransfer *transfer,
+                        GCancellable   *cancellable,
+                        gpointer        user_data)
+{
+  UsbStreamTestData *data = user_data;
+
+  g_assert_nonnull (cancellable);
+  g_ptr_array_add (data->submitted, transfer);
+  g_ptr_array_add (data->cancellables, g_object_ref (cancellable));
+}
+
+/* Completes the transfer submitted as @index with a single byte of data,
+ * or with @error if set. */
+static void
+usb_stream_complete (UsbStreamTestData *data,
+                     guint              index,
+                     guint8             byte,
+                     GError            *error)
+{
+  FpiUsbTransfer *transfer;
+
+  g_assert_cmpuint (index, <, data->submitted->len);
+  transfer = g_ptr_array_index (data->submitted, index);
+  g_assert_nonnull (transfer);
+  data->submitted->pdata[index] = NULL;
+
+  transfer->buffer[0] = byte;
+  fpi_usb_transfer_fake_complete (transfer, 1, error);
+}
+
+/* Completes all transfers in flight whose cancellable was cancelled */
+static void
+usb_stream_complete_cancelled (UsbStreamTestData *data)
+{
+  guint i;
+
+  for (i = 0; i < data->submitted->len; i++)
+    {
+      GCancellable *cancellable = g_ptr_array_index (data->cancellables, i);
+
+      if (g_ptr_array_index (data->submitted, i) && g_cancellable_is_cancelled (cancellable))
+        usb_stream_complete (data, i, 0,
+                             g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED, "Cancelled"));
+    }
+}
+
+static void
+usb_stream_data_cb (FpiUsbStream *stream, FpiUsbTransfer *transfer,
+                    FpDevice *device, gpointer user_data)
+{
+  UsbStreamTestData *data = user_data;
+
+  g_assert_false (data->done);
+  g_string_append_c (data->received,
+                     transfer->actual_length > 0 ? transfer->buffer[0] : '-');
+
+  if (data->received->len == data->stop_after)
+    fpi_usb_stream_stop (stream);
+}
+
+static void
+usb_stream_done_cb (FpiUsbStream *stream, FpDevice *device,
+                    gpointer user_data, GError *error)
+{
+  UsbStreamTestData *data = user_data;
+
+  g_assert_false (data->done);
+  g_assert_false (fpi_usb_stream_is_running (stream));
+  data->done = TRUE;
+  data->error = error;
+}
+
+static void
+test_driver_usb_stream_order (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(FpiUsbStream) stream = NULL;
+  UsbStreamTestData data = { 0, };
+
+  usb_stream_test_data_reset (&data);
+  fpi_usb_transfer_set_fake_submit (usb_stream_fake_submit, &data);
+
+  stream = fpi_usb_stream_new (device, FPI_USB_ENDPOINT_IN | 2, 16, 3);
+  fpi_usb_stream_start (stream, 1000, NULL,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+  g_assert_true (fpi_usb_stream_is_running (stream));
+  g_assert_cmpuint (data.submitted->len, ==, 3);
+
+  /* Transfers that complete early wait for the ones submitted before */
+  usb_stream_complete (&data, 2, 'c', NULL);
+  g_assert_cmpstr (data.received->str, ==, "");
+  g_assert_cmpuint (data.submitted->len, ==, 3);
+
+  usb_stream_complete (&data, 0, 'a', NULL);
+  g_assert_cmpstr (data.received->str, ==, "a");
+  g_assert_cmpuint (data.submitted->len, ==, 4);
+
+  usb_stream_complete (&data, 1, 'b', NULL);
+  g_assert_cmpstr (data.received->str, ==, "abc");
+  g_assert_cmpuint (data.submitted->len, ==, 6);
+
+  /* Every completed transfer was resubmitted in order */
+  usb_stream_complete (&data, 3, 'd', NULL);
+  usb_stream_complete (&data, 4, 'e', NULL);
+  g_assert_cmpstr (data.received->str, ==, "abcde");
+  g_assert_false (data.done);
+
+  fpi_usb_stream_stop (stream);
+  usb_stream_complete_cancelled (&data);
+  g_assert_true (data.done);
+  g_assert_no_error (data.error);
+
+  fpi_usb_transfer_set_fake_submit (NULL, NULL);
+  usb_stream_test_data_clear (&data);
+}
+
+static void
+test_driver_usb_stream_stop (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(FpiUsbStream) stream = NULL;
+  UsbStreamTestData data = { 0, };
+
+  usb_stream_test_data_reset (&data);
+  fpi_usb_transfer_set_fake_submit (usb_stream_fake_submit, &data);
+
+  stream = fpi_usb_stream_new (device, FPI_USB_ENDPOINT_IN | 2, 16, 3);
+  data.stop_after = 2;
+  fpi_usb_stream_start (stream, 1000, NULL,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+
+  usb_stream_complete (&data, 0, 'a', NULL);
+  usb_stream_complete (&data, 1, 'b', NULL);
+  g_assert_cmpstr (data.received->str, ==, "ab");
+
+  /* Stopping cancels the transfers in flight, without resubmitting */
+  g_assert_cmpuint (data.submitted->len, ==, 4);
+  g_assert_true (g_cancellable_is_cancelled (g_ptr_array_index (data.cancellables, 2)));
+  g_assert_false (data.done);
+
+  /* Data that still arrives is dropped */
+  usb_stream_complete (&data, 2, 'c', NULL);
+  g_assert_false (data.done);
+
+  usb_stream_complete_cancelled (&data);
+  g_assert_cmpstr (data.received->str, ==, "ab");
+  g_assert_true (data.done);
+  g_assert_no_error (data.error);
+
+  /* The stream can be started again */
+  usb_stream_test_data_reset (&data);
+  fpi_usb_stream_start (stream, 1000, NULL,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+  g_assert_cmpuint (data.submitted->len, ==, 3);
+  usb_stream_complete (&data, 0, 'x', NULL);
+  g_assert_cmpstr (data.received->str, ==, "x");
+
+  fpi_usb_stream_stop (stream);
+  usb_stream_complete_cancelled (&data);
+  g_assert_true (data.done);
+
+  fpi_usb_transfer_set_fake_submit (NULL, NULL);
+  usb_stream_test_data_clear (&data);
+}
+
+static void
+test_driver_usb_stream_cancel (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(FpiUsbStream) stream = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  UsbStreamTestData data = { 0, };
+
+  usb_stream_test_data_reset (&data);
+  fpi_usb_transfer_set_fake_submit (usb_stream_fake_submit, &data);
+
+  stream = fpi_usb_stream_new (device, FPI_USB_ENDPOINT_IN | 2, 16, 3);
+  fpi_usb_stream_start (stream, 1000, cancellable,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+
+  /* Cancelling while all transfers are queued ends the stream */
+  g_cancellable_cancel (cancellable);
+  usb_stream_complete_cancelled (&data);
+
+  g_assert_true (data.done);
+  g_assert_error (data.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_cmpstr (data.received->str, ==, "");
+  g_assert_cmpuint (data.submitted->len, ==, 3);
+
+  fpi_usb_transfer_set_fake_submit (NULL, NULL);
+  usb_stream_test_data_clear (&data);
+}
+
+static void
+test_driver_usb_stream_timeout (void)
+{
+  g_autoptr(FpDevice) device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  g_autoptr(FpiUsbStream) stream = NULL;
+  UsbStreamTestData data = { 0, };
+
+  usb_stream_test_data_reset (&data);
+  fpi_usb_transfer_set_fake_submit (usb_stream_fake_submit, &data);
+
+  stream = fpi_usb_stream_new (device, FPI_USB_ENDPOINT_IN | 2, 16, 3);
+
+  /* By default a timeout ends the stream */
+  fpi_usb_stream_start (stream, 1000, NULL,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+  usb_stream_complete (&data, 0, 0,
+                       g_error_new_literal (G_USB_DEVICE_ERROR,
+                                            G_USB_DEVICE_ERROR_TIMED_OUT,
+                                            "Timed out"));
+  usb_stream_complete_cancelled (&data);
+  g_assert_true (data.done);
+  g_assert_error (data.error, G_USB_DEVICE_ERROR, G_USB_DEVICE_ERROR_TIMED_OUT);
+  g_assert_cmpstr (data.received->str, ==, "");
+
+  /* Or is handed over without data, and the transfer is resubmitted */
+  usb_stream_test_data_reset (&data);
+  fpi_usb_stream_set_continue_on_timeout (stream, TRUE);
+  fpi_usb_stream_start (stream, 1000, NULL,
+                        usb_stream_data_cb, usb_stream_done_cb, &data);
+  usb_stream_complete (&data, 0, 0,
+                       g_error_new_literal (G_USB_DEVICE_ERROR,
+                                            G_USB_DEVICE_ERROR_TIMED_OUT,
+                                            "Timed out"));
+  usb_stream_complete (&data, 1, 'a', NULL);
+  g_assert_cmpstr (data.received->str, ==, "-a");
+  g_assert_cmpuint (data.submitted->len, ==, 5);
+  g_assert_false (data.done);
+
+  fpi_usb_stream_stop (stream);
+  usb_stream_complete_cancelled (&data);
+  g_assert_true (data.done);
+  g_assert_no_error (data.error);
+
+  fpi_usb_transfer_set_fake_submit (NULL, NULL);
+  usb_stream_test_data_clear (&data);
+}
+
 static void
 on_driver_probe_async (GObject *initable, GAsyncResult *res, gpointer user_data)
 {
@@ -2198,6 +2542,12 @@ main (int argc, char *argv[])
   g_test_add_func ("/driver/get_usb_device", test_driver_get_usb_device);
   g_test_add_func ("/driver/get_virtual_env", test_driver_get_virtual_env);
   g_test_add_func ("/driver/get_driver_data", test_driver_get_driver_data);
+  g_test_add_func ("/driver/usb_transfer_recycle", test_driver_usb_transfer_recycle);
+  g_test_add_func ("/driver/usb_transfer_device_ref", test_driver_usb_transfer_device_ref);
+  g_test_add_func ("/driver/usb_stream/order", test_driver_usb_stream_order);
+  g_test_add_func ("/driver/usb_stream/stop", test_driver_usb_stream_stop);
+  g_test_add_func ("/driver/usb_stream/cancel", test_driver_usb_stream_cancel);
+  g_test_add_func ("/driver/usb_stream/timeout", test_driver_usb_stream_timeout);
 
   g_test_add_func ("/driver/probe", test_driver_probe);
   g_test_add_func ("/driver/probe/error", test_driver_probe_error);
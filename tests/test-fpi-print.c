@@ -0,0 +1,152 @@
+/*
+ * FpPrint Unit tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <cairo.h>
+#include "fpi-image.h"
+#include "fpi-print.h"
+#include "fp-print-private.h"
+#include "test-config.h"
+
+#define BZ3_THRESHOLD 40
+
+static FpImage *
+load_capture (const gchar *name)
+{
+  g_autofree gchar *path = NULL;
+  cairo_surface_t *img;
+  FpImage *image;
+  guchar *data;
+  gint width, height, stride;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", name, "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  g_assert_cmpint (cairo_surface_status (img), ==, CAIRO_STATUS_SUCCESS);
+
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  image = fp_image_new (width, height);
+  for (gint y = 0; y < height; y++)
+    for (gint x = 0; x < width; x++)
+      image->data[x + y * width] = data[x * 4 + y * stride + 1];
+
+  cairo_surface_destroy (img);
+
+  return image;
+}
+
+static void
+on_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean *done = user_data;
+
+  g_assert_true (fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, &error));
+  g_assert_no_error (error);
+
+  *done = TRUE;
+}
+
+static FpPrint *
+create_print (FpImage *image)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean done = FALSE;
+  FpPrint *print;
+
+  fp_image_detect_minutiae (image, NULL, on_minutiae_detected, &done);
+  while (!done)
+    g_main_context_iteration (NULL, TRUE);
+
+  print = g_object_new (FP_TYPE_PRINT,
+                        "driver", "test",
+                        "device-id", "test",
+                        NULL);
+  g_object_ref_sink (print);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+
+  g_assert_true (fpi_print_add_from_image (print, image, &error));
+  g_assert_no_error (error);
+
+  return print;
+}
+
+static FpPrint *
+create_print_from_xyt (struct xyt_struct *xyt)
+{
+  FpPrint *print;
+
+  print = g_object_new (FP_TYPE_PRINT,
+                        "driver", "test",
+                        "device-id", "test",
+                        NULL);
+  g_object_ref_sink (print);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+  g_ptr_array_add (print->prints, g_memdup (xyt, sizeof (struct xyt_struct)));
+
+  return print;
+}
+
+static void
+test_print_bz3_match_few_minutiae (void)
+{
+  g_autoptr(FpImage) image = load_capture ("vfs5011");
+  g_autoptr(FpPrint) print = create_print (image);
+  g_autoptr(FpPrint) few = NULL;
+  g_autoptr(FpPrint) template = NULL;
+  g_autoptr(GError) error = NULL;
+  struct xyt_struct xyt;
+  gint probe_len;
+
+  g_assert_cmpint (fpi_print_bz3_match (print, print, BZ3_THRESHOLD, &error), ==, FPI_MATCH_SUCCESS);
+  g_assert_no_error (error);
+
+  /* The same print with too few minutiae for Bozorth to score it */
+  xyt = *(struct xyt_struct *) g_ptr_array_index (print->prints, 0);
+  g_assert_cmpint (xyt.nrows, >=, MIN_COMPUTABLE_BOZORTH_MINUTIAE);
+  xyt.nrows = MIN_COMPUTABLE_BOZORTH_MINUTIAE - 1;
+  few = create_print_from_xyt (&xyt);
+
+  probe_len = bozorth_probe_init (&xyt);
+  g_assert_cmpint (bozorth_to_gallery (probe_len, &xyt, g_ptr_array_index (print->prints, 0)), ==, 0);
+
+  /* Rejected as a probe and skipped as part of a template */
+  g_assert_cmpint (fpi_print_bz3_match (print, few, BZ3_THRESHOLD, &error), ==, FPI_MATCH_FAIL);
+  g_assert_no_error (error);
+  g_assert_cmpint (fpi_print_bz3_match (few, print, BZ3_THRESHOLD, &error), ==, FPI_MATCH_FAIL);
+  g_assert_no_error (error);
+
+  template = create_print_from_xyt (&xyt);
+  fpi_print_add_print (template, print);
+  g_assert_cmpint (template->prints->len, ==, 2);
+  g_assert_cmpint (fpi_print_bz3_match (template, print, BZ3_THRESHOLD, &error), ==, FPI_MATCH_SUCCESS);
+  g_assert_no_error (error);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/print/bz3-match-few-minutiae", test_print_bz3_match_few_minutiae);
+
+  return g_test_run ();
+}
@@ -0,0 +1,158 @@
+/*
+ * uru4000 image decoding unit tests
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "drivers/uru4000_decode.h"
+
+/* Width of a line of the image */
+#define IMAGE_WIDTH 384
+
+/* The bit-serial implementation the driver used before the tables */
+static uint32_t
+update_key (uint32_t key)
+{
+  /* linear feedback shift register
+   * taps at bit positions 1 3 4 7 11 13 20 23 26 29 32 */
+  uint32_t bit = key & 0x9248144d;
+
+  bit ^= bit << 16;
+  bit ^= bit << 8;
+  bit ^= bit << 4;
+  bit ^= bit << 2;
+  bit ^= bit << 1;
+  return (bit & 0x80000000) | (key >> 1);
+}
+
+static uint32_t
+reference_decode (uint8_t *data, int num_bytes, uint32_t key)
+{
+  uint8_t xorbyte;
+  int i;
+
+  for (i = 0; i < num_bytes - 1; i++)
+    {
+      /* calculate xor byte and update key */
+      xorbyte  = ((key >>  4) & 1) << 0;
+      xorbyte |= ((key >>  8) & 1) << 1;
+      xorbyte |= ((key >> 11) & 1) << 2;
+      xorbyte |= ((key >> 14) & 1) << 3;
+      xorbyte |= ((key >> 18) & 1) << 4;
+      xorbyte |= ((key >> 21) & 1) << 5;
+      xorbyte |= ((key >> 24) & 1) << 6;
+      xorbyte |= ((key >> 29) & 1) << 7;
+      key = update_key (key);
+
+      /* decrypt data */
+      data[i] = data[i + 1] ^ xorbyte;
+    }
+
+  /* the final byte is implicitly zero */
+  data[i] = 0;
+  return update_key (key);
+}
+
+static uint32_t
+reference_skip (uint32_t key, int steps)
+{
+  int r;
+
+  for (r = 0; r < steps; r++)
+    key = update_key (key);
+
+  return key;
+}
+
+static void
+check_decode (int num_bytes, uint32_t key)
+{
+  g_autofree uint8_t *data = g_malloc (num_bytes);
+  g_autofree uint8_t *expected = NULL;
+  uint32_t expected_key;
+  int i;
+
+  for (i = 0; i < num_bytes; i++)
+    data[i] = g_test_rand_int_range (0, 256);
+  expected = g_memdup (data, num_bytes);
+
+  expected_key = reference_decode (expected, num_bytes, key);
+  key = uru4000_decode (data, num_bytes, key);
+
+  g_assert_cmpmem (data, num_bytes, expected, num_bytes);
+  g_assert_cmphex (key, ==, expected_key);
+}
+
+static void
+test_uru4000_decode (void)
+{
+  int num_bytes, i;
+
+  uru4000_init_decode_tables ();
+
+  /* Including lengths that are not a multiple of 8 */
+  for (num_bytes = 1; num_bytes <= 100; num_bytes++)
+    for (i = 0; i < 16; i++)
+      check_decode (num_bytes, g_test_rand_int ());
+
+  check_decode (1, 0);
+  check_decode (17, 0xffffffff);
+
+  /* Whole lines and images */
+  check_decode (IMAGE_WIDTH, g_test_rand_int ());
+  check_decode (IMAGE_WIDTH * 3 + 5, g_test_rand_int ());
+  check_decode (IMAGE_WIDTH * 290, g_test_rand_int ());
+}
+
+static void
+test_uru4000_skip (void)
+{
+  int steps, i;
+
+  uru4000_init_decode_tables ();
+
+  for (steps = 0; steps <= 100; steps++)
+    {
+      for (i = 0; i < 16; i++)
+        {
+          uint32_t key = g_test_rand_int ();
+
+          g_assert_cmphex (uru4000_advance_key (key, steps), ==, reference_skip (key, steps));
+        }
+    }
+
+  /* Skipped lines, as done for blocks without image data */
+  for (i = 1; i <= 4; i++)
+    {
+      uint32_t key = g_test_rand_int ();
+
+      g_assert_cmphex (uru4000_advance_key (key, IMAGE_WIDTH * i), ==,
+                       reference_skip (key, IMAGE_WIDTH * i));
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/uru4000/decode", test_uru4000_decode);
+  g_test_add_func ("/uru4000/skip", test_uru4000_skip);
+
+  return g_test_run ();
+}
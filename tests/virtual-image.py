@@ -123,6 +123,12 @@ class VirtualImage(unittest.TestCase):
         while iterate and ctx.pending():
             ctx.iteration(False)
 
+    def send_match_cache_size(self, size, iterate=True):
+        # Set the number of scans kept in the match cache
+        self.con.sendall(struct.pack('ii', -5, size))
+        while iterate and ctx.pending():
+            ctx.iteration(False)
+
     def send_image(self, image, iterate=True):
         img = self.prints[image]
 
@@ -210,6 +216,49 @@ class VirtualImage(unittest.TestCase):
 
         return self._enrolled
 
+    def test_enroll_pipelined(self):
+        # The next scan is accepted while the previous one is processed
+        self._steps = []
+        self._enrolled = None
+        self._submitted = 0
+        self._overlapped = False
+
+        def progress_cb(dev, step, fp, user_data):
+            # A retry would report the same step again
+            self._steps.append(step)
+
+        def done_cb(dev, res):
+            self._enrolled = dev.enroll_finish(res)
+
+        def submit():
+            # Stages are only reported once the minutiae are detected
+            if self._submitted > len(self._steps):
+                self._overlapped = True
+            self._submitted += 1
+            self.send_image('whorl', iterate=False)
+
+        def state_changed_cb(dev, state):
+            # 1 is FPI_IMAGE_DEVICE_STATE_AWAIT_FINGER_ON
+            if int(state) == 1:
+                submit()
+
+        handler = self.dev.connect('fpi-image-device-state-changed', state_changed_cb)
+
+        template = FPrint.Print.new(self.dev)
+        self.dev.enroll(template, None, progress_cb, tuple(), done_cb)
+        submit()
+
+        while self._enrolled is None:
+            ctx.iteration(True)
+
+        self.dev.disconnect(handler)
+
+        # Note: Assumes 5 enroll steps for this device!
+        assert self._overlapped
+        assert self._steps == [1, 2, 3, 4, 5]
+        assert self._submitted == 5
+        assert self._enrolled is not None
+
     def test_enroll_verify(self):
         done = False
 
@@ -345,6 +394,119 @@ class VirtualImage(unittest.TestCase):
             ctx.iteration(True)
         assert(not self._verify_match)
 
+    def test_scan_timings(self):
+        def verify_cb(dev, res):
+            self._verify_match, self._verify_fp = dev.verify_finish(res)
+
+        def verify(template, image):
+            self._verify_match = None
+            self.dev.verify(template, callback=verify_cb)
+            self.send_image(image)
+            while self._verify_match is None:
+                ctx.iteration(True)
+            return self._verify_match
+
+        fp_whorl = self.enroll_print('whorl')
+
+        # A cached result would skip most stages of the repeated scan
+        self.send_match_cache_size(0)
+
+        # Nothing is recorded unless enabled
+        assert verify(fp_whorl, 'whorl')
+        assert self.dev.get_scan_timings().unpack() == []
+
+        self.dev.set_collect_statistics(True)
+        assert verify(fp_whorl, 'whorl')
+        timings = self.dev.get_scan_timings().unpack()
+        self.dev.set_collect_statistics(False)
+
+        stages = [t[0] for t in timings]
+        starts = {t[0]: t[1] for t in timings}
+
+        # Sorted by their start, one entry per stage of the scan
+        assert [t[1] for t in timings] == sorted(t[1] for t in timings)
+        for stage in ['capture', 'minutiae', 'extract', 'match']:
+            assert stages.count(stage) == 1, stage
+
+        assert starts['capture'] <= starts['minutiae']
+        assert starts['minutiae'] <= starts['extract']
+        assert starts['extract'] <= starts['match']
+
+        # The minutiae phases are part of the minutiae stage
+        minutiae = next(t for t in timings if t[0] == 'minutiae')
+        for stage in ['minutiae-maps', 'minutiae-binarize', 'minutiae-detect',
+                      'minutiae-remove', 'minutiae-ridge-count']:
+            assert stages.count(stage) == 1, stage
+        for t in timings:
+            if t[0].startswith('minutiae-'):
+                assert t[1] >= minutiae[1]
+                assert t[1] + t[2] <= minutiae[1] + minutiae[2]
+
+    def test_match_cache(self):
+        def verify_cb(dev, res):
+            self._verify_match, self._verify_fp = dev.verify_finish(res)
+
+        def verify(template, image):
+            self._verify_match = None
+            self._verify_fp = None
+            self.dev.verify(template, callback=verify_cb)
+            self.send_image(image)
+            while self._verify_match is None:
+                ctx.iteration(True)
+
+            stages = [s[0] for s in self.dev.get_scan_timings().unpack()]
+            # Cache hits skip the minutiae detection
+            return self._verify_match, self._verify_fp, 'minutiae' not in stages
+
+        fp_whorl = self.enroll_print('whorl')
+
+        self.dev.set_collect_statistics(True)
+        self.send_match_cache_size(2)
+
+        # Miss, then hit with the same result and a fresh print
+        match, fp_first, hit = verify(fp_whorl, 'whorl')
+        assert match and not hit
+        match, fp_second, hit = verify(fp_whorl, 'whorl')
+        assert match and hit
+        assert fp_second is not fp_first
+        assert fp_second.equal(fp_first)
+
+        match, fp, hit = verify(fp_whorl, 'tented_arch')
+        assert not match and not hit
+        match, fp, hit = verify(fp_whorl, 'tented_arch')
+        assert not match and hit
+
+        # The least recently used scan is evicted
+        match, fp, hit = verify(fp_whorl, 'arch')
+        assert not match and not hit
+        match, fp, hit = verify(fp_whorl, 'tented_arch')
+        assert not match and hit
+        match, fp, hit = verify(fp_whorl, 'whorl')
+        assert match and not hit
+
+        # Enrolling clears the cache
+        fp_whorl = self.enroll_print('whorl')
+        match, fp, hit = verify(fp_whorl, 'whorl')
+        assert match and not hit
+        match, fp, hit = verify(fp_whorl, 'whorl')
+        assert match and hit
+
+        # And so does closing the device
+        self.con.close()
+        self.dev.close_sync()
+        self.dev.open_sync()
+        self.con = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.con.connect(self.sockaddr)
+
+        # The driver enables the cache by default
+        match, fp, hit = verify(fp_whorl, 'whorl')
+        assert match and not hit
+        match, fp, hit = verify(fp_whorl, 'whorl')
+        assert match and hit
+
+        self.send_match_cache_size(0)
+        self.dev.set_collect_statistics(False)
+
 if __name__ == '__main__':
     # avoid writing to stderr
     unittest.main(testRunner=unittest.TextTestRunner(stream=sys.stdout, verbosity=2))